@@ -1,30 +1,134 @@
 #include "hash_policy.h"
+#include "recursive_csmt.h"
+#include "src/concurrent_csmt.h"
 #include "src/csmt.h"
+#include "src/csmt_snapshot.h"
+#include "src/csmt_view.h"
+#include "src/durable_csmt.h"
+#include "src/indexed_csmt.h"
+#include "src/paged_csmt.h"
+#include "src/pool_allocator.h"
+#include "src/sharded_csmt.h"
 #include "utils.h"
 
+#include <atomic>
 #include <bitset>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+/*** count every heap allocation made by the benchmark ***/
+namespace alloc_utils {
+    std::atomic<uint64_t> allocations{0};
+
+    void *allocate(size_t size) {
+        ++allocations;
+        if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+
+    void *allocate(size_t size, std::align_val_t align) {
+        ++allocations;
+        auto alignment = static_cast<size_t>(align);
+        // aligned_alloc wants size to be a multiple of alignment
+        size_t rounded = (size + alignment - 1) / alignment * alignment;
+        if (void *ptr = std::aligned_alloc(alignment, rounded == 0 ? alignment : rounded)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+} // namespace alloc_utils
+
+// every form is replaced, so each pointer is freed by the family that made it
+void *operator new(size_t size) {
+    return alloc_utils::allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return alloc_utils::allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    return alloc_utils::allocate(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    return alloc_utils::allocate(size, align);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
 
 /***  choose hash policy for benchmarks ***/
 //#define DEFAULT_POLICY
 //#define SHA256_POLICY
 #define SHA256_TREE_POLICY
+//#define SHA256_DIGEST_POLICY
 
 constexpr size_t DEF_KEYS = 50'000;
 
 #ifdef DEFAULT_POLICY
-    using tree_type = Csmt<>;
+    using policy_type = DefaultHashPolicy;
+    using hash_type = std::string;
     const char *POLICY_STR = "Default";
 #elif defined(SHA256_POLICY)
-    using tree_type = Csmt<HashPolicySHA256>;
+    using policy_type = HashPolicySHA256;
+    using hash_type = std::string;
     const char *POLICY_STR = "SHA256";
 #elif defined(SHA256_TREE_POLICY)
-    using tree_type = Csmt<HashPolicySHA256Tree>;
+    using policy_type = HashPolicySHA256Tree;
+    using hash_type = std::string;
     const char *POLICY_STR = "SHA256_TREE";
+#elif defined(SHA256_DIGEST_POLICY)
+    using policy_type = HashPolicySHA256Digest;
+    using hash_type = SHA256::digest_t;
+    const char *POLICY_STR = "SHA256_DIGEST";
 #elif
-    using tree_type = Csmt<>;
+    using policy_type = DefaultHashPolicy;
+    using hash_type = std::string;
 #endif
 
+using tree_type = Csmt<policy_type, hash_type>;
+
+template <typename Alloc>
+using alloc_tree_type = Csmt<policy_type, hash_type, std::string, Alloc>;
+
 template <size_t VALUE_SIZE, size_t KEYS = DEF_KEYS>
 void spam_insert() {
     std::cout << "BENCH SPAM INSERT. Operations: " << KEYS
@@ -183,6 +287,685 @@ void spam_all() {
     std::cout << "Average elapsed: " << elapsed_us * 1.0 / KEYS << " us." << std::endl;
 }
 
+template <typename Alloc, size_t VALUE_SIZE, size_t KEYS = DEF_KEYS>
+void spam_insert_erase_alloc(const char *alloc_name) {
+    std::cout << "BENCH ALLOCATIONS (" << alloc_name << "). Operations: " << 2 * KEYS
+              << ". Value size: " << VALUE_SIZE << std::endl;
+
+    std::vector<std::string> values;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        values.push_back(string_utils::generate_random_string(VALUE_SIZE));
+    }
+
+    uint64_t allocations_before = alloc_utils::allocations;
+    time_utils::stage_timer<> st;
+    {
+        alloc_tree_type<Alloc> tree;
+        for (size_t idx = 0; idx < KEYS; ++idx) {
+            tree.insert(idx, values[idx]);
+        }
+        for (size_t idx = 0; idx < KEYS; idx += 2) {
+            tree.erase(idx);
+        }
+        for (size_t idx = 0; idx < KEYS; idx += 2) {
+            tree.insert(idx, values[idx]);
+        }
+    }
+    uint64_t elapsed_us = st.stop_stage<std::chrono::microseconds>().count();
+    uint64_t allocations = alloc_utils::allocations - allocations_before;
+
+    std::cout << "Average elapsed: " << elapsed_us * 1.0 / (2 * KEYS) << " us." << std::endl;
+    std::cout << "Heap allocations: " << allocations << " ("
+              << allocations * 1.0 / (2 * KEYS) << " per operation)." << std::endl;
+}
+
+template <size_t VALUE_SIZE, size_t KEYS = DEF_KEYS>
+void bulk_build() {
+    std::cout << "BENCH BULK BUILD. Keys: " << KEYS << ". Value size: " << VALUE_SIZE
+              << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(idx, string_utils::generate_random_string(VALUE_SIZE));
+    }
+
+    time_utils::stage_timer<> st;
+    tree_type inserted;
+    for (const auto &[key, value] : items) {
+        inserted.insert(key, value);
+    }
+    uint64_t insert_us = st.stop_stage<std::chrono::microseconds>().count();
+
+    st.start_stage();
+    tree_type built = tree_type::build(items);
+    uint64_t build_us = st.stop_stage<std::chrono::microseconds>().count();
+    bench_utils::do_not_optimize(built.size());
+
+    std::cout << "Insert one by one: " << insert_us / 1000.0 << " ms." << std::endl;
+    std::cout << "Bulk build: " << build_us / 1000.0 << " ms." << std::endl;
+}
+
+template <size_t VALUE_SIZE, size_t BATCH, size_t KEYS = DEF_KEYS>
+void batch_insert() {
+    std::cout << "BENCH BATCH INSERT. Keys: " << KEYS << ". Batch: " << BATCH
+              << ". Value size: " << VALUE_SIZE << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(2 * idx, string_utils::generate_random_string(VALUE_SIZE));
+    }
+    tree_type looped = tree_type::build(items);
+    tree_type batched = tree_type::build(items);
+
+    // half of batch updates existing keys, half inserts new ones
+    std::vector<tree_type::op_t> ops;
+    for (size_t idx = 0; idx < BATCH; ++idx) {
+        uint64_t key = (idx * (2 * KEYS / BATCH)) | (idx & 1u);
+        ops.push_back(tree_type::op_t::insert(key, string_utils::generate_random_string(VALUE_SIZE)));
+    }
+
+    time_utils::stage_timer<> st;
+    for (const tree_type::op_t &op : ops) {
+        looped.insert(op.key_, op.value_);
+    }
+    uint64_t loop_us = st.stop_stage<std::chrono::microseconds>().count();
+
+    st.start_stage();
+    batched.apply_batch(ops);
+    uint64_t batch_us = st.stop_stage<std::chrono::microseconds>().count();
+    bench_utils::do_not_optimize(batched.size());
+
+    std::cout << "Insert in loop: " << loop_us / 1000.0 << " ms." << std::endl;
+    std::cout << "Apply batch: " << batch_us / 1000.0 << " ms." << std::endl;
+}
+
+template <size_t VALUE_SIZE, size_t KEYS = 4 * DEF_KEYS>
+void parallel_hashing() {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "BENCH PARALLEL HASHING. Keys: " << KEYS << ". Value size: " << VALUE_SIZE
+              << ". Cores: " << max_threads << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::vector<tree_type::op_t> ops;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(idx, string_utils::generate_random_string(VALUE_SIZE));
+        ops.push_back(tree_type::op_t::insert(idx, items.back().second + "*"));
+    }
+
+    for (size_t threads = 1;; threads = std::min(2 * threads, max_threads)) {
+        time_utils::stage_timer<> st;
+        tree_type tree = tree_type::build(items, {}, threads);
+        uint64_t build_us = st.stop_stage<std::chrono::microseconds>().count();
+
+        tree.set_lazy(true);
+        for (const tree_type::op_t &op : ops) {
+            tree.insert(op.key_, op.value_);
+        }
+        st.start_stage();
+        tree.commit();
+        uint64_t commit_us = st.stop_stage<std::chrono::microseconds>().count();
+        bench_utils::do_not_optimize(tree.root_hash());
+
+        std::cout << "Threads: " << threads << ". Bulk build: " << build_us / 1000.0
+                  << " ms. Commit: " << commit_us / 1000.0 << " ms." << std::endl;
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+template <typename Tree, size_t VALUE_SIZE, size_t KEYS = 2 * DEF_KEYS>
+void descent(const char *descent_name) {
+    std::cout << "BENCH " << descent_name << " DESCENT. Keys: " << KEYS
+              << ". Value size: " << VALUE_SIZE << std::endl;
+
+    std::mt19937_64 generator(KEYS);
+    std::vector<uint64_t> keys(KEYS);
+    std::vector<std::string> values;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        keys[idx] = generator();
+        values.push_back(string_utils::generate_random_string(VALUE_SIZE));
+    }
+
+    Tree tree;
+    time_utils::stage_timer<> st;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        tree.insert(keys[idx], values[idx]);
+    }
+    uint64_t insert_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    st.start_stage();
+    for (size_t round = 0; round < 10; ++round) {
+        for (size_t idx = 0; idx < KEYS; ++idx) {
+            bench_utils::do_not_optimize(tree.contains(keys[idx] + round));
+        }
+    }
+    uint64_t contains_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    st.start_stage();
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        bench_utils::do_not_optimize(tree.membership_proof(keys[idx]));
+    }
+    uint64_t proof_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    st.start_stage();
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        tree.erase(keys[idx]);
+    }
+    uint64_t erase_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    std::cout << "Insert: " << insert_ns * 1.0 / KEYS << " ns. Contains: "
+              << contains_ns * 0.1 / KEYS << " ns. Proof: " << proof_ns * 1.0 / KEYS
+              << " ns. Erase: " << erase_ns * 1.0 / KEYS << " ns." << std::endl;
+}
+
+template <size_t KEYS = 2 * DEF_KEYS>
+void proofs() {
+    std::cout << "BENCH PROOFS. Keys: " << KEYS << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    tree_type tree = tree_type::build(items);
+
+    size_t full_hashes = 0;
+    time_utils::stage_timer<> st;
+    for (const auto &item : items) {
+        tree_type::proof_t proof = tree.membership_proof(item.first);
+        full_hashes += proof.size();
+        bench_utils::do_not_optimize(proof);
+    }
+    uint64_t full_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    size_t compact_hashes = 0;
+    st.start_stage();
+    for (const auto &item : items) {
+        std::optional<tree_type::compact_proof_t> proof = tree.compact_proof(item.first);
+        compact_hashes += proof->siblings_.size();
+        bench_utils::do_not_optimize(proof);
+    }
+    uint64_t compact_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    std::cout << "Full proof: " << full_ns * 1.0 / KEYS << " ns, "
+              << full_hashes * 1.0 / KEYS << " hashes." << std::endl;
+    std::cout << "Compact proof: " << compact_ns * 1.0 / KEYS << " ns, "
+              << compact_hashes * 1.0 / KEYS << " hashes + 8 bytes of directions." << std::endl;
+}
+
+template <size_t KEYS = DEF_KEYS>
+void verify_proofs() {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "BENCH VERIFY PROOFS. Proofs: " << KEYS << ". Cores: " << max_threads
+              << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    tree_type tree = tree_type::build(items);
+    hash_type root = tree.root_hash();
+
+    std::vector<tree_type::proof_t> proofs;
+    std::vector<tree_type::proof_ref_t> refs;
+    for (const auto &item : items) {
+        proofs.push_back(tree.membership_proof(item.first));
+    }
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        refs.push_back({items[idx].first, &items[idx].second, &proofs[idx]});
+    }
+
+    time_utils::stage_timer<> st;
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        bench_utils::do_not_optimize(
+            tree_type::verify(items[idx].first, items[idx].second, proofs[idx], root));
+    }
+    uint64_t loop_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+    std::cout << "Verify in loop: " << loop_ns * 1.0 / KEYS << " ns." << std::endl;
+
+    ThreadPool pool(max_threads);
+    st.start_stage();
+    bench_utils::do_not_optimize(tree_type::verify_many(refs.data(), KEYS, root));
+    uint64_t batch_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+    st.start_stage();
+    bench_utils::do_not_optimize(tree_type::verify_many(refs.data(), KEYS, root, nullptr, &pool));
+    uint64_t pool_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+    std::cout << "Verify many: " << batch_ns * 1.0 / KEYS << " ns. With " << max_threads
+              << " threads: " << pool_ns * 1.0 / KEYS << " ns." << std::endl;
+}
+
+template <size_t KEYS = DEF_KEYS, size_t PROVEN = 1000>
+void multiproof() {
+    std::cout << "BENCH MULTIPROOF. Keys: " << KEYS << ". Proven: " << PROVEN << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    tree_type tree = tree_type::build(items);
+
+    std::vector<uint64_t> keys;
+    for (size_t idx = 0; idx < PROVEN; ++idx) {
+        keys.push_back(items[idx].first);
+    }
+
+    size_t single_hashes = 0;
+    time_utils::stage_timer<> st;
+    for (uint64_t key : keys) {
+        tree_type::proof_t proof = tree.membership_proof(key);
+        single_hashes += proof.size();
+        bench_utils::do_not_optimize(proof);
+    }
+    uint64_t single_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    st.start_stage();
+    std::optional<tree_type::multiproof_t> proof = tree.membership_multiproof(keys);
+    uint64_t multi_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    std::cout << "Proof per key: " << single_ns / 1000 << " us, " << single_hashes
+              << " hashes." << std::endl;
+    std::cout << "Multiproof: " << multi_ns / 1000 << " us, " << proof->hashes_.size()
+              << " hashes + " << proof->shape_.size() + proof->proven_.size() << " bits."
+              << std::endl;
+}
+
+template <size_t KEYS = DEF_KEYS, size_t SPAN = 1000>
+void range_proof() {
+    std::cout << "BENCH RANGE PROOF. Keys: " << KEYS << ". Keys in range: " << SPAN << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    tree_type tree = tree_type::build(items);
+    std::string root = tree.root_hash();
+
+    std::vector<uint64_t> keys;
+    for (const auto &blob : tree) {
+        keys.push_back(blob.key_);
+    }
+    uint64_t first = keys[KEYS / 2];
+    uint64_t last = keys[KEYS / 2 + SPAN - 1];
+
+    size_t single_hashes = 0;
+    time_utils::stage_timer<> st;
+    tree.for_each_in_range(first, last, [&](const tree_type::Blob &blob) {
+        std::optional<tree_type::compact_proof_t> proof = tree.compact_proof(blob.key_);
+        single_hashes += proof->siblings_.size();
+        bench_utils::do_not_optimize(proof);
+    });
+    uint64_t single_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    st.start_stage();
+    std::optional<tree_type::range_proof_t> proof = tree.range_proof(first, last);
+    uint64_t range_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+    bool valid = tree_type::verify_range_proof(first, last, *proof, root);
+    uint64_t verify_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+
+    std::cout << "Proof per key: " << single_ns / 1000 << " us, " << single_hashes
+              << " hashes, completeness not proven." << std::endl;
+    std::cout << "Range proof: " << range_ns / 1000 << " us, " << proof->leaves_.size()
+              << " leaf hashes + " << proof->subtree_.hashes_.size() << " hashes. Verify: "
+              << verify_ns / 1000 << " us, " << (valid ? "valid" : "INVALID") << "." << std::endl;
+}
+
+// readers serve proofs while one writer updates, returns proofs per second
+template <typename Prove, typename Write>
+double serve_proofs(size_t readers, size_t proofs_per_reader, const std::vector<uint64_t> &keys,
+                    Prove prove, Write write) {
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        for (size_t idx = 0; !done.load(); idx = (idx + 1) % keys.size()) {
+            write(keys[idx]);
+        }
+    });
+
+    time_utils::stage_timer<> st;
+    std::vector<std::thread> threads;
+    for (size_t reader = 0; reader < readers; ++reader) {
+        threads.emplace_back([&, reader] {
+            for (size_t idx = 0; idx < proofs_per_reader; ++idx) {
+                bench_utils::do_not_optimize(prove(keys[(reader * 7919 + idx) % keys.size()]));
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    uint64_t us = st.stop_stage<std::chrono::microseconds>().count();
+    done.store(true);
+    writer.join();
+    return readers * proofs_per_reader * 1e6 / std::max<uint64_t>(us, 1);
+}
+
+template <size_t KEYS = DEF_KEYS, size_t PROOFS = 20000>
+void concurrent_readers() {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "BENCH CONCURRENT READERS. Keys: " << KEYS << ". Proofs per reader: " << PROOFS
+              << ". Cores: " << max_threads << std::endl;
+
+    std::vector<uint64_t> keys;
+    std::string value = string_utils::generate_random_string(32);
+    tree_type locked_tree;
+    ConcurrentCsmt<policy_type, hash_type> concurrent_tree;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        keys.push_back(generator());
+        locked_tree.insert(keys.back(), value);
+        concurrent_tree.insert(keys.back(), value);
+    }
+
+    std::mutex mutex;
+    for (size_t readers = 1;; readers = std::min(2 * readers, max_threads)) {
+        double locked = serve_proofs(
+            readers, PROOFS, keys,
+            [&](uint64_t key) {
+                std::lock_guard<std::mutex> lock(mutex);
+                return locked_tree.membership_proof(key);
+            },
+            [&](uint64_t key) {
+                std::lock_guard<std::mutex> lock(mutex);
+                locked_tree.insert(key, value);
+            });
+        double lock_free = serve_proofs(
+            readers, PROOFS, keys,
+            [&](uint64_t key) { return concurrent_tree.membership_proof(key); },
+            [&](uint64_t key) { concurrent_tree.insert(key, value); });
+
+        std::cout << "Readers: " << readers << ". Mutex: " << size_t(locked)
+                  << " proofs/s. Epochs: " << size_t(lock_free) << " proofs/s." << std::endl;
+        if (readers == max_threads) {
+            break;
+        }
+    }
+}
+
+// writers insert their own slices of keys, returns inserts per second
+template <typename Insert>
+double write_slices(size_t writers, const std::vector<uint64_t> &keys, Insert insert) {
+    time_utils::stage_timer<> st;
+    std::vector<std::thread> threads;
+    for (size_t writer = 0; writer < writers; ++writer) {
+        threads.emplace_back([&, writer] {
+            for (size_t idx = writer; idx < keys.size(); idx += writers) {
+                insert(keys[idx]);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    uint64_t us = st.stop_stage<std::chrono::microseconds>().count();
+    return keys.size() * 1e6 / std::max<uint64_t>(us, 1);
+}
+
+template <size_t KEYS = DEF_KEYS, size_t SHARD_BITS = 4>
+void sharded_writers() {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "BENCH SHARDED WRITERS. Keys: " << KEYS << ". Shards: " << (1u << SHARD_BITS)
+              << ". Cores: " << max_threads << std::endl;
+
+    std::vector<uint64_t> keys;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        keys.push_back(generator());
+    }
+    std::string value = string_utils::generate_random_string(32);
+
+    for (size_t writers = 1;; writers = std::min(2 * writers, max_threads)) {
+        std::mutex mutex;
+        tree_type locked_tree;
+        double locked = write_slices(writers, keys, [&](uint64_t key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            locked_tree.insert(key, value);
+        });
+        ShardedCsmt<policy_type, hash_type> sharded_tree(SHARD_BITS);
+        double sharded = write_slices(writers, keys, [&](uint64_t key) {
+            sharded_tree.insert(key, value);
+        });
+        bench_utils::do_not_optimize(sharded_tree.root_hash());
+
+        std::cout << "Writers: " << writers << ". Mutex: " << size_t(locked)
+                  << " inserts/s. Sharded: " << size_t(sharded) << " inserts/s." << std::endl;
+        if (writers == max_threads) {
+            break;
+        }
+    }
+}
+
+template <size_t KEYS = 4 * DEF_KEYS, size_t OPS = 100'000>
+void paged_cache() {
+    using paged_type = PagedCsmt<policy_type, hash_type>;
+    std::cout << "BENCH PAGED TREE. Keys: " << KEYS << ". Ops: " << OPS << std::endl;
+
+    std::vector<uint64_t> keys;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        keys.push_back(generator());
+    }
+    std::string value = string_utils::generate_random_string(32);
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_bench.pages").string();
+    std::remove(path.c_str());
+
+    paged_type tree(path, 1 << 16);
+    for (uint64_t key : keys) {
+        tree.insert(key, value);
+    }
+    size_t pages = tree.pages();
+    std::vector<uint64_t> lookups;
+    for (size_t idx = 0; idx < OPS; ++idx) {
+        lookups.push_back(keys[generator() % KEYS]);
+    }
+
+    for (size_t percent : {1, 5, 10, 25, 50, 100}) {
+        tree.set_cache_pages(std::max<size_t>(1, pages * percent / 100));
+        // warm up, then measure
+        for (size_t idx = 0; idx < OPS / 10; ++idx) {
+            bench_utils::do_not_optimize(tree.contains(lookups[idx]));
+        }
+        tree.reset_cache_stats();
+        time_utils::stage_timer<> st;
+        for (uint64_t key : lookups) {
+            bench_utils::do_not_optimize(tree.contains(key));
+        }
+        uint64_t contains_us = st.stop_stage<std::chrono::microseconds>().count();
+        st.start_stage();
+        for (size_t idx = 0; idx < OPS / 10; ++idx) {
+            bench_utils::do_not_optimize(tree.membership_proof(lookups[idx]));
+        }
+        uint64_t proof_us = st.stop_stage<std::chrono::microseconds>().count();
+        st.start_stage();
+        for (size_t idx = 0; idx < OPS / 10; ++idx) {
+            tree.insert(lookups[idx], value);
+        }
+        uint64_t insert_us = st.stop_stage<std::chrono::microseconds>().count();
+        const auto &stats = tree.cache_stats();
+        std::cout << "Cache " << percent << "% (" << tree.get_cache_pages() << " of " << pages
+                  << " pages). Contains: " << size_t(OPS * 1e6 / std::max<uint64_t>(contains_us, 1))
+                  << " ops/s. Proof: " << size_t(OPS / 10 * 1e6 / std::max<uint64_t>(proof_us, 1))
+                  << " ops/s. Update: " << size_t(OPS / 10 * 1e6 / std::max<uint64_t>(insert_us, 1))
+                  << " ops/s. Hit rate: "
+                  << stats.hits_ * 100.0 / std::max<uint64_t>(stats.hits_ + stats.misses_, 1) << "%."
+                  << std::endl;
+    }
+
+    tree_type memory_tree;
+    for (uint64_t key : keys) {
+        memory_tree.insert(key, value);
+    }
+    time_utils::stage_timer<> st;
+    for (uint64_t key : lookups) {
+        bench_utils::do_not_optimize(memory_tree.contains(key));
+    }
+    uint64_t memory_us = st.stop_stage<std::chrono::microseconds>().count();
+    std::cout << "In memory Csmt. Contains: " << size_t(OPS * 1e6 / std::max<uint64_t>(memory_us, 1))
+              << " ops/s." << std::endl;
+    std::remove(path.c_str());
+}
+
+template <size_t KEYS = DEF_KEYS / 2, size_t BATCH = 1'000>
+void durable_writes() {
+    using durable_type = DurableCsmt<policy_type, hash_type>;
+    std::cout << "BENCH DURABLE WRITES. Keys: " << KEYS << std::endl;
+
+    std::vector<uint64_t> keys;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        keys.push_back(generator());
+    }
+    std::string value = string_utils::generate_random_string(32);
+    std::string dir = (std::filesystem::temp_directory_path() / "csmt_bench_durable").string();
+
+    tree_type memory_tree;
+    double memory = write_slices(1, keys, [&](uint64_t key) {
+        memory_tree.insert(key, value);
+    });
+    std::cout << "In memory: " << size_t(memory) << " inserts/s." << std::endl;
+
+    for (size_t writers : {1, 4, 16}) {
+        std::filesystem::remove_all(dir);
+        durable_type tree(dir);
+        double synced = write_slices(writers, keys, [&](uint64_t key) {
+            tree.insert(key, value);
+        });
+        std::cout << "Sync each write, writers: " << writers << ". " << size_t(synced)
+                  << " inserts/s, " << tree.log().syncs() << " syncs." << std::endl;
+    }
+
+    {
+        std::filesystem::remove_all(dir);
+        durable_type tree(dir);
+        time_utils::stage_timer<> st;
+        std::vector<durable_type::op_t> ops;
+        for (size_t idx = 0; idx < KEYS; ++idx) {
+            ops.push_back(durable_type::op_t::insert(keys[idx], value));
+            if (ops.size() == BATCH || idx + 1 == KEYS) {
+                tree.apply_batch(ops);
+                ops.clear();
+            }
+        }
+        uint64_t us = st.stop_stage<std::chrono::microseconds>().count();
+        std::cout << "Batches of " << BATCH << ": " << size_t(KEYS * 1e6 / std::max<uint64_t>(us, 1))
+                  << " inserts/s, " << tree.log().syncs() << " syncs." << std::endl;
+    }
+
+    {
+        std::filesystem::remove_all(dir);
+        durable_type::options_t options;
+        options.sync_writes_ = false;
+        options.checkpoint_every_ = KEYS / 4;
+        durable_type tree(dir, options);
+        double relaxed = write_slices(1, keys, [&](uint64_t key) {
+            tree.insert(key, value);
+        });
+        tree.sync();
+        std::cout << "No sync per write, background checkpoints: " << size_t(relaxed)
+                  << " inserts/s." << std::endl;
+    }
+
+    {
+        time_utils::stage_timer<> st;
+        durable_type tree(dir);
+        uint64_t us = st.stop_stage<std::chrono::microseconds>().count();
+        std::cout << "Recovery of " << tree.size() << " keys, checkpoint lsn " << tree.checkpoint_lsn()
+                  << " of " << tree.lsn() << ": " << us << " us." << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+}
+
+template <size_t KEYS = 10 * DEF_KEYS, size_t LOOKUPS = 1'000'000>
+void frozen_view() {
+    std::cout << "BENCH FROZEN VIEW. Keys: " << KEYS << ". Lookups: " << LOOKUPS << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    tree_type tree = tree_type::build(items);
+
+    time_utils::stage_timer<> st;
+    auto view = tree.freeze();
+    uint64_t freeze_ms = st.stop_stage<std::chrono::milliseconds>().count();
+
+    std::vector<uint64_t> lookups;
+    for (size_t idx = 0; idx < LOOKUPS; ++idx) {
+        lookups.push_back(items[generator() % KEYS].first);
+    }
+    auto measure = [&](const auto &source, const char *name) {
+        time_utils::stage_timer<> timer;
+        for (uint64_t key : lookups) {
+            bench_utils::do_not_optimize(source.contains(key));
+        }
+        uint64_t contains_ns = timer.stop_stage<std::chrono::nanoseconds>().count();
+        timer.start_stage();
+        for (size_t idx = 0; idx < LOOKUPS / 10; ++idx) {
+            bench_utils::do_not_optimize(source.compact_proof(lookups[idx]));
+        }
+        uint64_t proof_ns = timer.stop_stage<std::chrono::nanoseconds>().count();
+        std::cout << name << ": contains " << contains_ns * 1.0 / LOOKUPS << " ns, compact proof "
+                  << proof_ns * 10.0 / LOOKUPS << " ns." << std::endl;
+    };
+    std::cout << "Freeze: " << freeze_ms << " ms." << std::endl;
+    measure(tree, "Live tree");
+    measure(view, "Frozen view");
+}
+
+template <size_t KEYS = 10 * DEF_KEYS, size_t LOOKUPS = 1'000'000>
+void snapshot_file() {
+    using snapshot_type = CsmtSnapshot<policy_type, hash_type>;
+    std::cout << "BENCH SNAPSHOT FILE. Keys: " << KEYS << ". Lookups: " << LOOKUPS << std::endl;
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    std::mt19937_64 generator(KEYS);
+    for (size_t idx = 0; idx < KEYS; ++idx) {
+        items.emplace_back(generator(), string_utils::generate_random_string(32));
+    }
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_bench.snap").string();
+
+    time_utils::stage_timer<> st;
+    tree_type tree = tree_type::build(items);
+    uint64_t build_us = st.stop_stage<std::chrono::microseconds>().count();
+    st.start_stage();
+    snapshot_type::write(tree, path);
+    uint64_t write_us = st.stop_stage<std::chrono::microseconds>().count();
+    st.start_stage();
+    snapshot_type snapshot = snapshot_type::open(path);
+    uint64_t open_us = st.stop_stage<std::chrono::microseconds>().count();
+    st.start_stage();
+    bool valid = snapshot.verify();
+    uint64_t verify_us = st.stop_stage<std::chrono::microseconds>().count();
+    std::remove(path.c_str());
+
+    std::vector<uint64_t> lookups;
+    for (size_t idx = 0; idx < LOOKUPS; ++idx) {
+        lookups.push_back(items[generator() % KEYS].first);
+    }
+    auto measure = [&](const auto &source, const char *name) {
+        time_utils::stage_timer<> timer;
+        for (uint64_t key : lookups) {
+            bench_utils::do_not_optimize(source.contains(key));
+        }
+        uint64_t contains_ns = timer.stop_stage<std::chrono::nanoseconds>().count();
+        timer.start_stage();
+        for (size_t idx = 0; idx < LOOKUPS / 10; ++idx) {
+            bench_utils::do_not_optimize(source.membership_proof(lookups[idx]));
+        }
+        uint64_t proof_ns = timer.stop_stage<std::chrono::nanoseconds>().count();
+        std::cout << name << ": contains " << contains_ns * 1.0 / LOOKUPS << " ns, proof "
+                  << proof_ns * 10.0 / LOOKUPS << " ns." << std::endl;
+    };
+    std::cout << "Rebuild from items: " << build_us << " us. Write: " << write_us
+              << " us. Open: " << open_us << " us. Verify: " << verify_us << " us"
+              << (valid ? "." : ", FAILED.") << std::endl;
+    measure(tree, "Live tree");
+    measure(snapshot, "Mapped snapshot");
+}
+
 void run_spam_insert() {
     spam_insert<32>();
     spam_insert<256>();
@@ -201,6 +984,63 @@ void run_spam_contains() {
     spam_contains<2048, 100'000>();
 }
 
+void run_spam_alloc() {
+    spam_insert_erase_alloc<std::allocator<void>, 32>("std::allocator");
+    spam_insert_erase_alloc<PoolAllocator<void>, 32>("PoolAllocator");
+    spam_insert_erase_alloc<std::allocator<void>, 2048>("std::allocator");
+    spam_insert_erase_alloc<PoolAllocator<void>, 2048>("PoolAllocator");
+}
+
+void run_bulk_build() {
+    bulk_build<32>();
+    bulk_build<2048>();
+}
+
+void run_batch_insert() {
+    batch_insert<32, 1'000>();
+    batch_insert<32, 10'000>();
+    batch_insert<2048, 10'000>();
+}
+
+void run_parallel_hashing() {
+    parallel_hashing<32>();
+    parallel_hashing<1024>();
+}
+
+void run_descent() {
+    descent<RecursiveCsmt<policy_type, hash_type>, 32>("RECURSIVE");
+    descent<tree_type, 32>("ITERATIVE");
+    descent<IndexedCsmt<policy_type, hash_type>, 32>("INDEXED");
+}
+
+void run_proofs() {
+    proofs();
+    verify_proofs();
+    multiproof();
+    range_proof();
+}
+
+void run_frozen_view() {
+    frozen_view();
+    snapshot_file();
+}
+
+void run_concurrent_readers() {
+    concurrent_readers();
+}
+
+void run_sharded_writers() {
+    sharded_writers();
+}
+
+void run_durable_writes() {
+    durable_writes();
+}
+
+void run_paged_cache() {
+    paged_cache();
+}
+
 void run_spam_all() {
     spam_all<32>();
     spam_all<256>();
@@ -217,4 +1057,26 @@ int main() {
     run_spam_contains();
     std::cout << "-------------------------------------------" << std::endl;
     run_spam_all();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_spam_alloc();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_bulk_build();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_batch_insert();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_parallel_hashing();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_descent();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_proofs();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_frozen_view();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_concurrent_readers();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_sharded_writers();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_durable_writes();
+    std::cout << "-------------------------------------------" << std::endl;
+    run_paged_cache();
 }
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <limits>
 #include <random>
+#include <vector>
 
 namespace log2_impl {
 #ifdef __GNUC__
@@ -88,81 +89,69 @@ void bench_log2() {
 
 void bench_sha256() {
     constexpr uint64_t ITERATIONS = 1e3;
-
-    {
-        std::cout << "BENCH SHA256 4 chars" << std::endl;
-        uint64_t elapsed_ns = 0;
-        time_utils::stage_timer<> st;
-        for (uint64_t i = 0; i < ITERATIONS; ++i) {
-            std::string str = string_utils::generate_random_string(4);
-            bench_utils::do_not_optimize(str);
-            st.start_stage();
-            str = SHA256::hash(str);
-            bench_utils::clobber();
-            elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
+    const SHA256::backend_t initial_backend = SHA256::get_backend();
+
+    for (size_t size : {4, 32, 256, 2048, 16384}) {
+        for (SHA256::backend_t backend : {SHA256::backend_t::SCALAR,
+                                          SHA256::backend_t::AVX2,
+                                          SHA256::backend_t::SHA_NI}) {
+            std::cout << "BENCH SHA256 " << size << " chars, "
+                      << SHA256::backend_name(backend) << std::endl;
+            if (!SHA256::set_backend(backend)) {
+                std::cout << "NOT SUPPORTED BY CPU" << std::endl;
+                continue;
+            }
+
+            uint64_t elapsed_ns = 0;
+            time_utils::stage_timer<> st;
+            for (uint64_t i = 0; i < ITERATIONS; ++i) {
+                std::string str = string_utils::generate_random_string(size);
+                bench_utils::do_not_optimize(str);
+                st.start_stage();
+                str = SHA256::hash(str);
+                bench_utils::clobber();
+                elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
+            }
+            std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
         }
-        std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
     }
 
-    {
-        std::cout << "BENCH SHA256 32 chars" << std::endl;
-        uint64_t elapsed_ns = 0;
-        time_utils::stage_timer<> st;
-        for (uint64_t i = 0; i < ITERATIONS; ++i) {
-            std::string str = string_utils::generate_random_string(32);
-            bench_utils::do_not_optimize(str);
-            st.start_stage();
-            str = SHA256::hash(str);
-            bench_utils::clobber();
-            elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
-        }
-        std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
-    }
+    SHA256::set_backend(initial_backend);
+}
 
-    {
-        std::cout << "BENCH SHA256 256 chars" << std::endl;
-        uint64_t elapsed_ns = 0;
-        time_utils::stage_timer<> st;
-        for (uint64_t i = 0; i < ITERATIONS; ++i) {
-            std::string str = string_utils::generate_random_string(128);
-            bench_utils::do_not_optimize(str);
-            st.start_stage();
-            str = SHA256::hash(str);
-            bench_utils::clobber();
-            elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
-        }
-        std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
-    }
+void bench_sha256_many() {
+    constexpr uint64_t ITERATIONS = 1e2;
+    constexpr size_t MESSAGES = 4096;
+    const size_t initial_lanes = SHA256::get_lanes();
 
-    {
-        std::cout << "BENCH SHA256 2048 chars" << std::endl;
-        uint64_t elapsed_ns = 0;
-        time_utils::stage_timer<> st;
-        for (uint64_t i = 0; i < ITERATIONS; ++i) {
-            std::string str = string_utils::generate_random_string(2048);
-            bench_utils::do_not_optimize(str);
-            st.start_stage();
-            str = SHA256::hash(str);
-            bench_utils::clobber();
-            elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
+    for (size_t size : {65, 130, 1024}) {
+        std::vector<std::string> inputs;
+        for (size_t i = 0; i < MESSAGES; ++i) {
+            inputs.push_back(string_utils::generate_random_string(size));
         }
-        std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
-    }
-
-    {
-        std::cout << "BENCH SHA256 16384 chars" << std::endl;
-        uint64_t elapsed_ns = 0;
-        time_utils::stage_timer<> st;
-        for (uint64_t i = 0; i < ITERATIONS; ++i) {
-            std::string str = string_utils::generate_random_string(16384);
-            bench_utils::do_not_optimize(str);
-            st.start_stage();
-            str = SHA256::hash(str);
-            bench_utils::clobber();
-            elapsed_ns += st.stop_stage<std::chrono::nanoseconds>().count();
+        std::vector<SHA256::part_t> messages(inputs.begin(), inputs.end());
+        std::vector<SHA256::digest_t> digests(MESSAGES);
+
+        for (size_t lanes : {1, 4, 8, 16}) {
+            std::cout << "BENCH SHA256 MANY " << MESSAGES << " x " << size << " chars, "
+                      << lanes << " lanes" << std::endl;
+            if (!SHA256::set_lanes(lanes)) {
+                std::cout << "NOT SUPPORTED BY CPU" << std::endl;
+                continue;
+            }
+
+            time_utils::stage_timer<> st;
+            for (uint64_t i = 0; i < ITERATIONS; ++i) {
+                SHA256::digest_many(messages.data(), MESSAGES, digests.data());
+                bench_utils::do_not_optimize(digests);
+            }
+            auto elapsed_ns = st.stop_stage<std::chrono::nanoseconds>().count();
+            std::cout << "Average per message: " << elapsed_ns * 1.0 / ITERATIONS / MESSAGES
+                      << " ns." << std::endl;
         }
-        std::cout << "Average: " << elapsed_ns * 1.0 / ITERATIONS << " ns." << std::endl;
     }
+
+    SHA256::set_lanes(initial_lanes);
 }
 
 void bench_std_hash() {
@@ -250,6 +239,12 @@ int main() {
 
     std::cout << "-----------------------------" << std::endl;
 
+    std::cout << "BENCH SHA256 MANY (" << SHA256::backend_name(SHA256::get_backend())
+              << " for 1 lane)" << std::endl << std::endl;
+    bench_sha256_many();
+
+    std::cout << "-----------------------------" << std::endl;
+
     std::cout << "BENCH STD HASH" << std::endl << std::endl;
     bench_std_hash();
 }
@@ -3,25 +3,115 @@
 
 #include "contrib/crypto/sha256.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// key in big-endian order, so leaf with key is a fixed size prefix plus leaf hash
+inline std::array<unsigned char, 8> key_bytes(uint64_t key) {
+    std::array<unsigned char, 8> bytes;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = (unsigned char)(key >> (8 * (bytes.size() - 1 - i)));
+    }
+    return bytes;
+}
+
 struct HashPolicySHA256 {
-    static std::string leaf_hash(std::string leaf_value) {
-        return SHA256::hash(std::move(leaf_value));
+    static std::string leaf_hash(const std::string &leaf_value) {
+        return SHA256::hash(leaf_value);
     }
 
     static std::string merge_hash(const std::string &lhs, const std::string &rhs) {
-        return SHA256::hash(lhs + rhs);
+        return SHA256::hash_parts({lhs, rhs});
     }
 };
 
 struct HashPolicySHA256Tree {
     static std::string leaf_hash(const std::string &leaf_value) {
-        return SHA256::hash("0" + leaf_value);
+        return SHA256::hash_parts({"0", leaf_value});
     }
 
     static std::string merge_hash(const std::string &lhs, const std::string &rhs) {
-        return SHA256::hash("1" + lhs + "2" + rhs);
+        return SHA256::hash_parts({"1", lhs, "2", rhs});
+    }
+
+    static void merge_hash_many(const std::string *const *lhs, const std::string *const *rhs,
+                                std::string *out, size_t count) {
+        std::vector<size_t> offsets(count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            offsets[i + 1] = offsets[i] + 2 + lhs[i]->size() + rhs[i]->size();
+        }
+        std::string buf;
+        buf.reserve(offsets[count]);
+        for (size_t i = 0; i < count; ++i) {
+            buf.append("1").append(*lhs[i]).append("2").append(*rhs[i]);
+        }
+
+        std::vector<SHA256::part_t> messages;
+        messages.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            messages.emplace_back(buf.data() + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+        std::vector<SHA256::digest_t> digests(count);
+        SHA256::digest_many(messages.data(), count, digests.data());
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = SHA256::to_hex(digests[i]);
+        }
+    }
+};
+
+// HashPolicySHA256Tree with leaves bound to their keys, see has_bind_key
+struct HashPolicySHA256TreeKeyed : HashPolicySHA256Tree {
+    static std::string bind_key(uint64_t key, const std::string &leaf_hash) {
+        std::array<unsigned char, 8> bytes = key_bytes(key);
+        return SHA256::hash_parts({"3", {bytes.data(), bytes.size()}, leaf_hash});
     }
 };
 
+/*
+ * Binary digests instead of hex strings: use with HashType = SHA256::digest_t.
+ * Leaves, interior nodes and leaves bound to keys are domain separated with
+ * 0x00, 0x01 and 0x02 prefixes, so merge input is one byte plus raw 64 bytes
+ * of children and stays on stack.
+ * Every merge input has the same length, so batches fill all SIMD lanes.
+ */
+struct HashPolicySHA256Digest {
+    static constexpr uint8_t LEAF_PREFIX = 0x00;
+    static constexpr uint8_t NODE_PREFIX = 0x01;
+    static constexpr uint8_t KEY_PREFIX = 0x02;
+
+    static SHA256::digest_t leaf_hash(const std::string &leaf_value) {
+        return SHA256::digest_parts({{&LEAF_PREFIX, 1}, leaf_value});
+    }
+
+    static SHA256::digest_t bind_key(uint64_t key, const SHA256::digest_t &leaf_hash) {
+        std::array<unsigned char, 8> bytes = key_bytes(key);
+        return SHA256::digest_parts({{&KEY_PREFIX, 1}, {bytes.data(), bytes.size()}, leaf_hash});
+    }
+
+    static SHA256::digest_t merge_hash(const SHA256::digest_t &lhs,
+                                       const SHA256::digest_t &rhs) {
+        return SHA256::digest_parts({{&NODE_PREFIX, 1}, lhs, rhs});
+    }
+
+    static void merge_hash_many(const SHA256::digest_t *const *lhs,
+                                const SHA256::digest_t *const *rhs, SHA256::digest_t *out,
+                                size_t count) {
+        constexpr size_t MESSAGE_SIZE = 1 + 2 * SHA256_impl::DIGEST_SIZE;
+
+        std::vector<unsigned char> buf(count * MESSAGE_SIZE);
+        std::vector<SHA256::part_t> messages;
+        messages.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            unsigned char *message = buf.data() + i * MESSAGE_SIZE;
+            message[0] = NODE_PREFIX;
+            std::copy(lhs[i]->begin(), lhs[i]->end(), message + 1);
+            std::copy(rhs[i]->begin(), rhs[i]->end(), message + 1 + lhs[i]->size());
+            messages.emplace_back(message, MESSAGE_SIZE);
+        }
+        SHA256::digest_many(messages.data(), count, out);
+    }
+};
 
 #endif // CSMT_HASH_POLICY_H
@@ -0,0 +1,232 @@
+#ifndef CSMT_RECURSIVE_CSMT_H
+#define CSMT_RECURSIVE_CSMT_H
+
+#include "src/csmt.h"
+
+/*
+ * Recursive descent as Csmt had it before the iterative one: kept only for
+ * benchmark comparison. Trees are the same, only traversal differs.
+ */
+template <typename HashPolicy, typename HashType = std::string>
+class RecursiveCsmt : public Csmt<HashPolicy, HashType> {
+    using Base = Csmt<HashPolicy, HashType>;
+    using typename Base::Blob;
+    using typename Base::ptr_t;
+    using typename Base::proof_t;
+
+    using Base::root_;
+    using Base::size_;
+    using Base::destroy_node;
+    using Base::distance;
+    using Base::make_node;
+    using Base::update;
+
+    ptr_t insert(ptr_t root, Blob &blob) {
+        if (root->is_leaf()) {
+            return insert_leaf(root, blob);
+        }
+
+        uint64_t l_key = root->left_->get_key();
+        uint64_t r_key = root->right_->get_key();
+
+        if (root->left_->is_leaf() && l_key == blob.key_) {
+            root->left_ = insert_leaf(root->left_, blob);
+            update(root);
+            return root;
+        }
+        if (root->right_->is_leaf() && r_key == blob.key_) {
+            root->right_ = insert_leaf(root->right_, blob);
+            update(root);
+            return root;
+        }
+
+        uint64_t l_dist = distance(blob.key_, l_key);
+        uint64_t r_dist = distance(blob.key_, r_key);
+
+        if (l_dist == r_dist) {
+            ptr_t new_node = make_node(std::move(blob));
+            uint64_t min_key = (l_key < r_key ? l_key : r_key);
+            ++size_;
+            if (blob.key_ < min_key) {
+                return make_node(new_node, root);
+            } else {
+                return make_node(root, new_node);
+            }
+        }
+
+        // children are updated in place, so the same pointers come back
+        if (l_dist < r_dist) {
+            root->left_ = insert(root->left_, blob);
+        } else {
+            root->right_ = insert(root->right_, blob);
+        }
+        update(root);
+        return root;
+    }
+
+    ptr_t insert_leaf(ptr_t leaf, Blob &blob) {
+        uint64_t leaf_key = leaf->get_key();
+        if (blob.key_ == leaf_key) {
+            // update existing value
+            leaf->set_leaf_hash(std::move(blob.value_));
+            return leaf;
+        }
+        ++size_;
+        ptr_t new_node = make_node(std::move(blob));
+        if (blob.key_ < leaf_key) {
+            return make_node(new_node, leaf);
+        } else {
+            return make_node(leaf, new_node);
+        }
+    }
+
+    // drops interior root and its erased leaf, keeps the survivor child
+    ptr_t collapse(ptr_t root, ptr_t survivor) {
+        ptr_t erased = (root->left_ == survivor ? root->right_ : root->left_);
+        destroy_node(erased);
+        destroy_node(root);
+        return survivor;
+    }
+
+    bool collect_audit_path(ptr_t root, uint64_t key, proof_t &audit_path) const {
+        if (root->is_leaf()) {
+            return root->get_key() == key;
+        }
+
+        uint64_t l_key = root->left_->get_key();
+        uint64_t r_key = root->right_->get_key();
+
+        if (root->left_->is_leaf() && l_key == key) {
+            audit_path.push_back(root->left_->get_value());
+            audit_path.push_back(root->right_->get_value());
+            return true;
+        }
+        if (root->right_->is_leaf() && r_key == key) {
+            audit_path.push_back(root->left_->get_value());
+            audit_path.push_back(root->right_->get_value());
+            return true;
+        }
+
+        uint64_t l_dist = distance(key, l_key);
+        uint64_t r_dist = distance(key, r_key);
+
+        if (l_dist < r_dist) {
+            if (collect_audit_path(root->left_, key, audit_path)) {
+                audit_path.push_back(root->left_->get_value());
+                audit_path.push_back(root->right_->get_value());
+                return true;
+            }
+        } else if (l_dist > r_dist) {
+            if (collect_audit_path(root->right_, key, audit_path)) {
+                audit_path.push_back(root->left_->get_value());
+                audit_path.push_back(root->right_->get_value());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ptr_t erase(ptr_t root, uint64_t key) {
+        if (root->is_leaf()) {
+            if (root->get_key() == key) {
+                --size_;
+                destroy_node(root);
+                return nullptr;
+            } else {
+                return root;
+            }
+        }
+        if (root->left_->is_leaf() && root->left_->get_key() == key) {
+            --size_;
+            return collapse(root, root->right_);
+        }
+        if (root->right_->is_leaf() && root->right_->get_key() == key) {
+            --size_;
+            return collapse(root, root->left_);
+        }
+
+        uint64_t l_dist = distance(key, root->left_->get_key());
+        uint64_t r_dist = distance(key, root->right_->get_key());
+
+        if (l_dist == r_dist) {
+            return root;
+        }
+
+        // in worst case the same pointer returned, nothing to rehash then
+        size_t old_size = size_;
+        if (l_dist < r_dist) {
+            root->left_ = erase(root->left_, key);
+        } else {
+            root->right_ = erase(root->right_, key);
+        }
+        if (size_ != old_size) {
+            update(root);
+        }
+        return root;
+    }
+
+    bool contains(ptr_t root, uint64_t key) const {
+        if (root->is_leaf()) {
+            return root->get_key() == key;
+        }
+        uint64_t left_key = root->left_->get_key();
+        uint64_t right_key = root->right_->get_key();
+
+        if (root->left_->is_leaf() && root->left_->get_key() == key) {
+            return true;
+        }
+        if (root->right_->is_leaf() && root->right_->get_key() == key) {
+            return true;
+        }
+
+        uint64_t l_dist = distance(key, left_key);
+        uint64_t r_dist = distance(key, right_key);
+        if (l_dist == r_dist) {
+            return false;
+        }
+        if (l_dist < r_dist) {
+            return contains(root->left_, key);
+        } else {
+            return contains(root->right_, key);
+        }
+    }
+
+public:
+    void insert(uint64_t key, const std::string &value) {
+        Blob blob(key, HashPolicy::leaf_hash(value));
+        if (root_) {
+            root_ = insert(root_, blob);
+        } else {
+            ++size_;
+            root_ = make_node(std::move(blob));
+        }
+    }
+
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        if (root_) {
+            proof_t audit_path;
+            if (collect_audit_path(root_, key, audit_path)) {
+                audit_path.push_back(root_->get_value());
+            }
+            return audit_path;
+        } else {
+            return {};
+        }
+    }
+
+    void erase(uint64_t key) {
+        if (root_) {
+            root_ = erase(root_, key);
+        }
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        if (root_) {
+            return contains(root_, key);
+        } else {
+            return false;
+        }
+    }
+};
+
+#endif // CSMT_RECURSIVE_CSMT_H
@@ -1,7 +1,7 @@
 #include "sha256.h"
 
+#include <atomic>
 #include <cstring>
-#include <cstdio>
 
 const unsigned int SHA256_impl::sha256_k[64] = //UL = uint32
         {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
@@ -21,7 +21,46 @@ const unsigned int SHA256_impl::sha256_k[64] = //UL = uint32
          0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
          0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
+namespace {
+    struct active_backend_t {
+        std::atomic<SHA256_impl::transform_t> transform_;
+        std::atomic<SHA256::backend_t> backend_;
+    };
+
+    active_backend_t &active_backend() {
+        static active_backend_t active = [] {
+            for (SHA256::backend_t backend : {SHA256::backend_t::SHA_NI,
+                                              SHA256::backend_t::AVX2}) {
+                if (SHA256_impl::transform_t fn = SHA256_impl::get_transform(backend)) {
+                    return active_backend_t{{fn}, {backend}};
+                }
+            }
+            return active_backend_t{
+                {SHA256_impl::get_transform(SHA256::backend_t::SCALAR)},
+                {SHA256::backend_t::SCALAR}};
+        }();
+        return active;
+    }
+}
+
+SHA256_impl::transform_t SHA256_impl::get_transform(SHA256::backend_t backend) {
+    switch (backend) {
+    case SHA256::backend_t::SCALAR:
+        return &transform_scalar;
+    case SHA256::backend_t::AVX2:
+        return cpu_supports(backend) ? &transform_avx2 : nullptr;
+    case SHA256::backend_t::SHA_NI:
+        return cpu_supports(backend) ? &transform_shani : nullptr;
+    }
+    return nullptr;
+}
+
 void SHA256_impl::transform(const unsigned char *message, unsigned int block_nb) {
+    active_backend().transform_.load(std::memory_order_relaxed)(m_h, message, block_nb);
+}
+
+void SHA256_impl::transform_scalar(uint32 *state, const unsigned char *message,
+                                   unsigned int block_nb) {
     uint32 w[64];
     uint32 wv[8];
     uint32 t1, t2;
@@ -36,7 +75,7 @@ void SHA256_impl::transform(const unsigned char *message, unsigned int block_nb)
             w[j] = SHA256_F4(w[j - 2]) + w[j - 7] + SHA256_F3(w[j - 15]) + w[j - 16];
         }
         for (j = 0; j < 8; j++) {
-            wv[j] = m_h[j];
+            wv[j] = state[j];
         }
         for (j = 0; j < 64; j++) {
             t1 = wv[7] + SHA256_F2(wv[4]) + SHA2_CH(wv[4], wv[5], wv[6])
@@ -52,7 +91,7 @@ void SHA256_impl::transform(const unsigned char *message, unsigned int block_nb)
             wv[0] = t1 + t2;
         }
         for (j = 0; j < 8; j++) {
-            m_h[j] += wv[j];
+            state[j] += wv[j];
         }
     }
 }
@@ -110,19 +149,77 @@ void SHA256_impl::final(unsigned char *digest) {
     }
 }
 
-// TODO: check if const ref is possible
-std::string SHA256::hash(std::string input) {
-    unsigned char digest[SHA256_impl::DIGEST_SIZE];
-    memset(digest, 0, SHA256_impl::DIGEST_SIZE);
+SHA256::digest_t SHA256::digest(const unsigned char *message, size_t len) {
+    digest_t result;
 
     SHA256_impl ctx = SHA256_impl();
     ctx.init();
-    ctx.update((unsigned char *) input.c_str(), input.length());
-    ctx.final(digest);
-
-    char buf[2 * SHA256_impl::DIGEST_SIZE + 1];
-    buf[2 * SHA256_impl::DIGEST_SIZE] = 0;
-    for (size_t i = 0; i < SHA256_impl::DIGEST_SIZE; i++)
-        sprintf(buf + i * 2, "%02x", digest[i]);
-    return std::string(buf);
+    ctx.update(message, len);
+    ctx.final(result.data());
+    return result;
+}
+
+SHA256::digest_t SHA256::digest(const std::string &input) {
+    return digest((const unsigned char *) input.data(), input.length());
+}
+
+SHA256::digest_t SHA256::digest_parts(std::initializer_list<part_t> parts) {
+    digest_t result;
+
+    SHA256_impl ctx = SHA256_impl();
+    ctx.init();
+    for (const part_t &part : parts) {
+        ctx.update(part.data_, part.len_);
+    }
+    ctx.final(result.data());
+    return result;
+}
+
+std::string SHA256::to_hex(const digest_t &digest) {
+    static const char hex_digits[] = "0123456789abcdef";
+
+    std::string result(2 * digest.size(), '0');
+    for (size_t i = 0; i < digest.size(); i++) {
+        result[2 * i] = hex_digits[digest[i] >> 4u];
+        result[2 * i + 1] = hex_digits[digest[i] & 0xfu];
+    }
+    return result;
+}
+
+std::string SHA256::hash(const std::string &input) {
+    return to_hex(digest(input));
+}
+
+std::string SHA256::hash_parts(std::initializer_list<part_t> parts) {
+    return to_hex(digest_parts(parts));
+}
+
+bool SHA256::is_supported(backend_t backend) {
+    return SHA256_impl::get_transform(backend) != nullptr;
+}
+
+bool SHA256::set_backend(backend_t backend) {
+    SHA256_impl::transform_t fn = SHA256_impl::get_transform(backend);
+    if (!fn) {
+        return false;
+    }
+    active_backend().transform_.store(fn, std::memory_order_relaxed);
+    active_backend().backend_.store(backend, std::memory_order_relaxed);
+    return true;
+}
+
+SHA256::backend_t SHA256::get_backend() {
+    return active_backend().backend_.load(std::memory_order_relaxed);
+}
+
+const char *SHA256::backend_name(backend_t backend) {
+    switch (backend) {
+    case backend_t::SCALAR:
+        return "scalar";
+    case backend_t::AVX2:
+        return "avx2";
+    case backend_t::SHA_NI:
+        return "sha-ni";
+    }
+    return "unknown";
 }
@@ -1,8 +1,23 @@
 #ifndef SHA256_H
 #define SHA256_H
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
 #include <string>
 
+namespace SHA256 {
+
+    /* implementations of block transform, chosen at startup via CPUID */
+    enum class backend_t {
+        SCALAR, // portable C++
+        AVX2,   // message schedules of two blocks per ymm register, BMI2 rounds
+        SHA_NI  // x86 SHA extensions
+    };
+
+}
+
 class SHA256_impl {
 private:
     typedef unsigned char uint8;
@@ -12,17 +27,57 @@ private:
     static const size_t SHA224_256_BLOCK_SIZE = (512 / 8);
 
 public:
+    static const size_t DIGEST_SIZE = (256 / 8);
+    static const size_t MAX_LANES = 16;
+
+    typedef void (*transform_t)(uint32 *state, const unsigned char *message,
+                                unsigned int block_nb);
+
     void init();
 
     void update(const unsigned char *message, unsigned int len);
 
     void final(unsigned char *digest);
 
-    static const size_t DIGEST_SIZE = (256 / 8);
+    /* nullptr if backend is not supported by CPU or by compiler */
+    static transform_t get_transform(SHA256::backend_t backend);
+
+    // defined in sha256_x86.cpp
+    static bool cpu_supports_lanes(size_t lanes);
+
+    /* one message per lane, all of length len; false if lanes are not supported */
+    static bool digest_lanes(size_t lanes, const unsigned char *const *messages, size_t len,
+                             unsigned char (*digests)[DIGEST_SIZE]);
 
 private:
     void transform(const unsigned char *message, unsigned int block_nb);
 
+    static void transform_scalar(uint32 *state, const unsigned char *message,
+                                 unsigned int block_nb);
+
+    // defined in sha256_x86.cpp
+    static bool cpu_supports(SHA256::backend_t backend);
+
+    static void transform_avx2(uint32 *state, const unsigned char *message,
+                               unsigned int block_nb);
+
+    static void transform_shani(uint32 *state, const unsigned char *message,
+                                unsigned int block_nb);
+
+    // defined in sha256_many.cpp
+    template <typename vec_t, size_t LANES>
+    static void digest_lanes_impl(const unsigned char *const *messages, size_t len,
+                                  uint8 (*digests)[DIGEST_SIZE]);
+
+    static void digest_x4(const unsigned char *const *messages, size_t len,
+                          uint8 (*digests)[DIGEST_SIZE]);
+
+    static void digest_x8(const unsigned char *const *messages, size_t len,
+                          uint8 (*digests)[DIGEST_SIZE]);
+
+    static void digest_x16(const unsigned char *const *messages, size_t len,
+                           uint8 (*digests)[DIGEST_SIZE]);
+
     unsigned int m_tot_len;
     unsigned int m_len;
     unsigned char m_block[2 * SHA224_256_BLOCK_SIZE];
@@ -31,7 +86,68 @@ private:
 
 namespace SHA256 {
 
-    std::string hash(std::string input);
+    /* raw binary digest, half the size of hex string and no heap */
+    using digest_t = std::array<uint8_t, SHA256_impl::DIGEST_SIZE>;
+
+    /* non-owning view of one piece of a message */
+    struct part_t {
+        const unsigned char *data_;
+        size_t len_;
+
+        part_t(const void *data, size_t len)
+            : data_(static_cast<const unsigned char *>(data))
+            , len_(len) {
+        }
+
+        part_t(const char *str)
+            : part_t(str, std::strlen(str)) {
+        }
+
+        part_t(const std::string &str)
+            : part_t(str.data(), str.length()) {
+        }
+
+        part_t(const digest_t &digest)
+            : part_t(digest.data(), digest.size()) {
+        }
+    };
+
+    digest_t digest(const unsigned char *message, size_t len);
+
+    digest_t digest(const std::string &input);
+
+    /* hash of concatenated parts, pieces are fed to one context without copies */
+    digest_t digest_parts(std::initializer_list<part_t> parts);
+
+    std::string to_hex(const digest_t &digest);
+
+    std::string hash(const std::string &input);
+
+    std::string hash_parts(std::initializer_list<part_t> parts);
+
+    bool is_supported(backend_t backend);
+
+    /* switches all contexts to backend, false if it is not supported */
+    bool set_backend(backend_t backend);
+
+    backend_t get_backend();
+
+    const char *backend_name(backend_t backend);
+
+    /*
+     * Hashes count independent messages into out.
+     * Runs of equal-length messages are hashed get_lanes() at a time in SIMD
+     * lanes, which turns many short hashes (e.g. one tree level) from latency
+     * bound into throughput bound.
+     */
+    void digest_many(const part_t *messages, size_t count, digest_t *out);
+
+    /* 1 means one message at a time with active backend, otherwise 4, 8 or 16 */
+    bool is_supported_lanes(size_t lanes);
+
+    bool set_lanes(size_t lanes);
+
+    size_t get_lanes();
 
 }
 
@@ -0,0 +1,257 @@
+#include "sha256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+/*
+ * Multi-buffer SHA-256: every vector lane runs its own message, so one pass
+ * over the 64 rounds produces 4, 8 or 16 digests. Kernel is written once with
+ * GCC vector extensions and instantiated for each width under its own target.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA256_LANES
+
+typedef uint32_t vec4_t __attribute__((vector_size(16)));
+typedef uint32_t vec8_t __attribute__((vector_size(32)));
+typedef uint32_t vec16_t __attribute__((vector_size(64)));
+
+// SHA2_ROTR takes width from sizeof, which is the whole vector here
+#define SHA256_LANE_ROTR(x, n) ((x >> n) | (x << (32 - n)))
+#endif
+
+namespace {
+    const uint32_t sha256_h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    inline uint32_t load_be32(const unsigned char *str) {
+        return ((uint32_t)str[0] << 24u) | ((uint32_t)str[1] << 16u) |
+               ((uint32_t)str[2] << 8u) | ((uint32_t)str[3]);
+    }
+
+    inline void store_be32(unsigned char *str, uint32_t x) {
+        str[0] = (unsigned char)(x >> 24u);
+        str[1] = (unsigned char)(x >> 16u);
+        str[2] = (unsigned char)(x >> 8u);
+        str[3] = (unsigned char)(x);
+    }
+
+    std::atomic<size_t> &active_lanes() {
+        static std::atomic<size_t> lanes = [] {
+            // SHA extensions beat narrow lanes, only wide registers pay off
+            bool sha_ni = SHA256::is_supported(SHA256::backend_t::SHA_NI);
+            for (size_t lanes : {16, 8, 4}) {
+                if (sha_ni && lanes < 16) {
+                    break;
+                }
+                if (SHA256::is_supported_lanes(lanes)) {
+                    return lanes;
+                }
+            }
+            return size_t(1);
+        }();
+        return lanes;
+    }
+} // namespace
+
+#ifdef SHA256_LANES
+
+template <typename vec_t, size_t LANES>
+__attribute__((always_inline)) inline void
+SHA256_impl::digest_lanes_impl(const unsigned char *const *messages, size_t len,
+                               uint8 (*digests)[DIGEST_SIZE]) {
+    const size_t full_blocks = len / SHA224_256_BLOCK_SIZE;
+    const size_t tail_len = len % SHA224_256_BLOCK_SIZE;
+    const size_t tail_blocks = (tail_len + 9 > SHA224_256_BLOCK_SIZE ? 2 : 1);
+
+    // last one or two blocks of each message with padding and bit length
+    unsigned char tails[LANES][2 * SHA224_256_BLOCK_SIZE];
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        unsigned char *tail = tails[lane];
+        std::memset(tail, 0, sizeof(tails[lane]));
+        std::memcpy(tail, messages[lane] + full_blocks * SHA224_256_BLOCK_SIZE, tail_len);
+        tail[tail_len] = 0x80;
+        uint64_t bits = (uint64_t)len << 3u;
+        unsigned char *len_pos = tail + tail_blocks * SHA224_256_BLOCK_SIZE - 8;
+        store_be32(len_pos, (uint32_t)(bits >> 32u));
+        store_be32(len_pos + 4, (uint32_t)bits);
+    }
+
+    vec_t state[8];
+    for (size_t i = 0; i < 8; ++i) {
+        state[i] = vec_t{} + sha256_h0[i];
+    }
+
+    for (size_t block = 0; block < full_blocks + tail_blocks; ++block) {
+        const unsigned char *sub_block[LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            sub_block[lane] =
+                (block < full_blocks
+                     ? messages[lane] + block * SHA224_256_BLOCK_SIZE
+                     : tails[lane] + (block - full_blocks) * SHA224_256_BLOCK_SIZE);
+        }
+
+        // transpose through memory, per-element vector inserts are much slower
+        uint32_t words[16][LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            for (size_t j = 0; j < 16; ++j) {
+                words[j][lane] = load_be32(sub_block[lane] + 4 * j);
+            }
+        }
+        vec_t w[16];
+        std::memcpy(w, words, sizeof(w));
+
+        vec_t a = state[0], b = state[1], c = state[2], d = state[3];
+        vec_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (size_t j = 0; j < 64; ++j) {
+            if (j >= 16) {
+                vec_t w15 = w[(j - 15) & 15u];
+                vec_t w2 = w[(j - 2) & 15u];
+                vec_t s0 = SHA256_LANE_ROTR(w15, 7) ^ SHA256_LANE_ROTR(w15, 18) ^ (w15 >> 3);
+                vec_t s1 = SHA256_LANE_ROTR(w2, 17) ^ SHA256_LANE_ROTR(w2, 19) ^ (w2 >> 10);
+                w[j & 15u] += s0 + w[(j - 7) & 15u] + s1;
+            }
+            vec_t f2 = SHA256_LANE_ROTR(e, 6) ^ SHA256_LANE_ROTR(e, 11) ^ SHA256_LANE_ROTR(e, 25);
+            vec_t f1 = SHA256_LANE_ROTR(a, 2) ^ SHA256_LANE_ROTR(a, 13) ^ SHA256_LANE_ROTR(a, 22);
+            vec_t t1 = h + f2 + ((e & f) ^ (~e & g)) + sha256_k[j] + w[j & 15u];
+            vec_t t2 = f1 + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        for (size_t i = 0; i < 8; ++i) {
+            store_be32(&digests[lane][i << 2u], state[i][lane]);
+        }
+    }
+}
+
+void SHA256_impl::digest_x4(const unsigned char *const *messages, size_t len,
+                            uint8 (*digests)[DIGEST_SIZE]) {
+    digest_lanes_impl<vec4_t, 4>(messages, len, digests);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2"))) void
+SHA256_impl::digest_x8(const unsigned char *const *messages, size_t len,
+                       uint8 (*digests)[DIGEST_SIZE]) {
+    digest_lanes_impl<vec8_t, 8>(messages, len, digests);
+}
+
+__attribute__((target("avx512f"))) void
+SHA256_impl::digest_x16(const unsigned char *const *messages, size_t len,
+                        uint8 (*digests)[DIGEST_SIZE]) {
+    digest_lanes_impl<vec16_t, 16>(messages, len, digests);
+}
+
+#else
+
+void SHA256_impl::digest_x8(const unsigned char *const *messages, size_t len,
+                            uint8 (*digests)[DIGEST_SIZE]) {
+    digest_lanes_impl<vec8_t, 8>(messages, len, digests);
+}
+
+void SHA256_impl::digest_x16(const unsigned char *const *messages, size_t len,
+                             uint8 (*digests)[DIGEST_SIZE]) {
+    digest_lanes_impl<vec16_t, 16>(messages, len, digests);
+}
+
+#endif
+
+bool SHA256_impl::digest_lanes(size_t lanes, const unsigned char *const *messages,
+                               size_t len, unsigned char (*digests)[DIGEST_SIZE]) {
+    if (!cpu_supports_lanes(lanes)) {
+        return false;
+    }
+    switch (lanes) {
+    case 4:
+        digest_x4(messages, len, digests);
+        return true;
+    case 8:
+        digest_x8(messages, len, digests);
+        return true;
+    case 16:
+        digest_x16(messages, len, digests);
+        return true;
+    }
+    return false;
+}
+
+#else
+
+bool SHA256_impl::digest_lanes(size_t, const unsigned char *const *, size_t,
+                               unsigned char (*)[DIGEST_SIZE]) {
+    return false;
+}
+
+#endif // SHA256_LANES
+
+bool SHA256::is_supported_lanes(size_t lanes) {
+#ifdef SHA256_LANES
+    if (lanes == 4 || lanes == 8 || lanes == 16) {
+        return SHA256_impl::cpu_supports_lanes(lanes);
+    }
+#endif
+    return lanes == 1;
+}
+
+bool SHA256::set_lanes(size_t lanes) {
+    if (!is_supported_lanes(lanes)) {
+        return false;
+    }
+    active_lanes().store(lanes, std::memory_order_relaxed);
+    return true;
+}
+
+size_t SHA256::get_lanes() {
+    return active_lanes().load(std::memory_order_relaxed);
+}
+
+void SHA256::digest_many(const part_t *messages, size_t count, digest_t *out) {
+    const size_t lanes = get_lanes();
+    const unsigned char *lane_messages[SHA256_impl::MAX_LANES];
+    uint8_t lane_digests[SHA256_impl::MAX_LANES][SHA256_impl::DIGEST_SIZE];
+
+    size_t first = 0;
+    while (first < count) {
+        size_t len = messages[first].len_;
+        size_t group = 1;
+        while (group < lanes && first + group < count && messages[first + group].len_ == len) {
+            ++group;
+        }
+        if (group == 1) {
+            out[first] = digest(messages[first].data_, len);
+            ++first;
+            continue;
+        }
+
+        // idle lanes repeat the last message of the group
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            lane_messages[lane] = messages[first + std::min(lane, group - 1)].data_;
+        }
+        SHA256_impl::digest_lanes(lanes, lane_messages, len, lane_digests);
+        for (size_t lane = 0; lane < group; ++lane) {
+            std::memcpy(out[first + lane].data(), lane_digests[lane], SHA256_impl::DIGEST_SIZE);
+        }
+        first += group;
+    }
+}
@@ -0,0 +1,281 @@
+#include "sha256.h"
+
+/*
+ * x86 implementations of SHA256_impl block transform.
+ *
+ * Every function is compiled for its own target via attributes, so the rest of
+ * the project keeps baseline flags and the right variant is picked at runtime.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef SHA256_X86
+
+namespace {
+    struct cpu_features_t {
+        bool ssse3_ = false;
+        bool sse41_ = false;
+        bool avx2_ = false;
+        bool avx512f_ = false;
+        bool bmi2_ = false;
+        bool sha_ = false;
+    };
+
+    unsigned int os_saved_state() {
+        unsigned int eax, edx;
+        __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return eax;
+    }
+
+    cpu_features_t detect_features() {
+        cpu_features_t features;
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return features;
+        }
+        features.ssse3_ = ecx & (1u << 9u);
+        features.sse41_ = ecx & (1u << 19u);
+        bool osxsave = ecx & (1u << 27u);
+        unsigned int saved = (osxsave ? os_saved_state() : 0u);
+        // xmm and ymm state, then opmask and zmm state
+        bool avx = (ecx & (1u << 28u)) && (saved & 0x6u) == 0x6u;
+        bool avx512 = avx && (saved & 0xe0u) == 0xe0u;
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            features.avx2_ = avx && (ebx & (1u << 5u));
+            features.avx512f_ = avx512 && (ebx & (1u << 16u));
+            features.bmi2_ = ebx & (1u << 8u);
+            features.sha_ = ebx & (1u << 29u);
+        }
+        return features;
+    }
+
+    const cpu_features_t &cpu_features() {
+        static const cpu_features_t features = detect_features();
+        return features;
+    }
+
+    template <int N>
+    __attribute__((target("avx2"))) inline __m256i rotr_x8(__m256i x) {
+        return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i sigma0_x8(__m256i x) {
+        return _mm256_xor_si256(_mm256_xor_si256(rotr_x8<7>(x), rotr_x8<18>(x)),
+                                _mm256_srli_epi32(x, 3));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i sigma1_x8(__m256i x) {
+        return _mm256_xor_si256(_mm256_xor_si256(rotr_x8<17>(x), rotr_x8<19>(x)),
+                                _mm256_srli_epi32(x, 10));
+    }
+
+    /*
+     * w[j+16..j+19] from w[j..j+15] held in x0..x3, in each 128-bit lane on
+     * its own: alignr and shuffle_epi32 do not cross lanes.
+     */
+    __attribute__((target("avx2"))) inline __m256i schedule_x8(__m256i x0, __m256i x1,
+                                                               __m256i x2, __m256i x3) {
+        __m256i w = _mm256_add_epi32(x0, sigma0_x8(_mm256_alignr_epi8(x1, x0, 4)));
+        w = _mm256_add_epi32(w, _mm256_alignr_epi8(x3, x2, 4));
+        // words 0 and 1 depend on w[j+14], w[j+15]
+        __m256i lo = sigma1_x8(_mm256_shuffle_epi32(x3, 0xee));
+        w = _mm256_add_epi32(w, _mm256_and_si256(lo, _mm256_set_epi32(0, 0, -1, -1, 0, 0, -1, -1)));
+        // words 2 and 3 depend on words 0 and 1 computed above
+        __m256i hi = sigma1_x8(_mm256_shuffle_epi32(w, 0x44));
+        return _mm256_add_epi32(w, _mm256_and_si256(hi, _mm256_set_epi32(-1, -1, 0, 0, -1, -1, 0, 0)));
+    }
+
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, wk)                               \
+    {                                                                          \
+        unsigned int t1 = h + SHA256_F2(e) + SHA2_CH(e, f, g) + (wk);          \
+        unsigned int t2 = SHA256_F1(a) + SHA2_MAJ(a, b, c);                    \
+        d += t1;                                                               \
+        h = t1 + t2;                                                           \
+    }
+
+    /*
+     * 64 rounds over precomputed w[j] + k[j], word j at wk[j / 4 * stride + j % 4].
+     * Variables rotate by renaming, compiled with BMI2 rotations are rorx.
+     */
+    __attribute__((target("avx2,bmi2"))) inline void rounds(unsigned int *state,
+                                                            const unsigned int *wk,
+                                                            size_t stride) {
+        unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+        unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int j = 0; j < 64; j += 8, wk += 2 * stride) {
+            SHA256_ROUND(a, b, c, d, e, f, g, h, wk[0]);
+            SHA256_ROUND(h, a, b, c, d, e, f, g, wk[1]);
+            SHA256_ROUND(g, h, a, b, c, d, e, f, wk[2]);
+            SHA256_ROUND(f, g, h, a, b, c, d, e, wk[3]);
+            SHA256_ROUND(e, f, g, h, a, b, c, d, wk[stride + 0]);
+            SHA256_ROUND(d, e, f, g, h, a, b, c, wk[stride + 1]);
+            SHA256_ROUND(c, d, e, f, g, h, a, b, wk[stride + 2]);
+            SHA256_ROUND(b, c, d, e, f, g, h, a, wk[stride + 3]);
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+#undef SHA256_ROUND
+} // namespace
+
+bool SHA256_impl::cpu_supports(SHA256::backend_t backend) {
+    const cpu_features_t &features = cpu_features();
+    switch (backend) {
+    case SHA256::backend_t::SCALAR:
+        return true;
+    case SHA256::backend_t::AVX2:
+        return features.avx2_ && features.bmi2_;
+    case SHA256::backend_t::SHA_NI:
+        return features.sha_ && features.ssse3_ && features.sse41_;
+    }
+    return false;
+}
+
+bool SHA256_impl::cpu_supports_lanes(size_t lanes) {
+    const cpu_features_t &features = cpu_features();
+    switch (lanes) {
+    case 4:
+        return true;
+    case 8:
+        return features.avx2_;
+    case 16:
+        return features.avx512f_;
+    }
+    return false;
+}
+
+/*
+ * Message schedules of two blocks at once: each ymm register holds 4 words
+ * of one block in the low lane and of the next block in the high lane, so
+ * one pass of 256-bit ops schedules both. w + k of both blocks is stored,
+ * then the rounds of each block run scalar with BMI2 (rorx/andn do not touch
+ * flags and sources). An odd last block is scheduled alone in the low lanes.
+ */
+__attribute__((target("avx2,bmi2"))) void
+SHA256_impl::transform_avx2(uint32 *state, const unsigned char *message,
+                            unsigned int block_nb) {
+    const __m256i bswap_mask = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                                 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // 4 words of first block, then the same 4 words of second block
+    alignas(32) uint32 wk[128];
+
+    for (unsigned int block = 0; block < block_nb; block += 2, message += 128) {
+        bool pair = block + 1 < block_nb;
+        const unsigned char *second = (pair ? message + 64 : message);
+        __m256i x[4];
+        for (int i = 0; i < 4; ++i) {
+            __m256i words = _mm256_loadu2_m128i((const __m128i *)(second + 16 * i),
+                                                (const __m128i *)(message + 16 * i));
+            x[i] = _mm256_shuffle_epi8(words, bswap_mask);
+        }
+
+        for (int j = 0; j < 64; j += 4) {
+            __m256i k = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&sha256_k[j]));
+            _mm256_store_si256((__m256i *)&wk[2 * j], _mm256_add_epi32(x[0], k));
+            __m256i next = (j < 48 ? schedule_x8(x[0], x[1], x[2], x[3]) : x[3]);
+            x[0] = x[1];
+            x[1] = x[2];
+            x[2] = x[3];
+            x[3] = next;
+        }
+
+        rounds(state, wk, 8);
+        if (pair) {
+            rounds(state, wk + 4, 8);
+        }
+    }
+}
+
+/*
+ * SHA extensions: two rounds per sha256rnds2, schedule via sha256msg1/msg2.
+ * State is kept as ABEF/CDGH pairs as the instructions expect.
+ */
+__attribute__((target("sha,sse4.1"))) void
+SHA256_impl::transform_shani(uint32 *state, const unsigned char *message,
+                             unsigned int block_nb) {
+    const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);             // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);       // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);    // CDGH
+
+    for (unsigned int block = 0; block < block_nb; ++block, message += 64) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msgs[4];
+
+#pragma GCC unroll 16
+        for (int quad = 0; quad < 16; ++quad) {
+            __m128i &cur = msgs[quad & 3];
+            __m128i &next = msgs[(quad + 1) & 3];
+            __m128i &prev = msgs[(quad + 3) & 3];
+
+            if (quad < 4) {
+                cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(message + 16 * quad)),
+                                       bswap_mask);
+            }
+            __m128i msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i *)&sha256_k[4 * quad]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (quad >= 3 && quad <= 14) {
+                next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4));
+                next = _mm_sha256msg2_epu32(next, cur);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (quad >= 1 && quad <= 12) {
+                prev = _mm_sha256msg1_epu32(prev, cur);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);    // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    // HGFE
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+#else
+
+bool SHA256_impl::cpu_supports(SHA256::backend_t backend) {
+    return backend == SHA256::backend_t::SCALAR;
+}
+
+bool SHA256_impl::cpu_supports_lanes(size_t lanes) {
+    return lanes == 4;
+}
+
+void SHA256_impl::transform_avx2(uint32 *state, const unsigned char *message,
+                                 unsigned int block_nb) {
+    transform_scalar(state, message, block_nb);
+}
+
+void SHA256_impl::transform_shani(uint32 *state, const unsigned char *message,
+                                  unsigned int block_nb) {
+    transform_scalar(state, message, block_nb);
+}
+
+#endif // SHA256_X86
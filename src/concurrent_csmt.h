@@ -0,0 +1,234 @@
+#ifndef CSMT_CONCURRENT_CSMT_H
+#define CSMT_CONCURRENT_CSMT_H
+
+#include "csmt.h"
+#include "epoch.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+/*
+ * CSMT for lock-free readers and one writer at a time.
+ *
+ * Nodes are immutable once published. Writer copies the path to the key,
+ * publishes the new root with one atomic store and retires replaced nodes
+ * to EpochManager, so readers never wait on writes and never see partial
+ * updates. Writers are serialized by a mutex. Tree shape, hashes and proof
+ * formats are the same as of Csmt.
+ *
+ * Usage:
+ *  ConcurrentCsmt<Policy> tree;
+ *  // writer thread
+ *  tree.insert(1, "a");
+ *  // any number of reader threads
+ *  auto proof = tree.membership_proof(1); // back() is root it was made against
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class ConcurrentCsmt {
+public:
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType>;
+    using proof_t = typename csmt_type::proof_t;
+    using compact_proof_t = typename csmt_type::compact_proof_t;
+
+private:
+    // leaves keep only the hash their parents see, see has_bind_key
+    struct Node {
+        uint64_t key_;
+        HashType value_;
+        const Node *left_ = nullptr;
+        const Node *right_ = nullptr;
+        uint8_t split_ = 0;
+
+        [[nodiscard]] bool is_leaf() const {
+            return !left_;
+        }
+    };
+
+    // Reader access to published nodes
+    struct nodes_t {
+        using handle_t = const Node *;
+
+        static constexpr const Node *NIL = nullptr;
+
+        static typename csmt_type::template link_t<const Node *> link(const Node *node) {
+            return {node->key_, node->left_, node->right_, node->split_};
+        }
+
+        static const HashType &hash(const Node *node) {
+            return node->value_;
+        }
+
+        static typename csmt_type::Blob blob(const Node *node) {
+            return {node->key_, node->value_};
+        }
+    };
+
+    using reader_t = typename csmt_type::template Reader<nodes_t>;
+    using path_t = typename reader_t::path_t;
+
+    std::atomic<const Node *> root_{nullptr};
+    std::atomic<size_t> size_{0};
+    mutable std::mutex writer_mutex_;
+    mutable EpochManager epochs_;
+
+    static reader_t reader(const Node *root) {
+        return reader_t(nodes_t(), root);
+    }
+
+    static const Node *make_node(const Node *lhs, const Node *rhs) {
+        auto split = uint8_t(csmt_type::log2(lhs->key_ ^ rhs->key_));
+        return new Node{rhs->key_, HashPolicy::merge_hash(lhs->value_, rhs->value_), lhs, rhs,
+                        split};
+    }
+
+    static void destroy_subtree(const Node *root) {
+        if (root) {
+            destroy_subtree(root->left_);
+            destroy_subtree(root->right_);
+            delete root;
+        }
+    }
+
+    /*
+     * Copies path[0, depth) bottom-up with child on the way to key replaced,
+     * publishes the copy and retires the originals.
+     */
+    void publish(const path_t &path, size_t depth, uint64_t key, const Node *child) {
+        path_t copies;
+        size_t level = depth;
+        try {
+            for (; level > 0; --level) {
+                const Node *parent = path[level - 1];
+                child = ((key >> parent->split_) & 1u ? make_node(parent->left_, child)
+                                                      : make_node(child, parent->right_));
+                copies[level - 1] = child;
+            }
+        } catch (...) {
+            for (; level < depth; ++level) {
+                delete copies[level];
+            }
+            throw;
+        }
+        // seq-cst, pairs with pin: a reader the epoch scan misses loads this root
+        root_.store(child);
+        for (size_t level = 0; level < depth; ++level) {
+            epochs_.retire(const_cast<Node *>(path[level]));
+        }
+    }
+
+public:
+    ConcurrentCsmt() = default;
+
+    ConcurrentCsmt(const ConcurrentCsmt &) = delete;
+    ConcurrentCsmt &operator=(const ConcurrentCsmt &) = delete;
+
+    /* No reader may be active */
+    ~ConcurrentCsmt() {
+        destroy_subtree(root_.load());
+    }
+
+    void insert(uint64_t key, const ValueType &value) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        HashType hash = csmt_type::bound_hash(key, HashPolicy::leaf_hash(value));
+        std::unique_ptr<const Node> leaf(new Node{key, std::move(hash)});
+        const Node *root = root_.load(std::memory_order_relaxed);
+        if (!root) {
+            root_.store(leaf.release());
+            size_.store(1);
+            return;
+        }
+
+        path_t path;
+        const Node *stop;
+        size_t depth = reader(root).descend(key, path, stop);
+        if (stop->is_leaf() && stop->key_ == key) {
+            publish(path, depth, key, leaf.get());
+            leaf.release();
+            epochs_.retire(const_cast<Node *>(stop));
+        } else {
+            // stop is shared by old and new version as sibling of the new leaf
+            std::unique_ptr<const Node> node(key < stop->key_ ? make_node(leaf.get(), stop)
+                                                              : make_node(stop, leaf.get()));
+            publish(path, depth, key, node.get());
+            node.release();
+            leaf.release();
+            size_.fetch_add(1);
+        }
+        epochs_.reclaim();
+    }
+
+    void erase(uint64_t key) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        path_t path;
+        size_t depth = 0;
+        const Node *leaf = reader(root_.load(std::memory_order_relaxed)).find(key, path, depth);
+        if (!leaf) {
+            return;
+        }
+        if (depth == 0) {
+            root_.store(nullptr);
+        } else {
+            // parent is replaced by the other child, publish retires it
+            const Node *parent = path[depth - 1];
+            publish(path, depth - 1, key, parent->left_ == leaf ? parent->right_ : parent->left_);
+            epochs_.retire(const_cast<Node *>(parent));
+        }
+        epochs_.retire(const_cast<Node *>(leaf));
+        size_.fetch_sub(1);
+        epochs_.reclaim();
+    }
+
+    /* Frees all retired nodes that no reader can reach */
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        epochs_.reclaim(true);
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        auto guard = epochs_.pin();
+        return reader(root_.load()).contains(key);
+    }
+
+    /* Size may lag behind a concurrent write */
+    [[nodiscard]] size_t size() const {
+        return size_.load();
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        auto guard = epochs_.pin();
+        return reader(root_.load()).root_hash();
+    }
+
+    /* Same format as Csmt::membership_proof, back() is the root of the version read */
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        auto guard = epochs_.pin();
+        return reader(root_.load()).membership_proof(key);
+    }
+
+    /* Same format as Csmt::compact_proof, root of the version read goes to root_hash */
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key,
+                                                               HashType *root_hash = nullptr) const {
+        auto guard = epochs_.pin();
+        reader_t version = reader(root_.load());
+        std::optional<compact_proof_t> proof = version.compact_proof(key);
+        if (proof && root_hash) {
+            *root_hash = version.root_hash();
+        }
+        return proof;
+    }
+
+    /* Retired nodes waiting for readers */
+    [[nodiscard]] size_t pending() const {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        return epochs_.pending();
+    }
+};
+
+#endif // CSMT_CONCURRENT_CSMT_H
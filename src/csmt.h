@@ -1,11 +1,26 @@
 #ifndef CSMT_CSMT_H
 #define CSMT_CSMT_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream> // mingw
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #ifdef __MINGW32__
 namespace std {
@@ -31,32 +46,224 @@ struct DefaultHashPolicy {
     }
 };
 
+/*
+ * Optional HashPolicy extension:
+ *  static void merge_hash_many(const HashType *const *lhs, const HashType *const *rhs,
+ *                              HashType *out, size_t count);
+ * merges count independent pairs at once, e.g. with multi-buffer SHA-256.
+ * Csmt feeds it whole levels of interior nodes when it has them.
+ */
+template <typename HashPolicy, typename HashType, typename = void>
+struct has_merge_hash_many : std::false_type {};
+
+template <typename HashPolicy, typename HashType>
+struct has_merge_hash_many<
+    HashPolicy, HashType,
+    std::void_t<decltype(HashPolicy::merge_hash_many(
+        std::declval<const HashType *const *>(), std::declval<const HashType *const *>(),
+        std::declval<HashType *>(), size_t()))>> : std::true_type {};
+
+/*
+ * Optional HashPolicy extension:
+ *  static HashType bind_key(uint64_t key, const HashType &leaf_hash);
+ * hashes a leaf together with its key. Parents and proofs then see leaves by
+ * their bound hash, so proofs commit to keys and verifiers check them.
+ * Without it leaves are seen by their leaf hash and keys are trusted.
+ */
+template <typename HashPolicy, typename HashType, typename = void>
+struct has_bind_key : std::false_type {};
+
+template <typename HashPolicy, typename HashType>
+struct has_bind_key<HashPolicy, HashType,
+                    std::void_t<decltype(HashPolicy::bind_key(
+                        uint64_t(), std::declval<const HashType &>()))>> : std::true_type {};
+
+/*
+ * Bound hash of a leaf, computed once when the leaf is made or updated.
+ * Empty when HashPolicy has no bind_key, then leaves are seen by leaf hash.
+ */
+template <typename HashPolicy, typename HashType,
+          bool = has_bind_key<HashPolicy, HashType>::value>
+struct bound_hash_t {
+    HashType bound_;
+
+    static bound_hash_t of(uint64_t key, const HashType &leaf_hash) {
+        return {HashPolicy::bind_key(key, leaf_hash)};
+    }
+
+    [[nodiscard]] const HashType &bound_or(const HashType &) const {
+        return bound_;
+    }
+};
+
+template <typename HashPolicy, typename HashType>
+struct bound_hash_t<HashPolicy, HashType, false> {
+    static bound_hash_t of(uint64_t, const HashType &) {
+        return {};
+    }
+
+    [[nodiscard]] const HashType &bound_or(const HashType &leaf_hash) const {
+        return leaf_hash;
+    }
+};
+
+/*
+ * Fixed set of worker threads for hashing independent subtrees.
+ *
+ * run(tasks, job) calls job(0) ... job(tasks - 1), each exactly once. Idle
+ * threads take the next task index from a shared counter, calling thread
+ * works too, so pool of size n has n - 1 workers. One run at a time, pool
+ * may be shared between trees.
+ */
+class ThreadPool {
+    std::vector<std::thread> workers_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+
+    const std::function<void(size_t)> *job_ = nullptr;
+    size_t tasks_ = 0;
+    std::atomic<size_t> next_task_{0};
+    size_t busy_ = 0;
+    uint64_t generation_ = 0;
+    std::exception_ptr error_;
+    bool stop_ = false;
+
+    void drain(const std::function<void(size_t)> &job, size_t tasks) {
+        for (size_t task = next_task_++; task < tasks; task = next_task_++) {
+            try {
+                job(task);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        while (true) {
+            const std::function<void(size_t)> *job;
+            size_t tasks;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                job = job_;
+                tasks = tasks_;
+            }
+            drain(*job, tasks);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads) {
+        for (size_t i = 1; i < threads; ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    [[nodiscard]] size_t size() const {
+        return workers_.size() + 1;
+    }
+
+    void run(size_t tasks, const std::function<void(size_t)> &job) {
+        std::lock_guard<std::mutex> run_lock(run_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            tasks_ = tasks;
+            next_task_ = 0;
+            busy_ = workers_.size();
+            error_ = nullptr;
+            ++generation_;
+        }
+        wake_.notify_all();
+        drain(job, tasks);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] { return busy_ == 0; });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &worker : workers_) {
+            worker.join();
+        }
+    }
+};
+
+// read-only snapshot made by Csmt::freeze(), defined in csmt_view.h
+template <typename HashPolicy, typename HashType, typename ValueType>
+class CsmtView;
+
+// snapshot file written straight from the tree, defined in csmt_snapshot.h
+template <typename HashPolicy, typename HashType, typename ValueType>
+class CsmtSnapshot;
+
 /*
  * Compact Sparse Merkle Tree.
  *
  * Basic operations:
  *  insert(key, value)
- *  membership_proof(key)
+ *  membership_proof(key), verify(key, value, proof, root), verify_many(...)
+ *  compact_proof(key), verify_compact_proof(key, value, proof, root)
+ *  non_membership_proof(key), verify_non_membership(key, proof, root)
+ *  membership_multiproof(keys), verify_multiproof(keys, values, proof, root)
+ *  range_proof(first, last), verify_range_proof(first, last, proof, root)
  *  erase(key)
  *  contains(key)
  *  size()
+ *  root_hash()
+ *  build(sorted_range)
+ *  apply_batch(ops)
+ *  set_lazy(lazy), commit()
+ *  set_threads(threads)
+ *  freeze() -- CsmtView snapshot, include csmt_view.h to use it
+ *  begin(), end(), rbegin(), rend() -- leaves in key order
+ *  lower_bound(key), successor(key), predecessor(key)
+ *  for_each_in_range(first, last, fn)
  *
  * Requirements:
  *  HashPolicy -- type with static methods leaf_hash and merge_hash.
  *      leaf_hash to hash all origin elements in CSMT.
  *      merge_hash to hash two sub-nodes in CSMT.
+ *      Optional bind_key to hash leaves with their keys, see has_bind_key.
+ *      Verifiers check keys only with it, otherwise keys in proofs are trusted.
  *
  *  Key type -- uint64_t.
+ *
+ *  Alloc -- allocator used for tree nodes, rebound to the internal node type.
+ *      See PoolAllocator in pool_allocator.h for a slab pool with free-list reuse.
  */
 
 template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
-          typename ValueType = std::string
-          /*, typename Alloc = std::allocator<void>*/> // TODO
+          typename ValueType = std::string, typename Alloc = std::allocator<void>>
 class Csmt {
 public:
     /* Structure that holds key and value as element of merkle tree */
     struct Blob {
-        const uint64_t key_;
+        uint64_t key_;
         HashType value_;
 
         Blob(uint64_t key, HashType value)
@@ -67,43 +274,95 @@ public:
 
     using proof_t = std::deque<HashType>;
 
-protected:
-    struct Node {
-        using ptr_t = std::unique_ptr<Node>;
+    /* HashPolicy has bind_key: proofs commit to keys and verifiers check them */
+    static constexpr bool BINDS_KEYS = has_bind_key<HashPolicy, HashType>::value;
 
-        Blob blob_;
-        ptr_t left_ = nullptr;
-        ptr_t right_ = nullptr;
-
-        explicit Node(Blob blob, ptr_t left, ptr_t right)
-            : blob_(std::move(blob))
-            , left_(std::move(left))
-            , right_(std::move(right)) {
+    /* Hash of a leaf as its parent and proofs see it, see has_bind_key */
+    [[nodiscard]] static HashType bound_hash(uint64_t key, const HashType &leaf_hash) {
+        if constexpr (BINDS_KEYS) {
+            return HashPolicy::bind_key(key, leaf_hash);
+        } else {
+            (void)key;
+            return leaf_hash;
         }
+    }
 
-        [[nodiscard]] bool is_leaf() const {
-            return left_ == nullptr && right_ == nullptr;
-        }
+    /*
+     * Membership proof with only sibling hashes, bottom-up. Bit i of
+     * directions_ is set when siblings_[i] is the left child, i.e. the path
+     * goes right. Depth of the tree is at most 64, so one word is enough.
+     */
+    struct compact_proof_t {
+        std::vector<HashType> siblings_;
+        uint64_t directions_ = 0;
+    };
 
-        [[nodiscard]] uint64_t get_key() const {
-            return blob_.key_;
-        }
+    /* Leaf next to an absent key: its key, leaf hash and compact proof */
+    struct neighbour_t {
+        uint64_t key_;
+        HashType hash_;
+        compact_proof_t proof_;
+    };
 
-        [[nodiscard]] HashType get_value() const {
-            return blob_.value_;
-        }
+    /*
+     * Proof that key is absent: closest leaves below and above it, missing
+     * when key is out of keys range. Both are empty for an empty tree.
+     */
+    struct non_membership_proof_t {
+        std::optional<neighbour_t> lower_;
+        std::optional<neighbour_t> upper_;
     };
 
-    using ptr_t = typename Node::ptr_t;
+    /*
+     * Proof for several keys at once: the subtree spanned by paths to them,
+     * in preorder. shape_ has a bit per node, set for interior nodes. For
+     * each other node proven_ is set if it is a proven leaf, otherwise it is
+     * a sibling off the paths and its hash is the next one in hashes_.
+     * Every hash is emitted once, however many paths share it.
+     */
+    struct multiproof_t {
+        std::vector<bool> shape_;
+        std::vector<bool> proven_;
+        std::vector<HashType> hashes_;
+    };
 
-    // using NodeAlloc = typename std::allocator_traits<Alloc>
-    //      ::template rebind_alloc<Node>;
-    // using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+    /*
+     * Proof that keys_ are all keys in [first, last]: multiproof of the leaves
+     * in range plus the closest leaf on each side of it, if any. leaves_ has
+     * their leaf hashes in key order. The leaves are adjacent, so proven_ has
+     * one run of set bits, and without a neighbour the run reaches the edge.
+     * Size is O(k + depth) for k keys in range.
+     */
+    struct range_proof_t {
+        std::vector<uint64_t> keys_;
+        std::vector<HashType> leaves_;
+        multiproof_t subtree_;
+    };
 
-    ptr_t root_ = nullptr;
-    size_t size_ = 0;
+    /* Proof for verify_many, points to data owned by the caller */
+    struct proof_ref_t {
+        uint64_t key_;
+        const ValueType *value_;
+        const proof_t *proof_;
+    };
+
+    /* Single change for apply_batch: insert (or update) key with value, or erase key */
+    struct op_t {
+        enum class kind_t { INSERT, ERASE };
+
+        kind_t kind_;
+        uint64_t key_;
+        ValueType value_;
+
+        static op_t insert(uint64_t key, ValueType value) {
+            return {kind_t::INSERT, key, std::move(value)};
+        }
+
+        static op_t erase(uint64_t key) {
+            return {kind_t::ERASE, key, ValueType()};
+        }
+    };
 
-private:
     static uint64_t log2(uint64_t num) {
 #ifdef __GNUC__
         return ((unsigned)(8 * sizeof(unsigned long long) - __builtin_clzll((num)) - 1));
@@ -123,227 +382,1660 @@ private:
 #endif
     }
 
+    /* Highest bit where keys differ, 0 for equal keys */
     static uint64_t distance(uint64_t lhs, uint64_t rhs) {
         if (lhs == rhs)
             return 0;
         return log2(lhs ^ rhs);
     }
 
-private:
-    static ptr_t make_node(const Blob &blob) {
-        return std::make_unique<Node>(blob, nullptr, nullptr);
+    /* Walk data of a node: max key of subtree, children and split bit */
+    template <typename Handle>
+    struct link_t {
+        uint64_t key_;
+        Handle left_;
+        Handle right_;
+        uint8_t split_;
+    };
+
+    /*
+     * Walks, proofs and ordered iteration over any storage of a tree of this
+     * shape, so trees that keep nodes elsewhere share them with Csmt.
+     * Nodes is a cheap to copy accessor:
+     *  handle_t     -- reference to a node, e.g. pointer or index
+     *  NIL          -- handle of no node, left_ of leaves is NIL
+     *  link(handle) -- link_t or other struct with the same members, copied on use
+     *  hash(handle) -- hash as parents see it, bound hash for leaves (see has_bind_key)
+     *  blob(handle) -- Blob of a leaf with its leaf hash, by value or reference
+     * Reader owns nothing and is valid while the nodes it reads are.
+     * Storage that may be damaged, e.g. a file, checks handles in link().
+     */
+    template <typename Nodes>
+    class Reader {
+    public:
+        using handle_t = typename Nodes::handle_t;
+        // interior nodes on the way down, splits strictly decrease so 64 is enough
+        using path_t = std::array<handle_t, 64>;
+
+        static constexpr handle_t NIL = Nodes::NIL;
+
+    private:
+        using link_type =
+            std::decay_t<decltype(std::declval<const Nodes &>().link(std::declval<handle_t>()))>;
+        using blob_type = decltype(std::declval<const Nodes &>().blob(std::declval<handle_t>()));
+
+        Nodes nodes_;
+        handle_t root_ = NIL;
+
+        // a loop in damaged storage would run past any real depth
+        static void check_depth(size_t depth) {
+            if (depth > 64) {
+                throw std::runtime_error("tree is damaged: path is too deep");
+            }
+        }
+
+        static void push(path_t &path, size_t &depth, handle_t node) {
+            check_depth(depth + 1);
+            path[depth++] = node;
+        }
+
+        static bool in_subtree(const link_type &link, uint64_t key) {
+            // all keys of subtree share bits above split with its max key
+            return ((key ^ link.key_) >> link.split_) >> 1u == 0;
+        }
+
+        static handle_t child_for(const link_type &link, uint64_t key) {
+            return ((key >> link.split_) & 1u ? link.right_ : link.left_);
+        }
+
+        // walks to max or min leaf of subtree, appending interior nodes to path
+        handle_t descend_extreme(handle_t node, bool max, path_t &path, size_t &depth) const {
+            for (link_type link = nodes_.link(node); link.left_ != NIL; link = nodes_.link(node)) {
+                push(path, depth, node);
+                node = (max ? link.right_ : link.left_);
+            }
+            return node;
+        }
+
+        // compact proof of leaf with key below depth nodes of path
+        compact_proof_t make_compact_proof(const path_t &path, size_t depth, uint64_t key) const {
+            compact_proof_t proof;
+            proof.siblings_.reserve(depth);
+            for (size_t level = 0; depth > 0; ++level) {
+                link_type node = nodes_.link(path[--depth]);
+                if ((key >> node.split_) & 1u) {
+                    proof.siblings_.push_back(hash(node.left_));
+                    proof.directions_ |= uint64_t(1) << level;
+                } else {
+                    proof.siblings_.push_back(hash(node.right_));
+                }
+            }
+            return proof;
+        }
+
+        neighbour_t make_neighbour(const path_t &path, size_t depth, handle_t leaf) const {
+            uint64_t key = nodes_.link(leaf).key_;
+            return {key, nodes_.blob(leaf).value_, make_compact_proof(path, depth, key)};
+        }
+
+        // emits subtree spanned by sorted keys [first, last), false if some key is absent
+        bool collect_multiproof(handle_t root, const uint64_t *first, const uint64_t *last,
+                                multiproof_t &proof, size_t depth) const {
+            check_depth(depth);
+            if (first == last) {
+                proof.shape_.push_back(false);
+                proof.proven_.push_back(false);
+                proof.hashes_.push_back(hash(root));
+                return true;
+            }
+            link_type link = nodes_.link(root);
+            if (link.left_ == NIL) {
+                proof.shape_.push_back(false);
+                proof.proven_.push_back(true);
+                return last - first == 1 && *first == link.key_;
+            }
+            if (!in_subtree(link, *first) || !in_subtree(link, *(last - 1))) {
+                return false;
+            }
+            const uint64_t *mid = std::partition_point(first, last, [&link](uint64_t key) {
+                return ((key >> link.split_) & 1u) == 0;
+            });
+            proof.shape_.push_back(true);
+            return collect_multiproof(link.left_, first, mid, proof, depth + 1) &&
+                   collect_multiproof(link.right_, mid, last, proof, depth + 1);
+        }
+
+        /*
+         * Calls fn(blob) for leaves of subtree with keys in [first, last] in key
+         * order. Subtree is skipped when its max key is below first or its
+         * lowest possible key (common prefix, zeros after) is above last, so
+         * only the two boundary paths are walked besides the leaves in range.
+         */
+        template <typename Fn>
+        void visit_range(handle_t node, uint64_t first, uint64_t last, Fn &fn, size_t depth) const {
+            check_depth(depth);
+            link_type link = nodes_.link(node);
+            if (link.key_ < first) {
+                return;
+            }
+            if (link.left_ == NIL) {
+                if (link.key_ <= last) {
+                    fn(nodes_.blob(node));
+                }
+                return;
+            }
+            uint64_t lowest = link.key_ >> link.split_ >> 1u << link.split_ << 1u;
+            if (lowest > last) {
+                return;
+            }
+            visit_range(link.left_, first, last, fn, depth + 1);
+            visit_range(link.right_, first, last, fn, depth + 1);
+        }
+
+    public:
+        /*
+         * Bidirectional iterator over leaves in key order, *it is the Blob of a
+         * leaf: key and leaf hash. Keeps the path from the root, so a full pass
+         * visits each node a constant number of times. Decrementing end() gives
+         * the last leaf, decrementing begin() gives end(). Any mutation of the
+         * tree invalidates iterators.
+         */
+        class const_iterator {
+            // operator-> of iterators that make Blob on the fly
+            struct arrow_t {
+                Blob blob_;
+
+                const Blob *operator->() const {
+                    return &blob_;
+                }
+            };
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = Blob;
+            using difference_type = std::ptrdiff_t;
+            using reference = blob_type;
+            using pointer =
+                std::conditional_t<std::is_reference_v<reference>, const Blob *, arrow_t>;
+
+            const_iterator() = default;
+
+            reference operator*() const {
+                return reader_.nodes_.blob(leaf_);
+            }
+
+            pointer operator->() const {
+                if constexpr (std::is_reference_v<reference>) {
+                    return &reader_.nodes_.blob(leaf_);
+                } else {
+                    return arrow_t{reader_.nodes_.blob(leaf_)};
+                }
+            }
+
+            const_iterator &operator++() {
+                step(true);
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator copy = *this;
+                step(true);
+                return copy;
+            }
+
+            const_iterator &operator--() {
+                step(false);
+                return *this;
+            }
+
+            const_iterator operator--(int) {
+                const_iterator copy = *this;
+                step(false);
+                return copy;
+            }
+
+            bool operator==(const const_iterator &other) const {
+                return leaf_ == other.leaf_;
+            }
+
+            bool operator!=(const const_iterator &other) const {
+                return leaf_ != other.leaf_;
+            }
+
+        private:
+            friend class Reader;
+
+            Reader reader_;
+            path_t path_;
+            size_t depth_ = 0;
+            handle_t leaf_ = NIL; // NIL for end
+
+            explicit const_iterator(const Reader &reader)
+                : reader_(reader) {
+            }
+
+            // climbs until the path can turn the other way, then goes down to the closest leaf
+            void step(bool forward) {
+                handle_t root = reader_.root_;
+                if (leaf_ == NIL) {
+                    depth_ = 0;
+                    if (root != NIL && !forward) {
+                        leaf_ = reader_.descend_extreme(root, true, path_, depth_);
+                    }
+                    return;
+                }
+                handle_t child = leaf_;
+                while (depth_ > 0) {
+                    link_type parent = reader_.nodes_.link(path_[depth_ - 1]);
+                    handle_t next = (forward ? parent.right_ : parent.left_);
+                    if (next != child) {
+                        leaf_ = reader_.descend_extreme(next, !forward, path_, depth_);
+                        return;
+                    }
+                    child = path_[--depth_];
+                }
+                leaf_ = NIL;
+            }
+        };
+
+        Reader() = default;
+
+        Reader(Nodes nodes, handle_t root)
+            : nodes_(std::move(nodes))
+            , root_(root) {
+        }
+
+        [[nodiscard]] handle_t root() const {
+            return root_;
+        }
+
+        /* Hash of node as its parent and proofs see it */
+        [[nodiscard]] HashType hash(handle_t node) const {
+            return nodes_.hash(node);
+        }
+
+        /*
+         * Walks down while key fits into subtree prefix, stops at leaf (same key
+         * or new sibling) or at subtree to become sibling of the new leaf.
+         * Interior nodes passed are stored in path, their number is returned,
+         * stop gets the node the walk ended at. Tree must not be empty.
+         */
+        size_t descend(uint64_t key, path_t &path, handle_t &stop) const {
+            size_t depth = 0;
+            handle_t node = root_;
+            for (link_type link = nodes_.link(node); link.left_ != NIL && in_subtree(link, key);
+                 link = nodes_.link(node)) {
+                push(path, depth, node);
+                node = child_for(link, key);
+            }
+            stop = node;
+            return depth;
+        }
+
+        /* Leaf with key and path to it, NIL if key is absent */
+        handle_t find(uint64_t key, path_t &path, size_t &depth) const {
+            depth = 0;
+            if (root_ == NIL) {
+                return NIL;
+            }
+            handle_t stop;
+            depth = descend(key, path, stop);
+            link_type link = nodes_.link(stop);
+            return (link.left_ == NIL && link.key_ == key ? stop : NIL);
+        }
+
+        [[nodiscard]] bool contains(uint64_t key) const {
+            path_t path;
+            size_t depth = 0;
+            return find(key, path, depth) != NIL;
+        }
+
+        [[nodiscard]] HashType root_hash() const {
+            return (root_ != NIL ? hash(root_) : HashType());
+        }
+
+        [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+            path_t path;
+            size_t depth = 0;
+            if (find(key, path, depth) == NIL) {
+                return {};
+            }
+            proof_t audit_path;
+            while (depth > 0) {
+                link_type node = nodes_.link(path[--depth]);
+                audit_path.push_back(hash(node.left_));
+                audit_path.push_back(hash(node.right_));
+            }
+            audit_path.push_back(hash(root_));
+            return audit_path;
+        }
+
+        [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+            path_t path;
+            size_t depth = 0;
+            if (find(key, path, depth) == NIL) {
+                return std::nullopt;
+            }
+            return make_compact_proof(path, depth, key);
+        }
+
+        /*
+         * Proof of absence from one descent: it stops at the subtree key would
+         * split off, and the highest bit where key differs from it tells the side.
+         * One neighbour is the extreme leaf of that subtree, the other one is the
+         * opposite extreme under the deepest turn of the path the other way.
+         * Empty if key is in the tree.
+         */
+        [[nodiscard]] std::optional<non_membership_proof_t> non_membership_proof(
+            uint64_t key) const {
+            non_membership_proof_t proof;
+            if (root_ == NIL) {
+                return proof;
+            }
+
+            path_t path;
+            handle_t stop;
+            size_t depth = descend(key, path, stop);
+            link_type link = nodes_.link(stop);
+            if (link.left_ == NIL && link.key_ == key) {
+                return std::nullopt;
+            }
+            bool above = (key >> distance(key, link.key_)) & 1u;
+
+            size_t turn = depth;
+            while (turn > 0 && (((key >> nodes_.link(path[turn - 1]).split_) & 1u) != 0) == above) {
+                --turn;
+            }
+            if (turn > 0) {
+                path_t far_path;
+                std::copy(path.begin(), path.begin() + turn, far_path.begin());
+                size_t far_depth = turn;
+                link_type parent = nodes_.link(path[turn - 1]);
+                handle_t far_root = (above ? parent.right_ : parent.left_);
+                handle_t far = descend_extreme(far_root, !above, far_path, far_depth);
+                (above ? proof.upper_ : proof.lower_) = make_neighbour(far_path, far_depth, far);
+            }
+            handle_t near = descend_extreme(stop, above, path, depth);
+            (above ? proof.lower_ : proof.upper_) = make_neighbour(path, depth, near);
+            return proof;
+        }
+
+        /* See Csmt::membership_multiproof */
+        [[nodiscard]] std::optional<multiproof_t> membership_multiproof(
+            std::vector<uint64_t> keys) const {
+            if (root_ == NIL) {
+                return std::nullopt;
+            }
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+            multiproof_t proof;
+            if (!collect_multiproof(root_, keys.data(), keys.data() + keys.size(), proof, 0)) {
+                return std::nullopt;
+            }
+            return proof;
+        }
+
+        /* See Csmt::range_proof */
+        [[nodiscard]] std::optional<range_proof_t> range_proof(uint64_t first,
+                                                               uint64_t last) const {
+            if (first > last) {
+                return std::nullopt;
+            }
+            range_proof_t proof;
+            if (root_ == NIL) {
+                return proof;
+            }
+            const_iterator it = predecessor(first);
+            if (it == end()) {
+                it = begin();
+            }
+            for (; it != end(); ++it) {
+                const Blob &blob = *it;
+                proof.keys_.push_back(blob.key_);
+                proof.leaves_.push_back(blob.value_);
+                if (blob.key_ > last) {
+                    break;
+                }
+            }
+            const uint64_t *keys = proof.keys_.data();
+            collect_multiproof(root_, keys, keys + proof.keys_.size(), proof.subtree_, 0);
+            return proof;
+        }
+
+        [[nodiscard]] const_iterator begin() const {
+            const_iterator it(*this);
+            if (root_ != NIL) {
+                it.leaf_ = descend_extreme(root_, false, it.path_, it.depth_);
+            }
+            return it;
+        }
+
+        [[nodiscard]] const_iterator end() const {
+            return const_iterator(*this);
+        }
+
+        /* First leaf with key not less than given one: goes left while left max key fits */
+        [[nodiscard]] const_iterator lower_bound(uint64_t key) const {
+            const_iterator it(*this);
+            if (root_ == NIL || nodes_.link(root_).key_ < key) {
+                return it;
+            }
+            handle_t node = root_;
+            link_type link = nodes_.link(node);
+            while (link.left_ != NIL) {
+                push(it.path_, it.depth_, node);
+                link_type left = nodes_.link(link.left_);
+                if (left.key_ >= key) {
+                    node = link.left_;
+                    link = left;
+                } else {
+                    node = link.right_;
+                    link = nodes_.link(node);
+                }
+            }
+            it.leaf_ = node;
+            return it;
+        }
+
+        /* First leaf with key greater than given one */
+        [[nodiscard]] const_iterator successor(uint64_t key) const {
+            return (key == std::numeric_limits<uint64_t>::max() ? end() : lower_bound(key + 1));
+        }
+
+        /* Last leaf with key less than given one */
+        [[nodiscard]] const_iterator predecessor(uint64_t key) const {
+            return --lower_bound(key);
+        }
+
+        /* Calls fn(blob) for each leaf with key in [first, last], in key order */
+        template <typename Fn>
+        void for_each_in_range(uint64_t first, uint64_t last, Fn fn) const {
+            if (root_ != NIL && first <= last) {
+                visit_range(root_, first, last, fn, 0);
+            }
+        }
+    };
+
+protected:
+    using bound_type = bound_hash_t<HashPolicy, HashType>;
+
+    // leaves keep leaf hash in blob_ and bound hash in base, interior nodes merged hash
+    struct Node : bound_type {
+        using ptr_t = Node *;
+
+        Blob blob_;
+        ptr_t left_ = nullptr;
+        ptr_t right_ = nullptr;
+        bool dirty_ = false;  // hash is stale, lazy mode only
+        uint8_t split_ = 0; // highest bit where keys of subtrees differ, interior only
+
+        explicit Node(Blob blob, ptr_t left, ptr_t right, bound_type bound = bound_type())
+            : bound_type(std::move(bound))
+            , blob_(std::move(blob))
+            , left_(left)
+            , right_(right) {
+            if (left_) {
+                split_ = uint8_t(log2(left_->get_key() ^ right_->get_key()));
+            }
+        }
+
+        [[nodiscard]] bool is_leaf() const {
+            return left_ == nullptr && right_ == nullptr;
+        }
+
+        [[nodiscard]] uint64_t get_key() const {
+            return blob_.key_;
+        }
+
+        [[nodiscard]] const HashType &get_value() const {
+            return blob_.value_;
+        }
+
+        /* Hash its parent and proofs see, see has_bind_key */
+        [[nodiscard]] const HashType &get_hash() const {
+            return (is_leaf() ? this->bound_or(blob_.value_) : blob_.value_);
+        }
+
+        // new leaf hash of a leaf, bound is the same hash bound to its key
+        void set_leaf_hash(HashType leaf_hash, bound_type bound) {
+            blob_.value_ = std::move(leaf_hash);
+            static_cast<bound_type &>(*this) = std::move(bound);
+        }
+
+        void set_leaf_hash(HashType leaf_hash) {
+            bound_type bound = bound_type::of(blob_.key_, leaf_hash);
+            set_leaf_hash(std::move(leaf_hash), std::move(bound));
+        }
+    };
+
+    using ptr_t = typename Node::ptr_t;
+
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+    static_assert(std::is_same_v<typename NodeAllocTraits::pointer, Node *>,
+                  "fancy pointers are not supported");
+
+    NodeAlloc alloc_;
+    ptr_t root_ = nullptr;
+    size_t size_ = 0;
+    bool lazy_ = false;
+    std::shared_ptr<ThreadPool> pool_;
+
+    template <typename, typename, typename>
+    friend class CsmtSnapshot;
+
+protected:
+    // parallel passes: tasks per pool thread, smaller batches of leaves are hashed inline
+    static constexpr size_t TASKS_PER_THREAD = 4;
+    static constexpr size_t PARALLEL_LEAVES = 1024;
+    // few lanes worth of proofs, levels of a chunk are walked while its proofs are in cache
+    static constexpr size_t VERIFY_CHUNK = 64;
+
+    // Reader access to own nodes
+    struct nodes_t {
+        using handle_t = ptr_t;
+
+        static constexpr ptr_t NIL = nullptr;
+
+        static link_t<ptr_t> link(ptr_t node) {
+            return {node->get_key(), node->left_, node->right_, node->split_};
+        }
+
+        static const HashType &hash(ptr_t node) {
+            return node->get_hash();
+        }
+
+        static const Blob &blob(ptr_t node) {
+            return node->blob_;
+        }
+    };
+
+    using reader_t = Reader<nodes_t>;
+    using path_t = typename reader_t::path_t;
+
+    [[nodiscard]] reader_t reader() const {
+        return reader_t(nodes_t(), root_);
     }
 
-    static ptr_t make_node(ptr_t &lhs, ptr_t &rhs) {
-        uint64_t l_key = lhs->get_key();
-        uint64_t r_key = rhs->get_key();
-        uint64_t key = (l_key < r_key ? r_key : l_key);
+    // link holding node at given depth on the way to key: root or child of path node
+    ptr_t *link_at(const path_t &path, size_t depth, uint64_t key) {
+        if (depth == 0) {
+            return &root_;
+        }
+        ptr_t parent = path[depth - 1];
+        return ((key >> parent->split_) & 1u ? &parent->right_ : &parent->left_);
+    }
 
-        HashType value = HashPolicy::merge_hash(lhs->get_value(), rhs->get_value());
-        return std::make_unique<Node>(Blob(key, value), std::move(lhs), std::move(rhs));
+protected:
+    ptr_t create_node(Blob blob, ptr_t left, ptr_t right, bound_type bound = bound_type()) {
+        ptr_t node = NodeAllocTraits::allocate(alloc_, 1);
+        try {
+            NodeAllocTraits::construct(alloc_, node, std::move(blob), left, right,
+                                       std::move(bound));
+        } catch (...) {
+            NodeAllocTraits::deallocate(alloc_, node, 1);
+            throw;
+        }
+        return node;
     }
 
-    static ptr_t make_node(ptr_t &root) {
-        return make_node(root->left_, root->right_);
+    void destroy_node(ptr_t node) {
+        NodeAllocTraits::destroy(alloc_, node);
+        NodeAllocTraits::deallocate(alloc_, node, 1);
     }
 
-private:
-    ptr_t insert(ptr_t &root, const Blob &blob) {
-        if (root->is_leaf()) {
-            return insert_leaf(root, blob);
+    void destroy_subtree(ptr_t root) {
+        if (root) {
+            destroy_subtree(root->left_);
+            destroy_subtree(root->right_);
+            destroy_node(root);
+        }
+    }
+
+    ptr_t make_node(Blob &&blob, bound_type &&bound) {
+        return create_node(std::move(blob), nullptr, nullptr, std::move(bound));
+    }
+
+    ptr_t make_node(Blob &&blob) {
+        bound_type bound = bound_type::of(blob.key_, blob.value_);
+        return make_node(std::move(blob), std::move(bound));
+    }
+
+    ptr_t make_node(ptr_t lhs, ptr_t rhs) {
+        uint64_t l_key = lhs->get_key();
+        uint64_t r_key = rhs->get_key();
+        uint64_t key = (l_key < r_key ? r_key : l_key);
+
+        if (lazy_) {
+            ptr_t node = create_node(Blob(key, HashType()), lhs, rhs);
+            node->dirty_ = true;
+            return node;
         }
+        HashType value = HashPolicy::merge_hash(lhs->get_hash(), rhs->get_hash());
+        return create_node(Blob(key, std::move(value)), lhs, rhs);
+    }
 
+    // recomputes key and hash of interior root in place after its child changed
+    static void rehash(ptr_t root) {
         uint64_t l_key = root->left_->get_key();
         uint64_t r_key = root->right_->get_key();
 
-        if (root->left_->is_leaf() && l_key == blob.key_) {
-            root->left_ = insert_leaf(root->left_, blob);
-            return make_node(root);
+        root->blob_.key_ = (l_key < r_key ? r_key : l_key);
+        root->blob_.value_ =
+            HashPolicy::merge_hash(root->left_->get_hash(), root->right_->get_hash());
+        root->dirty_ = false;
+    }
+
+    // rehashes independent interior nodes, in one batch if policy supports it
+    static void rehash_many(const ptr_t *nodes, size_t count) {
+        if constexpr (has_merge_hash_many<HashPolicy, HashType>::value) {
+            std::vector<const HashType *> lhs(count);
+            std::vector<const HashType *> rhs(count);
+            std::vector<HashType> values(count);
+            for (size_t i = 0; i < count; ++i) {
+                lhs[i] = &nodes[i]->left_->get_hash();
+                rhs[i] = &nodes[i]->right_->get_hash();
+            }
+            HashPolicy::merge_hash_many(lhs.data(), rhs.data(), values.data(), count);
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t l_key = nodes[i]->left_->get_key();
+                uint64_t r_key = nodes[i]->right_->get_key();
+                nodes[i]->blob_.key_ = (l_key < r_key ? r_key : l_key);
+                nodes[i]->blob_.value_ = std::move(values[i]);
+                nodes[i]->dirty_ = false;
+            }
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                rehash(nodes[i]);
+            }
         }
-        if (root->right_->is_leaf() && r_key == blob.key_) {
-            root->right_ = insert_leaf(root->right_, blob);
-            return make_node(root);
+    }
+
+    // refreshes interior root after its child changed, lazy mode only marks hash stale
+    void update(ptr_t root) {
+        if (lazy_) {
+            uint64_t l_key = root->left_->get_key();
+            uint64_t r_key = root->right_->get_key();
+            root->blob_.key_ = (l_key < r_key ? r_key : l_key);
+            root->dirty_ = true;
+        } else {
+            rehash(root);
         }
+    }
 
-        uint64_t l_dist = distance(blob.key_, l_key);
-        uint64_t r_dist = distance(blob.key_, r_key);
+private:
+    // change of apply_batch with hashed leaf value, erased key has no value
+    struct Change {
+        Blob blob_;
+        bool erase_;
+        bound_type bound_ = bound_type();
 
-        if (l_dist == r_dist) {
-            ptr_t new_node = make_node(blob);
-            uint64_t min_key = (l_key < r_key ? l_key : r_key);
-            ++size_;
-            if (blob.key_ < min_key) {
-                return make_node(new_node, root);
+        [[nodiscard]] uint64_t get_key() const {
+            return blob_.key_;
+        }
+    };
+
+    // stale interior nodes bucketed by height above their lowest stale descendant
+    using levels_t = std::vector<std::vector<ptr_t>>;
+
+    struct Patch {
+        ptr_t root_;
+        bool changed_;
+    };
+
+    // sorts changes by key, for repeated keys only the last one is kept
+    static void sort_changes(std::vector<Change> &changes) {
+        auto by_key = [](const Change &lhs, const Change &rhs) {
+            return lhs.get_key() < rhs.get_key();
+        };
+        if (!std::is_sorted(changes.begin(), changes.end(), by_key)) {
+            std::stable_sort(changes.begin(), changes.end(), by_key);
+        }
+        size_t unique = 0;
+        for (size_t i = 0; i < changes.size(); ++i) {
+            if (unique > 0 && changes[unique - 1].get_key() == changes[i].get_key()) {
+                changes[unique - 1] = std::move(changes[i]);
             } else {
-                return make_node(root, new_node);
+                if (unique != i) {
+                    changes[unique] = std::move(changes[i]);
+                }
+                ++unique;
             }
         }
+        changes.erase(changes.begin() + unique, changes.end());
+    }
 
-        if (l_dist < r_dist) {
-            root->left_ = insert(root->left_, blob);
-        } else {
-            root->right_ = insert(root->right_, blob);
+    // hashes values of inserts, split between pool threads if there is a pool
+    template <typename ValueOf>
+    void hash_leaves(std::vector<Change> &changes, ValueOf value_of) const {
+        auto hash_range = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                if (!changes[i].erase_) {
+                    Blob &blob = changes[i].blob_;
+                    blob.value_ = HashPolicy::leaf_hash(value_of(i));
+                    changes[i].bound_ = bound_type::of(blob.key_, blob.value_);
+                }
+            }
+        };
+        if (!pool_ || changes.size() < PARALLEL_LEAVES) {
+            hash_range(0, changes.size());
+            return;
         }
-        return make_node(root);
+        size_t tasks = TASKS_PER_THREAD * pool_->size();
+        size_t chunk = (changes.size() + tasks - 1) / tasks;
+        pool_->run(tasks, [&](size_t task) {
+            size_t first = std::min(task * chunk, changes.size());
+            hash_range(first, std::min(first + chunk, changes.size()));
+        });
     }
 
-    ptr_t insert_leaf(ptr_t &leaf, const Blob &blob) {
-        uint64_t leaf_key = leaf->get_key();
-        if (blob.key_ == leaf_key) {
-            // update existing value
-            leaf->blob_.value_ = blob.value_;
-            return std::move(leaf);
+    static void add_to_level(levels_t &levels, ptr_t node, size_t height) {
+        if (levels.size() < height) {
+            levels.resize(height);
         }
-        ++size_;
-        ptr_t new_node = make_node(blob);
-        if (blob.key_ < leaf_key) {
-            return make_node(new_node, leaf);
-        } else {
-            return make_node(leaf, new_node);
+        levels[height - 1].push_back(node);
+    }
+
+    // buckets stale interior nodes of subtree by height, returns height of root
+    static size_t collect_dirty(ptr_t root, levels_t &levels) {
+        if (!root->dirty_) {
+            return 0;
         }
+        size_t height = std::max(collect_dirty(root->left_, levels),
+                                 collect_dirty(root->right_, levels)) + 1;
+        add_to_level(levels, root, height);
+        return height;
     }
 
-    bool collect_audit_path(const ptr_t &root, uint64_t key, proof_t &audit_path) const {
-        if (root->is_leaf()) {
-            return root->get_key() == key;
+    // hashes each stale interior node of subtree once, a whole level per batch
+    static void rehash_dirty(ptr_t root) {
+        levels_t levels;
+        collect_dirty(root, levels);
+        for (const std::vector<ptr_t> &level : levels) {
+            rehash_many(level.data(), level.size());
         }
+    }
 
-        uint64_t l_key = root->left_->get_key();
-        uint64_t r_key = root->right_->get_key();
+    /*
+     * Stale hashes are a cache miss, not a state change, so readers may flush.
+     * With a pool, stale nodes of top levels are expanded breadth first until
+     * there are enough independent stale subtrees, threads take subtrees one
+     * by one, then the top is merged on the way up by the calling thread.
+     */
+    void flush() const {
+        if (!root_ || !root_->dirty_) {
+            return;
+        }
+        if (!pool_) {
+            rehash_dirty(root_);
+            return;
+        }
 
-        if (root->left_->is_leaf() && l_key == key) {
-            audit_path.push_back(root->left_->get_value());
-            audit_path.push_back(root->right_->get_value());
-            return true;
+        std::vector<ptr_t> top;
+        std::vector<ptr_t> tasks{root_};
+        while (tasks.size() < TASKS_PER_THREAD * pool_->size()) {
+            std::vector<ptr_t> next;
+            for (ptr_t node : tasks) {
+                top.push_back(node);
+                for (ptr_t child : {node->left_, node->right_}) {
+                    if (child->dirty_) {
+                        next.push_back(child);
+                    }
+                }
+            }
+            tasks.swap(next);
+            if (tasks.empty()) {
+                break;
+            }
         }
-        if (root->right_->is_leaf() && r_key == key) {
-            audit_path.push_back(root->left_->get_value());
-            audit_path.push_back(root->right_->get_value());
-            return true;
+
+        pool_->run(tasks.size(), [&tasks](size_t task) { rehash_dirty(tasks[task]); });
+        for (auto it = top.rbegin(); it != top.rend(); ++it) {
+            rehash(*it);
         }
+    }
 
-        uint64_t l_dist = distance(key, l_key);
-        uint64_t r_dist = distance(key, r_key);
+    /*
+     * Links disjoint subtrees given in key order into one. Crit-bit tree over
+     * sorted keys is a Cartesian tree of distances between neighbours, so one
+     * stack pass is enough. New interior nodes are left stale.
+     * On exception subtrees are left unlinked, as they were passed.
+     */
+    Patch link(const std::vector<Patch> &items) {
+        std::vector<Patch> stack;
+        std::vector<uint64_t> gaps; // gaps[i] is distance between stack[i] and stack[i + 1]
+        std::vector<ptr_t> created;
+        stack.reserve(items.size());
+        created.reserve(items.size());
 
-        if (l_dist < r_dist) {
-            if (collect_audit_path(root->left_, key, audit_path)) {
-                audit_path.push_back(root->left_->get_value());
-                audit_path.push_back(root->right_->get_value());
-                return true;
+        auto merge_top = [&]() {
+            const Patch &lhs = stack[stack.size() - 2];
+            const Patch &rhs = stack.back();
+
+            // hash is filled later, key of sorted right subtree is the max
+            ptr_t node = create_node(Blob(rhs.root_->get_key(), HashType()), lhs.root_,
+                                     rhs.root_);
+            node->dirty_ = true;
+            created.push_back(node);
+            stack.pop_back();
+            stack.back() = {node, true};
+        };
+
+        try {
+            stack.push_back(items[0]);
+            for (size_t i = 1; i < items.size(); ++i) {
+                uint64_t gap = distance(items[i - 1].root_->get_key(), items[i].root_->get_key());
+                while (!gaps.empty() && gaps.back() < gap) {
+                    gaps.pop_back();
+                    merge_top();
+                }
+                gaps.push_back(gap);
+                stack.push_back(items[i]);
             }
-        } else if (l_dist > r_dist) {
-            if (collect_audit_path(root->right_, key, audit_path)) {
-                audit_path.push_back(root->left_->get_value());
-                audit_path.push_back(root->right_->get_value());
-                return true;
+            while (stack.size() > 1) {
+                merge_top();
             }
+        } catch (...) {
+            for (ptr_t node : created) {
+                destroy_node(node);
+            }
+            throw;
         }
-        return false;
+        return stack.back();
     }
 
-    ptr_t erase(ptr_t &root, uint64_t key) {
-        if (root->is_leaf()) {
-            if (root->get_key() == key) {
-                --size_;
-                return nullptr;
-            } else {
-                return std::move(root);
+    // links subtree (may be null) with new leaves of inserts before and after it
+    Patch link_inserts(Patch subtree, Change *below_first, Change *below_last,
+                       Change *above_first, Change *above_last) {
+        std::vector<Patch> items;
+        auto add_inserts = [&](Change *first, Change *last) {
+            for (; first != last; ++first) {
+                if (!first->erase_) {
+                    items.push_back({make_node(std::move(first->blob_), std::move(first->bound_)),
+                                     true});
+                    ++size_;
+                }
+            }
+        };
+
+        try {
+            add_inserts(below_first, below_last);
+            if (subtree.root_) {
+                items.push_back(subtree);
+            }
+            add_inserts(above_first, above_last);
+            if (items.size() == (subtree.root_ ? 1u : 0u)) {
+                return subtree;
             }
+            return link(items);
+        } catch (...) {
+            for (const Patch &item : items) {
+                if (item.root_ != subtree.root_) {
+                    --size_;
+                    destroy_node(item.root_);
+                }
+            }
+            throw;
         }
-        if (root->left_->is_leaf() && root->left_->get_key() == key) {
-            --size_;
-            return std::move(root->right_);
+    }
+
+    /*
+     * Applies sorted unique changes [first, last) to subtree in one descent.
+     * Changed interior nodes are only marked stale, so shared ancestors are
+     * hashed once per batch, not once per change.
+     */
+    Patch apply(ptr_t root, Change *first, Change *last) {
+        if (first == last) {
+            return {root, false};
         }
-        if (root->right_->is_leaf() && root->right_->get_key() == key) {
-            --size_;
-            return std::move(root->left_);
+        if (root->is_leaf()) {
+            uint64_t key = root->get_key();
+            Change *found = std::partition_point(first, last, [key](const Change &change) {
+                return change.get_key() < key;
+            });
+            Change *after = found;
+            Patch leaf{root, false};
+            if (found != last && found->get_key() == key) {
+                ++after;
+                if (found->erase_) {
+                    --size_;
+                    destroy_node(root);
+                    leaf = {nullptr, true};
+                } else {
+                    root->set_leaf_hash(std::move(found->blob_.value_), std::move(found->bound_));
+                    leaf.changed_ = true;
+                }
+            }
+            return link_inserts(leaf, first, found, after, last);
         }
 
-        uint64_t l_dist = distance(key, root->left_->get_key());
-        uint64_t r_dist = distance(key, root->right_->get_key());
+        // keys of subtree share bits above split bit, left has it unset, right set
+        uint64_t split = root->split_;
+        uint64_t prefix = (root->get_key() >> split) >> 1u;
+        auto prefix_of = [split](const Change &change) {
+            return (change.get_key() >> split) >> 1u;
+        };
+
+        Change *inner_first = std::partition_point(first, last, [&](const Change &change) {
+            return prefix_of(change) < prefix;
+        });
+        Change *inner_last = std::partition_point(inner_first, last, [&](const Change &change) {
+            return prefix_of(change) == prefix;
+        });
+        Change *inner_mid = std::partition_point(inner_first, inner_last, [&](const Change &change) {
+            return ((change.get_key() >> split) & 1u) == 0;
+        });
 
-        if (l_dist == r_dist) {
-            return std::move(root);
+        Patch lhs = apply(root->left_, inner_first, inner_mid);
+        Patch rhs = apply(root->right_, inner_mid, inner_last);
+
+        Patch result{root, false};
+        if (!lhs.root_ || !rhs.root_) {
+            destroy_node(root);
+            result = {(lhs.root_ ? lhs.root_ : rhs.root_), true};
+        } else if (lhs.changed_ || rhs.changed_) {
+            root->left_ = lhs.root_;
+            root->right_ = rhs.root_;
+            root->blob_.key_ = rhs.root_->get_key();
+            root->dirty_ = true;
+            result.changed_ = true;
         }
 
-        // in worst case the same pointer returned with move
-        if (l_dist < r_dist) {
-            root->left_ = erase(root->left_, key);
+        // keys outside of subtree prefix can only be new neighbours of it
+        return link_inserts(result, first, inner_first, inner_last, last);
+    }
+
+    void apply_changes(std::vector<Change> &changes) {
+        sort_changes(changes);
+        if (changes.empty()) {
+            return;
+        }
+        Change *first = changes.data();
+        Change *last = changes.data() + changes.size();
+        if (root_) {
+            root_ = apply(root_, first, last).root_;
         } else {
-            root->right_ = erase(root->right_, key);
+            root_ = link_inserts({nullptr, false}, first, last, last, last).root_;
+        }
+        if (!lazy_) {
+            flush();
         }
-        return make_node(root);
     }
 
-    bool contains(const ptr_t &root, uint64_t key) const {
-        if (root->is_leaf()) {
-            return root->get_key() == key;
+    static bool fold_compact_proof(HashType hash, const compact_proof_t &proof,
+                                   const HashType &root_hash) {
+        size_t depth = proof.siblings_.size();
+        if (depth > 64 || (depth < 64 && proof.directions_ >> depth != 0)) {
+            return false;
         }
-        uint64_t left_key = root->left_->get_key();
-        uint64_t right_key = root->right_->get_key();
+        for (size_t level = 0; level < depth; ++level) {
+            if ((proof.directions_ >> level) & 1u) {
+                hash = HashPolicy::merge_hash(proof.siblings_[level], hash);
+            } else {
+                hash = HashPolicy::merge_hash(hash, proof.siblings_[level]);
+            }
+        }
+        return hash == root_hash;
+    }
 
-        if (root->left_->is_leaf() && root->left_->get_key() == key) {
-            return true;
+    // direction of path at given distance from root, true is right
+    static bool goes_right(const compact_proof_t &proof, size_t from_root) {
+        return (proof.directions_ >> (proof.siblings_.size() - 1 - from_root)) & 1u;
+    }
+
+    /*
+     * Leaves are adjacent when paths part at some node, lower goes left there
+     * and then only right, upper goes right and then only left. Proofs are
+     * checked against one root, so equal directions above mean same nodes.
+     * common gets the level of the node where paths part.
+     */
+    static bool adjacent(const compact_proof_t &lower, const compact_proof_t &upper,
+                         size_t &common) {
+        size_t lower_depth = lower.siblings_.size();
+        size_t upper_depth = upper.siblings_.size();
+        common = 0;
+        while (common < lower_depth && common < upper_depth &&
+               goes_right(lower, common) == goes_right(upper, common)) {
+            ++common;
         }
-        if (root->right_->is_leaf() && root->right_->get_key() == key) {
-            return true;
+        if (common == lower_depth || common == upper_depth || goes_right(lower, common)) {
+            return false;
+        }
+        for (size_t level = common + 1; level < lower_depth; ++level) {
+            if (!goes_right(lower, level)) {
+                return false;
+            }
+        }
+        for (size_t level = common + 1; level < upper_depth; ++level) {
+            if (goes_right(upper, level)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Splits decrease on the way down and each turn follows the bit of key at
+     * its split, so turns of a path to key are a subsequence of key bits from
+     * the highest one. Matches levels [first, last) from the root to bits
+     * below given one, returns bit of the last turn or -1 if they do not fit.
+     */
+    static int fit_path(const compact_proof_t &proof, uint64_t key, size_t first, size_t last,
+                        int below) {
+        for (size_t level = first; level < last; ++level) {
+            bool right = goes_right(proof, level);
+            do {
+                --below;
+            } while (below >= 0 && bool((key >> below) & 1u) != right);
+            if (below < 0) {
+                return -1;
+            }
         }
+        return below;
+    }
 
-        uint64_t l_dist = distance(key, left_key);
-        uint64_t r_dist = distance(key, right_key);
-        if (l_dist == r_dist) {
+    struct multiproof_cursor_t {
+        size_t shape_ = 0;
+        size_t proven_ = 0;
+        size_t hashes_ = 0;
+        size_t values_ = 0;
+    };
+
+    // folded subtree of multiproof: hash and proven keys in it, if any
+    struct folded_t {
+        HashType hash_;
+        bool proven_ = false;
+        uint64_t min_key_ = 0;
+        uint64_t max_key_ = 0;
+        int split_ = -1; // lowest split bit the subtree root may have, -1 for a leaf
+    };
+
+    /*
+     * Checks that proven keys of children fit a crit-bit node over them and
+     * puts them to node. With keys on both sides split is the highest bit where
+     * they differ, it must be above splits of children and put lower keys to
+     * the left. With keys on one side only it is the lowest bit above the
+     * child split that turns those keys to that side.
+     */
+    static bool fit_split(const folded_t &lhs, const folded_t &rhs, folded_t &node) {
+        if (lhs.proven_ && rhs.proven_) {
+            auto split = int(distance(lhs.max_key_, rhs.min_key_));
+            if (lhs.max_key_ >= rhs.min_key_ || split <= lhs.split_ || split <= rhs.split_) {
+                return false;
+            }
+            node.proven_ = true;
+            node.min_key_ = lhs.min_key_;
+            node.max_key_ = rhs.max_key_;
+            node.split_ = split;
+        } else if (lhs.proven_ || rhs.proven_) {
+            const folded_t &child = (lhs.proven_ ? lhs : rhs);
+            int split = child.split_ + 1;
+            while (split < 64 && bool((child.min_key_ >> split) & 1u) != rhs.proven_) {
+                ++split;
+            }
+            if (split == 64) {
+                return false;
+            }
+            node.proven_ = true;
+            node.min_key_ = child.min_key_;
+            node.max_key_ = child.max_key_;
+            node.split_ = split;
+        }
+        return true;
+    }
+
+    /*
+     * Recomputes next preorder subtree of proof, false on malformed proof or
+     * keys that do not fit its shape. leaf_hash(idx) gives hash of idx-th
+     * proven leaf with key keys[idx], idx < values_count.
+     */
+    template <typename LeafHash>
+    static bool fold_multiproof(const multiproof_t &proof, const LeafHash &leaf_hash,
+                                const uint64_t *keys, size_t values_count,
+                                multiproof_cursor_t &at, size_t depth, folded_t &node) {
+        if (at.shape_ >= proof.shape_.size() || depth > 64) {
+            return false;
+        }
+        if (proof.shape_[at.shape_++]) {
+            folded_t lhs;
+            folded_t rhs;
+            if (!fold_multiproof(proof, leaf_hash, keys, values_count, at, depth + 1, lhs) ||
+                !fold_multiproof(proof, leaf_hash, keys, values_count, at, depth + 1, rhs) ||
+                !fit_split(lhs, rhs, node)) {
+                return false;
+            }
+            node.hash_ = HashPolicy::merge_hash(lhs.hash_, rhs.hash_);
+            return true;
+        }
+        if (at.proven_ >= proof.proven_.size()) {
             return false;
         }
-        if (l_dist < r_dist) {
-            return contains(root->left_, key);
+        if (proof.proven_[at.proven_++]) {
+            if (at.values_ >= values_count) {
+                return false;
+            }
+            node.proven_ = true;
+            node.min_key_ = node.max_key_ = keys[at.values_];
+            node.hash_ = leaf_hash(at.values_++);
+        } else {
+            if (at.hashes_ >= proof.hashes_.size()) {
+                return false;
+            }
+            node.hash_ = proof.hashes_[at.hashes_++];
+        }
+        return true;
+    }
+
+    /*
+     * Verifies proofs level by level: at each level pairs of all proofs still
+     * climbing are merged in one batch, so multi-buffer policies hash them
+     * side by side. results[i] is set for items[i].
+     */
+    static void verify_chunk(const proof_ref_t *items, size_t count, const HashType &root_hash,
+                             bool *results) {
+        if constexpr (!has_merge_hash_many<HashPolicy, HashType>::value) {
+            for (size_t i = 0; i < count; ++i) {
+                results[i] = verify(items[i].key_, *items[i].value_, *items[i].proof_, root_hash);
+            }
         } else {
-            return contains(root->right_, key);
+            std::vector<HashType> hashes(count);
+            size_t max_levels = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const proof_t &proof = *items[i].proof_;
+                results[i] = (proof.size() % 2 == 1 && proof.back() == root_hash);
+                if (results[i]) {
+                    hashes[i] = bound_hash(items[i].key_, HashPolicy::leaf_hash(*items[i].value_));
+                    max_levels = std::max(max_levels, proof.size() / 2);
+                }
+            }
+
+            std::vector<size_t> active;
+            std::vector<const HashType *> lhs;
+            std::vector<const HashType *> rhs;
+            std::vector<HashType> merged;
+            for (size_t level = 0; level < max_levels; ++level) {
+                active.clear();
+                lhs.clear();
+                rhs.clear();
+                for (size_t i = 0; i < count; ++i) {
+                    const proof_t &proof = *items[i].proof_;
+                    if (!results[i] || 2 * level + 1 >= proof.size()) {
+                        continue;
+                    }
+                    const HashType &left = proof[2 * level];
+                    const HashType &right = proof[2 * level + 1];
+                    if (hashes[i] != left && hashes[i] != right) {
+                        results[i] = false;
+                        continue;
+                    }
+                    active.push_back(i);
+                    lhs.push_back(&left);
+                    rhs.push_back(&right);
+                }
+                merged.resize(active.size());
+                HashPolicy::merge_hash_many(lhs.data(), rhs.data(), merged.data(), active.size());
+                for (size_t j = 0; j < active.size(); ++j) {
+                    hashes[active[j]] = std::move(merged[j]);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                results[i] = results[i] && hashes[i] == root_hash;
+            }
         }
     }
 
 public:
+    using const_iterator = typename reader_t::const_iterator;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
     Csmt() = default;
 
+    explicit Csmt(const Alloc &alloc)
+        : alloc_(alloc) {
+    }
+
+    /*
+     * Builds tree from range of (key, value) pairs in one pass, hashing each
+     * interior node once. Result is the same as inserting pairs one by one:
+     * for repeated keys the last value wins. Sorted range skips sorting.
+     */
+    template <typename InputIt>
+    Csmt(InputIt first, InputIt last, const Alloc &alloc = Alloc(), size_t threads = 1)
+        : Csmt(alloc) {
+        set_threads(threads);
+        std::vector<Change> changes;
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                                        typename std::iterator_traits<InputIt>::iterator_category>) {
+            std::vector<InputIt> items;
+            for (; first != last; ++first) {
+                changes.push_back({Blob(first->first, HashType()), false});
+                items.push_back(first);
+            }
+            hash_leaves(changes, [&items](size_t i) -> decltype(auto) { return (items[i]->second); });
+        } else {
+            for (; first != last; ++first) {
+                Blob blob(first->first, HashPolicy::leaf_hash(first->second));
+                bound_type bound = bound_type::of(blob.key_, blob.value_);
+                changes.push_back({std::move(blob), false, std::move(bound)});
+            }
+        }
+        apply_changes(changes);
+    }
+
+    template <typename Range>
+    static Csmt build(const Range &range, const Alloc &alloc = Alloc(), size_t threads = 1) {
+        return Csmt(std::begin(range), std::end(range), alloc, threads);
+    }
+
+    Csmt(const Csmt &) = delete;
+    Csmt &operator=(const Csmt &) = delete;
+
+    Csmt(Csmt &&other) noexcept
+        : alloc_(other.alloc_)
+        , root_(other.root_)
+        , size_(other.size_)
+        , lazy_(other.lazy_)
+        , pool_(std::move(other.pool_)) {
+        other.root_ = nullptr;
+        other.size_ = 0;
+    }
+
+    Csmt &operator=(Csmt &&other) noexcept {
+        if (this != &other) {
+            destroy_subtree(root_);
+            alloc_ = other.alloc_;
+            root_ = other.root_;
+            size_ = other.size_;
+            lazy_ = other.lazy_;
+            pool_ = std::move(other.pool_);
+            other.root_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
     void insert(uint64_t key, const ValueType &value) {
-        if (root_) {
-            root_ = insert(root_, {key, HashPolicy::leaf_hash(value)});
+        Blob blob(key, HashPolicy::leaf_hash(value));
+        if (!root_) {
+            ++size_;
+            root_ = make_node(std::move(blob));
+            return;
+        }
+
+        path_t path;
+        ptr_t stop;
+        size_t depth = reader().descend(key, path, stop);
+        ptr_t *link = link_at(path, depth, key);
+        if (stop->is_leaf() && stop->get_key() == key) {
+            // update existing value
+            stop->set_leaf_hash(std::move(blob.value_));
         } else {
+            ptr_t leaf = make_node(std::move(blob));
             ++size_;
-            root_ = make_node({key, HashPolicy::leaf_hash(value)});
+            *link = (key < stop->get_key() ? make_node(leaf, stop) : make_node(stop, leaf));
+        }
+        while (depth > 0) {
+            update(path[--depth]);
+        }
+    }
+
+    /*
+     * Applies range of op_t as if they were called one by one, but in one
+     * descent: each changed interior node is rehashed once per batch.
+     * Tree is not usable after an exception here.
+     */
+    template <typename Range>
+    void apply_batch(const Range &ops) {
+        std::vector<Change> changes;
+        std::vector<const op_t *> items;
+        for (const op_t &op : ops) {
+            changes.push_back({Blob(op.key_, HashType()), op.kind_ == op_t::kind_t::ERASE});
+            items.push_back(&op);
         }
+        hash_leaves(changes, [&items](size_t i) -> const ValueType & { return items[i]->value_; });
+        apply_changes(changes);
     }
 
     [[nodiscard]] proof_t membership_proof(uint64_t key) const {
-        if (root_) {
-            proof_t audit_path;
-            if (collect_audit_path(root_, key, audit_path)) {
-                audit_path.push_back(root_->get_value());
+        flush();
+        return reader().membership_proof(key);
+    }
+
+    /*
+     * Checks membership_proof of key with value against root_hash. Key is
+     * checked only if HashPolicy has bind_key, otherwise the proof checks
+     * value and its position.
+     */
+    [[nodiscard]] static bool verify(uint64_t key, const ValueType &value, const proof_t &proof,
+                                     const HashType &root_hash) {
+        if (proof.size() % 2 == 0 || proof.back() != root_hash) {
+            return false;
+        }
+        HashType hash = bound_hash(key, HashPolicy::leaf_hash(value));
+        for (size_t level = 0; 2 * level + 1 < proof.size(); ++level) {
+            const HashType &left = proof[2 * level];
+            const HashType &right = proof[2 * level + 1];
+            if (hash != left && hash != right) {
+                return false;
             }
-            return audit_path;
+            hash = HashPolicy::merge_hash(left, right);
+        }
+        return hash == root_hash;
+    }
+
+    /*
+     * Checks count proofs against one root, returns true if all are valid.
+     * Per proof verdicts go to results if given. Proofs are split into chunks
+     * between pool threads, inside a chunk levels are merged in batches.
+     */
+    static bool verify_many(const proof_ref_t *items, size_t count, const HashType &root_hash,
+                            bool *results = nullptr, ThreadPool *pool = nullptr) {
+        std::unique_ptr<bool[]> own_results;
+        if (!results) {
+            own_results.reset(new bool[count]);
+            results = own_results.get();
+        }
+        size_t chunks = (count + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+        auto verify_range = [&](size_t chunk) {
+            size_t first = chunk * VERIFY_CHUNK;
+            size_t chunk_size = std::min(VERIFY_CHUNK, count - first);
+            verify_chunk(items + first, chunk_size, root_hash, results + first);
+        };
+        if (pool && chunks > 1) {
+            pool->run(chunks, verify_range);
         } else {
-            return {};
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                verify_range(chunk);
+            }
         }
+        return std::all_of(results, results + count, [](bool valid) { return valid; });
     }
 
-    void erase(uint64_t key) {
-        if (root_) {
-            root_ = erase(root_, key);
+    /*
+     * One proof for all keys, each needed hash is emitted once: size grows
+     * with the subtree spanned by keys, not with keys times depth.
+     * Empty if tree is empty or some key is not in it.
+     */
+    [[nodiscard]] std::optional<multiproof_t> membership_multiproof(
+        std::vector<uint64_t> keys) const {
+        flush();
+        return reader().membership_multiproof(std::move(keys));
+    }
+
+    /*
+     * Checks multiproof of keys in increasing order with their values, keys
+     * must fit split bits of the subtree as it is folded
+     */
+    template <typename Keys, typename Values>
+    [[nodiscard]] static bool verify_multiproof(const Keys &keys, const Values &values,
+                                                const multiproof_t &proof,
+                                                const HashType &root_hash) {
+        std::vector<uint64_t> key_list(std::begin(keys), std::end(keys));
+        size_t values_count = std::distance(std::begin(values), std::end(values));
+        if (key_list.size() != values_count) {
+            return false;
         }
+        multiproof_cursor_t at;
+        folded_t root;
+        auto leaf_hash = [&key_list, &values](size_t idx) {
+            return bound_hash(key_list[idx],
+                              HashPolicy::leaf_hash(*std::next(std::begin(values), idx)));
+        };
+        return fold_multiproof(proof, leaf_hash, key_list.data(), values_count, at, 0, root) &&
+               at.shape_ == proof.shape_.size() && at.proven_ == proof.proven_.size() &&
+               at.hashes_ == proof.hashes_.size() && at.values_ == values_count &&
+               root.hash_ == root_hash;
     }
 
-    [[nodiscard]] bool contains(uint64_t key) const {
-        if (root_) {
-            return contains(root_, key);
-        } else {
+    /*
+     * Proof of the complete set of keys in [first, last], see range_proof_t.
+     * Empty if first > last.
+     */
+    [[nodiscard]] std::optional<range_proof_t> range_proof(uint64_t first, uint64_t last) const {
+        flush();
+        return reader().range_proof(first, last);
+    }
+
+    /*
+     * Checks that proof.keys_ in [first, last] are all keys of the tree in
+     * that range: keys are in order and fit split bits of the subtree as it
+     * is folded, leaves are adjacent, and with bind_key hashed with their keys.
+     */
+    [[nodiscard]] static bool verify_range_proof(uint64_t first, uint64_t last,
+                                                 const range_proof_t &proof,
+                                                 const HashType &root_hash) {
+        const std::vector<uint64_t> &keys = proof.keys_;
+        const std::vector<bool> &proven = proof.subtree_.proven_;
+        if (first > last || keys.size() != proof.leaves_.size()) {
+            return false;
+        }
+        if (keys.empty()) {
+            return root_hash == HashType() && proof.subtree_.shape_.empty();
+        }
+        // only the first key may be below the range and only the last one above it
+        for (size_t idx = 0; idx < keys.size(); ++idx) {
+            if ((idx > 0 && keys[idx - 1] >= keys[idx]) || (idx > 0 && keys[idx] < first) ||
+                (idx + 1 < keys.size() && keys[idx] > last)) {
+                return false;
+            }
+        }
+        auto run_first = std::find(proven.begin(), proven.end(), true);
+        auto run_last = std::find(run_first, proven.end(), false);
+        if (std::find(run_last, proven.end(), true) != proven.end() ||
+            (keys.front() >= first && run_first != proven.begin()) ||
+            (keys.back() <= last && run_last != proven.end())) {
+            return false;
+        }
+
+        multiproof_cursor_t at;
+        folded_t root;
+        auto leaf_hash = [&proof](size_t idx) {
+            return bound_hash(proof.keys_[idx], proof.leaves_[idx]);
+        };
+        const multiproof_t &subtree = proof.subtree_;
+        return fold_multiproof(subtree, leaf_hash, keys.data(), keys.size(), at, 0, root) &&
+               at.shape_ == subtree.shape_.size() && at.proven_ == proven.size() &&
+               at.hashes_ == subtree.hashes_.size() && at.values_ == keys.size() &&
+               root.hash_ == root_hash;
+    }
+
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        flush();
+        return reader().compact_proof(key);
+    }
+
+    /* Checks that key with value is a leaf under root_hash, folding proof bottom-up */
+    [[nodiscard]] static bool verify_compact_proof(uint64_t key, const ValueType &value,
+                                                   const compact_proof_t &proof,
+                                                   const HashType &root_hash) {
+        return fold_compact_proof(bound_hash(key, HashPolicy::leaf_hash(value)), proof,
+                                  root_hash);
+    }
+
+    /*
+     * Proof of absence from one descent: it stops at the subtree key would
+     * split off, and the highest bit where key differs from it tells the side.
+     * One neighbour is the extreme leaf of that subtree, the other one is the
+     * opposite extreme under the deepest turn of the path the other way.
+     * Empty if key is in the tree.
+     */
+    [[nodiscard]] std::optional<non_membership_proof_t> non_membership_proof(uint64_t key) const {
+        flush();
+        return reader().non_membership_proof(key);
+    }
+
+    /*
+     * Checks that key is absent under root_hash: neighbours bracket key (their
+     * keys are hashed in with bind_key), they are adjacent leaves, and their paths
+     * fit their keys. Two neighbours part at the highest bit where their keys
+     * differ, so paths share turns above it only.
+     */
+    [[nodiscard]] static bool verify_non_membership(uint64_t key,
+                                                    const non_membership_proof_t &proof,
+                                                    const HashType &root_hash) {
+        const auto &lower = proof.lower_;
+        const auto &upper = proof.upper_;
+        if (!lower && !upper) {
+            return root_hash == HashType();
+        }
+        auto on_path = [&root_hash](const neighbour_t &neighbour) {
+            return fold_compact_proof(bound_hash(neighbour.key_, neighbour.hash_),
+                                      neighbour.proof_, root_hash);
+        };
+        if (lower && (lower->key_ >= key || !on_path(*lower))) {
+            return false;
+        }
+        if (upper && (upper->key_ <= key || !on_path(*upper))) {
             return false;
         }
+        if (lower && upper) {
+            size_t common;
+            if (!adjacent(lower->proof_, upper->proof_, common)) {
+                return false;
+            }
+            auto split = int(distance(lower->key_, upper->key_));
+            return fit_path(lower->proof_, lower->key_, 0, common, 64) > split &&
+                   fit_path(lower->proof_, lower->key_, common + 1,
+                            lower->proof_.siblings_.size(), split) >= 0 &&
+                   fit_path(upper->proof_, upper->key_, common + 1,
+                            upper->proof_.siblings_.size(), split) >= 0;
+        }
+        // single neighbour must be the max or the min leaf
+        const neighbour_t &edge = (lower ? *lower : *upper);
+        size_t depth = edge.proof_.siblings_.size();
+        for (size_t level = 0; level < depth; ++level) {
+            if (goes_right(edge.proof_, level) != bool(lower)) {
+                return false;
+            }
+        }
+        return fit_path(edge.proof_, edge.key_, 0, depth, 64) >= 0;
+    }
+
+    void erase(uint64_t key) {
+        path_t path;
+        size_t depth = 0;
+        ptr_t stop = reader().find(key, path, depth);
+        if (!stop) {
+            return;
+        }
+
+        --size_;
+        if (depth == 0) {
+            destroy_node(stop);
+            root_ = nullptr;
+            return;
+        }
+        // parent is replaced by the other child, chosen before stop is freed
+        ptr_t parent = path[--depth];
+        ptr_t sibling = (parent->left_ == stop ? parent->right_ : parent->left_);
+        destroy_node(stop);
+        *link_at(path, depth, key) = sibling;
+        destroy_node(parent);
+        while (depth > 0) {
+            update(path[--depth]);
+        }
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        return reader().contains(key);
+    }
+
+    [[nodiscard]] const_iterator begin() const {
+        return reader().begin();
+    }
+
+    [[nodiscard]] const_iterator end() const {
+        return reader().end();
+    }
+
+    [[nodiscard]] const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    [[nodiscard]] const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    /* First leaf with key not less than given one */
+    [[nodiscard]] const_iterator lower_bound(uint64_t key) const {
+        return reader().lower_bound(key);
+    }
+
+    /* First leaf with key greater than given one */
+    [[nodiscard]] const_iterator successor(uint64_t key) const {
+        return reader().successor(key);
+    }
+
+    /* Last leaf with key less than given one */
+    [[nodiscard]] const_iterator predecessor(uint64_t key) const {
+        return reader().predecessor(key);
+    }
+
+    /* Calls fn(blob) for each leaf with key in [first, last], in key order */
+    template <typename Fn>
+    void for_each_in_range(uint64_t first, uint64_t last, Fn fn) const {
+        reader().for_each_in_range(first, last, std::move(fn));
     }
 
     [[nodiscard]] size_t size() const {
         return size_;
     }
 
-    ~Csmt() = default;
+    [[nodiscard]] HashType root_hash() const {
+        flush();
+        return reader().root_hash();
+    }
+
+    /* Immutable copy in cache-oblivious layout for read-mostly serving */
+    [[nodiscard]] CsmtView<HashPolicy, HashType, ValueType> freeze() const {
+        flush();
+        return CsmtView<HashPolicy, HashType, ValueType>(nodes_t(), root_, size_);
+    }
+
+    /*
+     * In lazy mode mutations only mark changed interior nodes stale. Their
+     * hashes are recomputed once by commit(), root_hash() or membership_proof(),
+     * so intermediate states of a burst of updates are never hashed.
+     * Const readers then write hashes too: share a lazy tree between threads
+     * only after commit(). Leaving lazy mode commits.
+     */
+    void set_lazy(bool lazy) {
+        if (!lazy) {
+            commit();
+        }
+        lazy_ = lazy;
+    }
+
+    [[nodiscard]] bool is_lazy() const {
+        return lazy_;
+    }
+
+    void commit() {
+        flush();
+    }
+
+    /*
+     * Hashes of batches, bulk builds and commits are computed by this many
+     * threads: independent stale subtrees go to a pool, top levels are
+     * merged by the calling thread. Single thread by default.
+     */
+    void set_threads(size_t threads) {
+        pool_ = (threads > 1 ? std::make_shared<ThreadPool>(threads) : nullptr);
+    }
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    [[nodiscard]] size_t get_threads() const {
+        return (pool_ ? pool_->size() : 1);
+    }
+
+    ~Csmt() {
+        destroy_subtree(root_);
+    }
 };
 
 #endif // CSMT_CSMT_H
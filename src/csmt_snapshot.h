@@ -0,0 +1,596 @@
+#ifndef CSMT_CSMT_SNAPSHOT_H
+#define CSMT_CSMT_SNAPSHOT_H
+
+#include "csmt.h"
+#include "csmt_view.h"
+#include "persistent_csmt.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CSMT_POSIX_FILES
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* File helpers shared by snapshots and the write-ahead log */
+namespace file_utils {
+    /* Flushes file to disk, data only where the system allows */
+    inline void sync_file(std::FILE *file) {
+        if (std::fflush(file) != 0) {
+            throw std::runtime_error("failed to flush file");
+        }
+#ifdef CSMT_POSIX_FILES
+#ifdef __linux__
+        int result = fdatasync(fileno(file));
+#else
+        int result = fsync(fileno(file));
+#endif
+        if (result != 0) {
+            throw std::runtime_error("failed to sync file");
+        }
+#endif
+    }
+
+    /* Makes creation, rename and removal of files in dir durable */
+    inline void sync_directory(const std::string &dir) {
+#ifdef CSMT_POSIX_FILES
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open " + dir);
+        }
+        int result = fsync(fd);
+        ::close(fd);
+        if (result != 0) {
+            throw std::runtime_error("failed to sync " + dir);
+        }
+#else
+        (void)dir;
+#endif
+    }
+
+    constexpr uint64_t CHECKSUM_SEED = 0xcbf29ce484222325ULL;
+
+    /*
+     * Word-wise FNV-1a with extra shift, continues from seed. Splitting data
+     * at multiples of 8 bytes gives the same result. Catches torn and damaged
+     * writes, it is not a cryptographic hash.
+     */
+    inline uint64_t checksum_bytes(const char *data, size_t size, uint64_t seed = CHECKSUM_SEED) {
+        uint64_t hash = seed;
+        size_t pos = 0;
+        for (; pos + 8 <= size; pos += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + pos, 8);
+            hash = (hash ^ word) * 0x100000001b3ULL;
+            hash ^= hash >> 29u;
+        }
+        for (; pos < size; ++pos) {
+            hash = (hash ^ uint8_t(data[pos])) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+} // namespace file_utils
+
+/*
+ * Binary form of hashes and values in files: trivially copyable types are
+ * stored as is, strings by their bytes. Snapshot needs all hashes of the
+ * same size, log records store size of each value.
+ */
+template <typename T, typename = void>
+struct snapshot_bytes;
+
+template <>
+struct snapshot_bytes<std::string> {
+    static size_t size(const std::string &hash) {
+        return hash.size();
+    }
+
+    static const char *data(const std::string &hash) {
+        return hash.data();
+    }
+
+    static std::string load(const char *data, size_t size) {
+        return std::string(data, size);
+    }
+};
+
+template <typename T>
+struct snapshot_bytes<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+    static size_t size(const T &) {
+        return sizeof(T);
+    }
+
+    static const char *data(const T &value) {
+        return reinterpret_cast<const char *>(&value);
+    }
+
+    static T load(const char *data, size_t) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+};
+
+/*
+ * Read-only CSMT mapped from a snapshot file.
+ *
+ * File is a frozen tree (see CsmtView) as is, in native byte order:
+ *  header  -- 64 bytes, see header_t
+ *  nodes   -- node_count records of 24 bytes, van Emde Boas order, root first
+ *  hashes  -- node_count hashes of hash_size bytes, same order, as parents
+ *             see them: leaves by bound hash if the policy binds keys
+ * Body checksum (file_utils::checksum_bytes) covers everything after the
+ * header, header has a checksum of its own. lsn is stored for the caller,
+ * e.g. the position of a log the snapshot was taken at.
+ *
+ * write() lays the tree out straight into the mapped output file, no copy of
+ * the tree is made. open() maps the file and checks the header and section
+ * bounds only, so startup does not depend on the tree size; verify() checks
+ * the body checksum. Queries read the mapped pages through Csmt::Reader.
+ * Child indices and splits are checked on the way down, so a damaged file
+ * throws instead of reading out of the mapping.
+ *
+ * Usage:
+ *  CsmtSnapshot<Policy>::write(tree, "tree.snap", lsn);
+ *  auto snapshot = CsmtSnapshot<Policy>::open("tree.snap");
+ *  snapshot.membership_proof(key);
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class CsmtSnapshot {
+public:
+    using index_t = uint32_t;
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType>;
+    using view_type = CsmtView<HashPolicy, HashType, ValueType>;
+    using persistent_type = PersistentCsmt<HashPolicy, HashType, ValueType>;
+    using proof_t = typename csmt_type::proof_t;
+    using compact_proof_t = typename csmt_type::compact_proof_t;
+
+    static constexpr uint64_t MAGIC = 0x31504e53544d5343; // "CSMTSNP1" in little endian
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    struct header_t {
+        uint64_t magic_;
+        uint32_t format_version_;
+        uint32_t hash_size_;
+        uint64_t node_count_;
+        uint64_t key_count_;
+        uint64_t lsn_;
+        uint64_t checksum_;
+        uint64_t header_checksum_; // of the fields above
+        uint64_t reserved_;
+    };
+
+    struct record_t {
+        uint64_t key_;
+        index_t left_;
+        index_t right_;
+        uint8_t split_;
+        uint8_t padding_[7];
+    };
+
+    static_assert(sizeof(header_t) == 64 && sizeof(record_t) == 24, "unexpected padding");
+
+private:
+    using hash_io = snapshot_bytes<HashType>;
+
+    static constexpr index_t NIL = view_type::NIL;
+
+    // Reader access to mapped records, checked as damage may point anywhere
+    struct nodes_t {
+        using handle_t = index_t;
+
+        static constexpr index_t NIL = CsmtSnapshot::NIL;
+
+        const CsmtSnapshot *snapshot_ = nullptr;
+
+        [[nodiscard]] const record_t &link(index_t idx) const {
+            return snapshot_->record(idx);
+        }
+
+        [[nodiscard]] HashType hash(index_t idx) const {
+            return snapshot_->hash_at(idx);
+        }
+
+        [[nodiscard]] typename csmt_type::Blob blob(index_t idx) const {
+            return {snapshot_->record(idx).key_, snapshot_->hash_at(idx)};
+        }
+    };
+
+    using reader_t = typename csmt_type::template Reader<nodes_t>;
+
+    struct unmapper_t {
+        size_t size_;
+
+        void operator()(const char *data) const {
+#ifdef CSMT_POSIX_FILES
+            munmap(const_cast<char *>(data), size_);
+#else
+            delete[] data;
+#endif
+        }
+    };
+
+    /*
+     * File being written, mapped where the system allows and written from
+     * memory on commit otherwise. Records are patched in place once their
+     * children get indices.
+     */
+    class output_t {
+        std::string path_;
+        size_t size_;
+#ifdef CSMT_POSIX_FILES
+        int fd_ = -1;
+        char *data_ = nullptr;
+#else
+        std::unique_ptr<char[]> data_;
+#endif
+
+    public:
+        output_t(std::string path, size_t size)
+            : path_(std::move(path))
+            , size_(size) {
+#ifdef CSMT_POSIX_FILES
+            fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0) {
+                throw std::runtime_error("failed to create " + path_);
+            }
+#ifdef __linux__
+            // no space left while writing a mapping is a signal, so blocks are taken up front
+            int result = posix_fallocate(fd_, 0, off_t(size_));
+#else
+            int result = ftruncate(fd_, off_t(size_));
+#endif
+            void *data = MAP_FAILED;
+            if (result == 0) {
+                data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            }
+            if (data == MAP_FAILED) {
+                ::close(fd_);
+                throw std::runtime_error("failed to allocate " + path_);
+            }
+            data_ = static_cast<char *>(data);
+#else
+            data_.reset(new char[size_]());
+#endif
+        }
+
+        output_t(const output_t &) = delete;
+        output_t &operator=(const output_t &) = delete;
+
+        ~output_t() {
+#ifdef CSMT_POSIX_FILES
+            if (data_) {
+                munmap(data_, size_);
+            }
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+#endif
+        }
+
+        [[nodiscard]] char *data() {
+#ifdef CSMT_POSIX_FILES
+            return data_;
+#else
+            return data_.get();
+#endif
+        }
+
+        /* Flushes file to disk and closes it */
+        void commit() {
+#ifdef CSMT_POSIX_FILES
+            bool synced = msync(data_, size_, MS_SYNC) == 0;
+            munmap(data_, size_);
+            data_ = nullptr;
+#ifdef __linux__
+            synced = fdatasync(fd_) == 0 && synced;
+#else
+            synced = fsync(fd_) == 0 && synced;
+#endif
+            synced = ::close(fd_) == 0 && synced;
+            fd_ = -1;
+            if (!synced) {
+                throw std::runtime_error("failed to sync " + path_);
+            }
+#else
+            std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(path_.c_str(), "wb"),
+                                                                  &std::fclose);
+            if (!file || std::fwrite(data_.get(), 1, size_, file.get()) != size_) {
+                throw std::runtime_error("failed to write " + path_);
+            }
+            file_utils::sync_file(file.get());
+#endif
+        }
+    };
+
+    std::unique_ptr<const char, unmapper_t> data_{nullptr, unmapper_t{0}};
+    header_t header_{};
+    const record_t *nodes_ = nullptr;
+    const char *hashes_ = nullptr;
+
+    [[nodiscard]] size_t body_size() const {
+        return header_.node_count_ * (sizeof(record_t) + header_.hash_size_);
+    }
+
+    [[nodiscard]] const record_t &record(index_t idx) const {
+        if (idx >= header_.node_count_ || nodes_[idx].split_ >= 64) {
+            throw std::runtime_error("snapshot is damaged: bad child index or split");
+        }
+        return nodes_[idx];
+    }
+
+    [[nodiscard]] HashType hash_at(index_t idx) const {
+        if (idx >= header_.node_count_) {
+            throw std::runtime_error("snapshot is damaged: bad child index or split");
+        }
+        return hash_io::load(hashes_ + size_t(idx) * header_.hash_size_, header_.hash_size_);
+    }
+
+    [[nodiscard]] reader_t reader() const {
+        return reader_t(nodes_t{this}, header_.node_count_ ? 0 : NIL);
+    }
+
+    static uint64_t header_checksum(const header_t &header) {
+        return file_utils::checksum_bytes(reinterpret_cast<const char *>(&header),
+                                          offsetof(header_t, header_checksum_));
+    }
+
+    /*
+     * Writes tree read through accessor nodes (see Csmt::Reader) to path
+     * atomically: nodes are laid out straight into mapped path.tmp, which is
+     * flushed to disk and renamed over path, then the rename is synced.
+     */
+    template <typename Nodes>
+    static void write_tree(const Nodes &nodes, typename Nodes::handle_t root, size_t size,
+                           const std::string &path, uint64_t lsn) {
+        header_t header{};
+        header.magic_ = MAGIC;
+        header.format_version_ = FORMAT_VERSION;
+        header.node_count_ = (size ? 2 * size - 1 : 0);
+        header.key_count_ = size;
+        header.lsn_ = lsn;
+        header.hash_size_ = uint32_t(root == Nodes::NIL ? 0 : hash_io::size(nodes.hash(root)));
+        if (header.node_count_ >= NIL) {
+            throw std::invalid_argument("too many keys for a snapshot");
+        }
+
+        size_t body_size = header.node_count_ * (sizeof(record_t) + header.hash_size_);
+        std::string tmp_path = path + ".tmp";
+        output_t output(tmp_path, sizeof(header_t) + body_size);
+        char *body = output.data() + sizeof(header_t);
+        auto *records = reinterpret_cast<record_t *>(body);
+        char *hashes = body + header.node_count_ * sizeof(record_t);
+
+        index_t placed = 0;
+        auto place = [&](auto node, const auto &link, index_t idx, index_t parent, bool right) {
+            if (idx >= header.node_count_) {
+                throw std::logic_error("tree has more nodes than its size implies");
+            }
+            records[idx] = {link.key_, NIL, NIL, link.split_, {}};
+            if (parent != NIL) {
+                (right ? records[parent].right_ : records[parent].left_) = idx;
+            }
+            decltype(auto) hash = nodes.hash(node);
+            if (hash_io::size(hash) != header.hash_size_) {
+                throw std::invalid_argument("snapshot needs hashes of the same size");
+            }
+            std::memcpy(hashes + size_t(idx) * header.hash_size_, hash_io::data(hash),
+                        header.hash_size_);
+            ++placed;
+        };
+        if (root != Nodes::NIL) {
+            view_type::lay_out(nodes, root, place);
+        }
+        if (placed != header.node_count_) {
+            throw std::logic_error("tree has fewer nodes than its size implies");
+        }
+
+        header.checksum_ = file_utils::checksum_bytes(body, body_size);
+        header.header_checksum_ = header_checksum(header);
+        std::memcpy(output.data(), &header, sizeof(header_t));
+        output.commit();
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("failed to rename " + tmp_path);
+        }
+        std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        file_utils::sync_directory(parent.empty() ? "." : parent.string());
+    }
+
+public:
+    CsmtSnapshot() = default;
+
+    /* Writes frozen view */
+    static void write(const view_type &view, const std::string &path, uint64_t lsn = 0) {
+        write_tree(typename view_type::nodes_t{&view}, view.reader().root(), view.size(), path,
+                   lsn);
+    }
+
+    /* Writes version of a persistent tree, which may change meanwhile */
+    static void write(const typename persistent_type::Snapshot &version, const std::string &path,
+                      uint64_t lsn = 0) {
+        write_tree(typename persistent_type::nodes_t(), version.root_.get(), version.size(), path,
+                   lsn);
+    }
+
+    /* Writes tree straight from its nodes, tree must not change meanwhile */
+    template <typename Alloc>
+    static void write(const Csmt<HashPolicy, HashType, ValueType, Alloc> &tree,
+                      const std::string &path, uint64_t lsn = 0) {
+        using tree_type = Csmt<HashPolicy, HashType, ValueType, Alloc>;
+        tree.flush();
+        write_tree(typename tree_type::nodes_t(), tree.reader().root(), tree.size(), path, lsn);
+    }
+
+    /* Maps snapshot file, checks header and section bounds, checksum if asked to */
+    static CsmtSnapshot open(const std::string &path, bool verify_checksum = false) {
+        CsmtSnapshot snapshot;
+        size_t file_size = 0;
+#ifdef CSMT_POSIX_FILES
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open " + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("failed to stat " + path);
+        }
+        file_size = size_t(info.st_size);
+        if (file_size >= sizeof(header_t)) {
+            void *data = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED) {
+                throw std::runtime_error("failed to map " + path);
+            }
+            snapshot.data_ = {static_cast<const char *>(data), unmapper_t{file_size}};
+        } else {
+            ::close(fd);
+        }
+#else
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(path.c_str(), "rb"),
+                                                              &std::fclose);
+        if (!file) {
+            throw std::runtime_error("failed to open " + path);
+        }
+        std::fseek(file.get(), 0, SEEK_END);
+        file_size = size_t(std::ftell(file.get()));
+        std::fseek(file.get(), 0, SEEK_SET);
+        std::unique_ptr<char[]> buffer(new char[file_size]);
+        if (std::fread(buffer.get(), 1, file_size, file.get()) != file_size) {
+            throw std::runtime_error("failed to read " + path);
+        }
+        snapshot.data_ = {buffer.release(), unmapper_t{file_size}};
+#endif
+        if (file_size < sizeof(header_t)) {
+            throw std::runtime_error("not a snapshot: " + path);
+        }
+
+        header_t &header = snapshot.header_;
+        std::memcpy(&header, snapshot.data_.get(), sizeof(header_t));
+        if (header.magic_ != MAGIC) {
+            throw std::runtime_error("not a snapshot or other byte order: " + path);
+        }
+        if (header.format_version_ != FORMAT_VERSION) {
+            throw std::runtime_error("unsupported snapshot version: " + path);
+        }
+        if (header.header_checksum_ != header_checksum(header)) {
+            throw std::runtime_error("snapshot header is damaged: " + path);
+        }
+        if constexpr (std::is_trivially_copyable_v<HashType>) {
+            if (header.node_count_ && header.hash_size_ != sizeof(HashType)) {
+                throw std::runtime_error("snapshot hash size mismatch: " + path);
+            }
+        }
+        // sections must fill the file exactly, compared by division so no size overflows
+        uint64_t nodes = header.node_count_;
+        size_t body = file_size - sizeof(header_t);
+        bool counts_match = (nodes == 0 ? header.key_count_ == 0
+                                        : nodes % 2 == 1 && header.key_count_ == nodes / 2 + 1);
+        bool sections_fit = (nodes == 0 ? body == 0
+                                        : body % nodes == 0 &&
+                                              body / nodes == sizeof(record_t) + header.hash_size_);
+        if (!counts_match || nodes >= NIL || !sections_fit) {
+            throw std::runtime_error("snapshot is truncated or damaged: " + path);
+        }
+        snapshot.nodes_ = reinterpret_cast<const record_t *>(snapshot.data_.get() + sizeof(header_t));
+        snapshot.hashes_ = reinterpret_cast<const char *>(snapshot.nodes_ + nodes);
+        if (verify_checksum && !snapshot.verify()) {
+            throw std::runtime_error("snapshot checksum mismatch: " + path);
+        }
+        return snapshot;
+    }
+
+    /* Recomputes checksum of the body */
+    [[nodiscard]] bool verify() const {
+        return file_utils::checksum_bytes(reinterpret_cast<const char *>(nodes_), body_size()) ==
+               header_.checksum_;
+    }
+
+    /* Calls fn(key, hash) for every key with its stored hash, in no particular order */
+    template <typename Fn>
+    void for_each_leaf(Fn fn) const {
+        for (size_t idx = 0; idx < header_.node_count_; ++idx) {
+            if (nodes_[idx].left_ == NIL) {
+                fn(nodes_[idx].key_, hash_at(index_t(idx)));
+            }
+        }
+    }
+
+    /*
+     * Persistent tree with the nodes of the file and their stored hashes,
+     * nothing is rehashed.
+     */
+    [[nodiscard]] persistent_type restore() const {
+        using node_t = typename persistent_type::Node;
+        using node_ptr = typename persistent_type::node_ptr;
+
+        size_t copied = 0;
+        size_t leaves = 0;
+        auto copy = [&](auto &self, index_t idx, size_t depth) -> node_ptr {
+            const record_t &record = this->record(idx);
+            if (++copied > header_.node_count_ || depth > 64) {
+                throw std::runtime_error("snapshot is damaged: nodes form no tree");
+            }
+            if (record.left_ == NIL) {
+                ++leaves;
+                return std::make_shared<const node_t>(node_t{record.key_, hash_at(idx), {}, {}});
+            }
+            node_ptr lhs = self(self, record.left_, depth + 1);
+            node_ptr rhs = self(self, record.right_, depth + 1);
+            return std::make_shared<const node_t>(
+                node_t{record.key_, hash_at(idx), std::move(lhs), std::move(rhs), record.split_});
+        };
+
+        persistent_type tree;
+        if (header_.node_count_) {
+            node_ptr root = copy(copy, 0, 0);
+            if (leaves != header_.key_count_) {
+                throw std::runtime_error("snapshot is damaged: nodes form no tree");
+            }
+            tree.publish(std::move(root), leaves);
+        }
+        return tree;
+    }
+
+    [[nodiscard]] uint64_t lsn() const {
+        return header_.lsn_;
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        return reader().contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return header_.key_count_;
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        return reader().root_hash();
+    }
+
+    /* Same format as Csmt::membership_proof */
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        return reader().membership_proof(key);
+    }
+
+    /* Same format as Csmt::compact_proof */
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        return reader().compact_proof(key);
+    }
+};
+
+#endif // CSMT_CSMT_SNAPSHOT_H
@@ -0,0 +1,243 @@
+#ifndef CSMT_CSMT_VIEW_H
+#define CSMT_CSMT_VIEW_H
+
+#include "csmt.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Immutable snapshot of a Csmt in one flat buffer, made by Csmt::freeze().
+ *
+ * Nodes are laid out in van Emde Boas order: top half of the levels goes
+ * first, then every subtree hanging below it, each laid out the same way.
+ * A descent then touches O(log_B n) cache blocks for any block size B.
+ * Walk data (key, split, children) is kept apart from hashes, which are
+ * read only for proofs. Hashes are the ones parents see; if the policy has
+ * bind_key, leaf hashes of leaves are kept apart too, for neighbour proofs.
+ *
+ * Answers and proofs are the same as of the tree at freeze time. View does
+ * not depend on the tree afterwards and may be read from many threads.
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class CsmtView {
+public:
+    using index_t = uint32_t;
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType>;
+    using proof_t = typename csmt_type::proof_t;
+    using compact_proof_t = typename csmt_type::compact_proof_t;
+    using non_membership_proof_t = typename csmt_type::non_membership_proof_t;
+    using multiproof_t = typename csmt_type::multiproof_t;
+    using range_proof_t = typename csmt_type::range_proof_t;
+
+    static constexpr index_t NIL = std::numeric_limits<index_t>::max();
+
+private:
+    struct Node {
+        uint64_t key_;
+        index_t left_;
+        index_t right_;
+        uint8_t split_;
+        index_t leaf_; // into leaf_hashes_ if kept
+    };
+
+    template <typename, typename, typename, typename>
+    friend class Csmt;
+    template <typename, typename, typename>
+    friend class CsmtSnapshot;
+
+    // Reader access to own nodes, root is at index 0
+    struct nodes_t {
+        using handle_t = index_t;
+
+        static constexpr index_t NIL = CsmtView::NIL;
+
+        const CsmtView *view_ = nullptr;
+
+        [[nodiscard]] const Node &link(index_t idx) const {
+            return view_->nodes_[idx];
+        }
+
+        [[nodiscard]] const HashType &hash(index_t idx) const {
+            return view_->values_[idx];
+        }
+
+        [[nodiscard]] typename csmt_type::Blob blob(index_t idx) const {
+            const Node &node = view_->nodes_[idx];
+            if constexpr (csmt_type::BINDS_KEYS) {
+                return {node.key_, view_->leaf_hashes_[node.leaf_]};
+            } else {
+                return {node.key_, view_->values_[idx]};
+            }
+        }
+    };
+
+    using reader_t = typename csmt_type::template Reader<nodes_t>;
+
+    std::vector<Node> nodes_;
+    std::vector<HashType> values_;
+    std::vector<HashType> leaf_hashes_; // in layout order, only if the policy has bind_key
+    size_t size_ = 0;
+
+    // node of source tree waiting for its place, parent gets the index once known
+    template <typename Handle>
+    struct pending_t {
+        Handle node_;
+        index_t parent_;
+        bool right_;
+    };
+
+    /*
+     * Van Emde Boas order of a tree read through a Reader accessor (see
+     * Csmt::Reader). Nodes are numbered in output order from 0, each goes to
+     * place(node, link, idx, parent, right) with the index of its parent, NIL for
+     * the root, so the caller links children as the parent is known first.
+     */
+    template <typename Nodes, typename Place>
+    class Layout {
+        using handle_t = typename Nodes::handle_t;
+        using item_t = pending_t<handle_t>;
+
+        const Nodes &nodes_;
+        Place &place_;
+        index_t next_ = 0;
+
+        void emit(const item_t &item, std::vector<item_t> &below) {
+            if (next_ == NIL) {
+                throw std::length_error("too many nodes for 32-bit indices");
+            }
+            index_t idx = next_++;
+            auto link = nodes_.link(item.node_);
+            place_(item.node_, link, idx, item.parent_, item.right_);
+            if (link.left_ != Nodes::NIL) {
+                below.push_back({link.left_, idx, false});
+                below.push_back({link.right_, idx, true});
+            }
+        }
+
+        /*
+         * Lays out given number of levels from item, children cut off below go
+         * to frontier in order. Upper half first, then subtrees below it.
+         */
+        void layout(const item_t &item, size_t levels, std::vector<item_t> &frontier) {
+            if (levels == 1 || nodes_.link(item.node_).left_ == Nodes::NIL) {
+                emit(item, frontier);
+                return;
+            }
+            size_t top = levels / 2;
+            std::vector<item_t> middle;
+            layout(item, top, middle);
+            for (const item_t &sub : middle) {
+                layout(sub, levels - top, frontier);
+            }
+        }
+
+        size_t height(handle_t node) const {
+            auto link = nodes_.link(node);
+            if (link.left_ == Nodes::NIL) {
+                return 1;
+            }
+            return 1 + std::max(height(link.left_), height(link.right_));
+        }
+
+    public:
+        Layout(const Nodes &nodes, Place &place)
+            : nodes_(nodes)
+            , place_(place) {
+        }
+
+        void run(handle_t root) {
+            std::vector<item_t> frontier;
+            layout({root, NIL, false}, height(root), frontier);
+        }
+    };
+
+    template <typename Nodes, typename Place>
+    static void lay_out(const Nodes &nodes, typename Nodes::handle_t root, Place place) {
+        Layout<Nodes, Place>(nodes, place).run(root);
+    }
+
+    // copies tree read through accessor nodes, see Csmt::Reader
+    template <typename Nodes>
+    CsmtView(const Nodes &nodes, typename Nodes::handle_t root, size_t size)
+        : size_(size) {
+        if (root == Nodes::NIL) {
+            return;
+        }
+        if (2 * size - 1 >= NIL) {
+            throw std::length_error("too many keys for a view");
+        }
+        nodes_.reserve(2 * size - 1);
+        values_.reserve(2 * size - 1);
+        if constexpr (csmt_type::BINDS_KEYS) {
+            leaf_hashes_.reserve(size);
+        }
+        auto place = [&](auto node, const auto &link, index_t idx, index_t parent, bool right) {
+            nodes_.push_back({link.key_, NIL, NIL, link.split_, NIL});
+            values_.push_back(nodes.hash(node));
+            if constexpr (csmt_type::BINDS_KEYS) {
+                if (link.left_ == Nodes::NIL) {
+                    nodes_.back().leaf_ = index_t(leaf_hashes_.size());
+                    leaf_hashes_.push_back(nodes.blob(node).value_);
+                }
+            }
+            if (parent != NIL) {
+                (right ? nodes_[parent].right_ : nodes_[parent].left_) = idx;
+            }
+        };
+        lay_out(nodes, root, place);
+    }
+
+    [[nodiscard]] reader_t reader() const {
+        return reader_t(nodes_t{this}, nodes_.empty() ? NIL : 0);
+    }
+
+public:
+    CsmtView() = default;
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        return reader().contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        return reader().root_hash();
+    }
+
+    /* Same format as Csmt::membership_proof */
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        return reader().membership_proof(key);
+    }
+
+    /* Same format as Csmt::compact_proof */
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        return reader().compact_proof(key);
+    }
+
+    /* Same format as Csmt::non_membership_proof */
+    [[nodiscard]] std::optional<non_membership_proof_t> non_membership_proof(uint64_t key) const {
+        return reader().non_membership_proof(key);
+    }
+
+    /* Same format as Csmt::membership_multiproof */
+    [[nodiscard]] std::optional<multiproof_t> membership_multiproof(
+        std::vector<uint64_t> keys) const {
+        return reader().membership_multiproof(std::move(keys));
+    }
+
+    /* Same format as Csmt::range_proof */
+    [[nodiscard]] std::optional<range_proof_t> range_proof(uint64_t first, uint64_t last) const {
+        return reader().range_proof(first, last);
+    }
+};
+
+#endif // CSMT_CSMT_VIEW_H
@@ -0,0 +1,330 @@
+#ifndef CSMT_DURABLE_CSMT_H
+#define CSMT_DURABLE_CSMT_H
+
+#include "csmt_snapshot.h"
+#include "persistent_csmt.h"
+#include "wal.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * Csmt persisted in a directory as the last checkpoint plus a write-ahead
+ * log of changes after it.
+ *
+ * Every write is applied to a copy of the tree and logged before the copy
+ * replaces it, so a write that throws changes neither. It returns once the
+ * log is synced; concurrent writers share syncs (see WriteAheadLog).
+ * With sync_writes_ off writes return at once and sync() makes them durable.
+ *
+ * The tree is a PersistentCsmt with only its current version retained.
+ * checkpoint() takes that version in O(1) and starts a new log segment
+ * under the lock, then writes it as CsmtSnapshot file and removes log
+ * segments it covers without blocking writers. With checkpoint_every_ set
+ * it runs on a background thread after that many records, its errors are
+ * rethrown by the next sync(). Opening restores the checkpoint with its
+ * stored hashes and replays only the log tail after it.
+ *
+ * Checkpoints need hashes of the same size (see CsmtSnapshot). Values are
+ * stored with snapshot_bytes, so ValueType is a string or trivially copyable.
+ *
+ * Usage:
+ *  DurableCsmt<Policy, Hash> tree("data/tree");
+ *  tree.insert(1, "a"); // durable when it returns
+ *  tree.checkpoint();   // log so far is not needed any more
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class DurableCsmt {
+public:
+    using tree_type = PersistentCsmt<HashPolicy, HashType, ValueType>;
+    using snapshot_type = CsmtSnapshot<HashPolicy, HashType, ValueType>;
+    using proof_t = typename tree_type::proof_t;
+    using compact_proof_t = typename tree_type::compact_proof_t;
+    using op_t = typename tree_type::op_t;
+
+    struct options_t {
+        bool sync_writes_ = true;     // write returns once it is on disk
+        size_t checkpoint_every_ = 0; // records between background checkpoints, 0 for none
+    };
+
+    static constexpr const char *CHECKPOINT_FILE = "checkpoint.snap";
+    // replayed records applied at once
+    static constexpr size_t REPLAY_BATCH = 4096;
+
+private:
+    using kind_t = WriteAheadLog::kind_t;
+    using value_io = snapshot_bytes<ValueType>;
+
+    const std::string dir_;
+    const options_t options_;
+    mutable std::mutex mutex_;
+    tree_type tree_;
+    std::vector<op_t> replayed_;
+    uint64_t checkpoint_lsn_;
+    WriteAheadLog log_;
+
+    std::mutex checkpoint_mutex_; // one checkpoint at a time
+    std::condition_variable checkpoint_cv_;
+    size_t since_checkpoint_ = 0;
+    bool checkpoint_due_ = false;
+    bool stop_ = false;
+    std::exception_ptr checkpoint_error_;
+    std::thread checkpointer_;
+
+    [[nodiscard]] std::string checkpoint_path() const {
+        return (std::filesystem::path(dir_) / CHECKPOINT_FILE).string();
+    }
+
+    uint64_t load_checkpoint() {
+        std::filesystem::create_directories(dir_);
+        if (!std::filesystem::exists(checkpoint_path())) {
+            return 0;
+        }
+        snapshot_type snapshot = snapshot_type::open(checkpoint_path(), true);
+        tree_ = snapshot.restore();
+        return snapshot.lsn();
+    }
+
+    void replay(const WriteAheadLog::record_t &record) {
+        if (record.kind_ == kind_t::ERASE) {
+            replayed_.push_back(op_t::erase(record.key_));
+        } else {
+            replayed_.push_back(
+                op_t::insert(record.key_, value_io::load(record.value_.data(), record.value_.size())));
+        }
+        if (replayed_.size() >= REPLAY_BATCH) {
+            apply(replayed_);
+            replayed_.clear();
+        }
+    }
+
+    // older versions are not kept, the last checkpoint holds its own one
+    template <typename Range>
+    void apply(const Range &ops) {
+        tree_.apply_batch(ops);
+        tree_.prune(tree_.version());
+    }
+
+    static WriteAheadLog::entry_t entry(const op_t &op) {
+        if (op.kind_ == op_t::kind_t::ERASE) {
+            return {kind_t::ERASE, op.key_};
+        }
+        return {kind_t::INSERT, op.key_, value_io::data(op.value_), value_io::size(op.value_)};
+    }
+
+    // replaces tree with its changed and logged copy, mutex must be held
+    void publish(tree_type &&next, size_t records) {
+        tree_ = std::move(next);
+        tree_.prune(tree_.version());
+        written(records);
+    }
+
+    // mutex must be held
+    void written(size_t records) {
+        since_checkpoint_ += records;
+        if (options_.checkpoint_every_ && since_checkpoint_ >= options_.checkpoint_every_ &&
+            !checkpoint_due_) {
+            checkpoint_due_ = true;
+            checkpoint_cv_.notify_one();
+        }
+    }
+
+    void finish(uint64_t lsn) {
+        if (options_.sync_writes_) {
+            log_.sync(lsn);
+        }
+    }
+
+    void checkpoint_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            checkpoint_cv_.wait(lock, [this] { return stop_ || checkpoint_due_; });
+            if (stop_) {
+                return;
+            }
+            checkpoint_due_ = false;
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                checkpoint();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (error) {
+                checkpoint_error_ = error;
+            }
+        }
+    }
+
+public:
+    /* Opens tree stored in dir, creates dir if needed */
+    explicit DurableCsmt(std::string dir, options_t options = options_t())
+        : dir_(std::move(dir))
+        , options_(options)
+        , checkpoint_lsn_(load_checkpoint())
+        , log_(dir_, checkpoint_lsn_, [this](const WriteAheadLog::record_t &record) {
+            replay(record);
+        }) {
+        apply(replayed_);
+        replayed_ = std::vector<op_t>();
+        if (options_.checkpoint_every_) {
+            checkpointer_ = std::thread([this] { checkpoint_loop(); });
+        }
+    }
+
+    DurableCsmt(const DurableCsmt &) = delete;
+    DurableCsmt &operator=(const DurableCsmt &) = delete;
+
+    /* Stops background checkpoints and syncs the log */
+    ~DurableCsmt() {
+        if (checkpointer_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            checkpoint_cv_.notify_one();
+            checkpointer_.join();
+        }
+        try {
+            log_.sync();
+        } catch (...) {
+            // unsynced writes are lost as in a crash
+        }
+    }
+
+    void insert(uint64_t key, const ValueType &value) {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tree_type next = tree_;
+            next.insert(key, value);
+            lsn = log_.append(kind_t::INSERT, key, value_io::data(value), value_io::size(value));
+            publish(std::move(next), 1);
+        }
+        finish(lsn);
+    }
+
+    void erase(uint64_t key) {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tree_type next = tree_;
+            next.erase(key);
+            lsn = log_.append(kind_t::ERASE, key);
+            publish(std::move(next), 1);
+        }
+        finish(lsn);
+    }
+
+    /*
+     * Applies ops with PersistentCsmt::apply_batch and logs them with one
+     * WriteAheadLog::append_batch, one sync for all. After a crash either
+     * all of them are recovered or none.
+     */
+    template <typename Range>
+    void apply_batch(const Range &ops) {
+        std::vector<WriteAheadLog::entry_t> entries;
+        for (const op_t &op : ops) {
+            entries.push_back(entry(op));
+        }
+        if (entries.empty()) {
+            return;
+        }
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tree_type next = tree_;
+            next.apply_batch(ops);
+            lsn = log_.append_batch(entries);
+            publish(std::move(next), entries.size());
+        }
+        finish(lsn);
+    }
+
+    /* Makes all writes so far durable */
+    void sync() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (checkpoint_error_) {
+                std::exception_ptr error = std::exchange(checkpoint_error_, nullptr);
+                std::rethrow_exception(error);
+            }
+        }
+        log_.sync();
+    }
+
+    /* Writes checkpoint of the current state and drops log it covers */
+    void checkpoint() {
+        std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex_);
+        typename tree_type::Snapshot version;
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            since_checkpoint_ = 0;
+            if (log_.last_lsn() == checkpoint_lsn_) {
+                return;
+            }
+            version = tree_.snapshot();
+            lsn = log_.rotate();
+        }
+        snapshot_type::write(version, checkpoint_path(), lsn);
+        log_.truncate(lsn);
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkpoint_lsn_ = lsn;
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.size();
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.root_hash();
+    }
+
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.membership_proof(key);
+    }
+
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.compact_proof(key);
+    }
+
+    /* Last logged write */
+    [[nodiscard]] uint64_t lsn() const {
+        return log_.last_lsn();
+    }
+
+    [[nodiscard]] uint64_t durable_lsn() const {
+        return log_.durable_lsn();
+    }
+
+    [[nodiscard]] uint64_t checkpoint_lsn() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return checkpoint_lsn_;
+    }
+
+    [[nodiscard]] const WriteAheadLog &log() const {
+        return log_;
+    }
+};
+
+#endif // CSMT_DURABLE_CSMT_H
@@ -0,0 +1,156 @@
+#ifndef CSMT_EPOCH_H
+#define CSMT_EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+
+/*
+ * Epoch-based reclamation for one writer and lock-free readers.
+ *
+ * Reader pins a slot with the current epoch before it loads shared pointers
+ * and unpins when it is done. Writer first unlinks objects (publishes a
+ * version without them), then retires them with the current epoch and
+ * advances it. Object retired in epoch E is freed once every pinned reader
+ * has a greater epoch: those readers pinned after the unlink and can not
+ * reach it.
+ *
+ * pin() is lock-free while there are free slots, retire() and reclaim()
+ * must be called by one thread at a time.
+ */
+class EpochManager {
+public:
+    static constexpr size_t DEFAULT_SLOTS = 128;
+    // retired objects to gather before writer tries to free them
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+private:
+    static constexpr uint64_t FREE = 0;
+
+    // one reader per cache line, pinned epoch or FREE
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch_{FREE};
+    };
+
+    struct Retired {
+        uint64_t epoch_;
+        void *ptr_;
+        void (*deleter_)(void *);
+    };
+
+    std::atomic<uint64_t> epoch_{1};
+    std::vector<Slot> slots_;
+    std::vector<Retired> retired_;
+
+    uint64_t min_pinned() const {
+        uint64_t result = std::numeric_limits<uint64_t>::max();
+        for (const Slot &slot : slots_) {
+            uint64_t pinned = slot.epoch_.load();
+            if (pinned != FREE) {
+                result = std::min(result, pinned);
+            }
+        }
+        return result;
+    }
+
+public:
+    /* Reader pin, unpins on destruction */
+    class Guard {
+        friend class EpochManager;
+
+        Slot *slot_ = nullptr;
+
+        explicit Guard(Slot *slot)
+            : slot_(slot) {
+        }
+
+    public:
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        Guard(Guard &&other) noexcept
+            : slot_(other.slot_) {
+            other.slot_ = nullptr;
+        }
+
+        ~Guard() {
+            if (slot_) {
+                slot_->epoch_.store(FREE, std::memory_order_release);
+            }
+        }
+    };
+
+    explicit EpochManager(size_t slots = DEFAULT_SLOTS)
+        : slots_(std::max<size_t>(slots, 1)) {
+    }
+
+    EpochManager(const EpochManager &) = delete;
+    EpochManager &operator=(const EpochManager &) = delete;
+
+    ~EpochManager() {
+        for (const Retired &item : retired_) {
+            item.deleter_(item.ptr_);
+        }
+    }
+
+    /*
+     * Takes a free slot with the current epoch, spins while all are busy.
+     * Seq-cst store orders the pin before loads of shared pointers, so
+     * writer either sees the pin or reader sees the new version.
+     */
+    [[nodiscard]] Guard pin() {
+        // threads start probing at different slots to avoid fighting over the first ones
+        size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        while (true) {
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                Slot &slot = slots_[(start + i) % slots_.size()];
+                uint64_t expected = FREE;
+                if (slot.epoch_.load(std::memory_order_relaxed) == FREE &&
+                    slot.epoch_.compare_exchange_strong(expected, epoch_.load())) {
+                    return Guard(&slot);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /* Object must be unreachable for readers pinned from now on */
+    template <typename T>
+    void retire(T *ptr) {
+        retired_.push_back({epoch_.load(), ptr, [](void *p) { delete static_cast<T *>(p); }});
+    }
+
+    /*
+     * Advances epoch and frees retired objects no pinned reader can reach.
+     * Does nothing until RECLAIM_BATCH objects are gathered, unless forced.
+     */
+    void reclaim(bool force = false) {
+        if (retired_.empty() || (!force && retired_.size() < RECLAIM_BATCH)) {
+            return;
+        }
+        epoch_.fetch_add(1);
+        uint64_t safe = min_pinned();
+        auto alive = std::partition(retired_.begin(), retired_.end(),
+                                    [safe](const Retired &item) { return item.epoch_ >= safe; });
+        for (auto it = alive; it != retired_.end(); ++it) {
+            it->deleter_(it->ptr_);
+        }
+        retired_.erase(alive, retired_.end());
+    }
+
+    [[nodiscard]] uint64_t epoch() const {
+        return epoch_.load();
+    }
+
+    /* Retired objects not freed yet */
+    [[nodiscard]] size_t pending() const {
+        return retired_.size();
+    }
+};
+
+#endif // CSMT_EPOCH_H
@@ -0,0 +1,104 @@
+#ifndef CSMT_INDEXED_CSMT_H
+#define CSMT_INDEXED_CSMT_H
+
+#include "slot_csmt.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// slots in one vector, link and hash of a node side by side, leaf hashes apart if kept
+template <typename HashType, bool LeafHashes = false>
+class VectorSlots {
+    struct Slot {
+        slot_link_t link_;
+        HashType value_;
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<HashType> leaf_hashes_; // by slot, empty without LeafHashes
+
+public:
+    [[nodiscard]] const slot_link_t &link(uint32_t idx) const {
+        return slots_[idx].link_;
+    }
+
+    void set_link(uint32_t idx, const slot_link_t &link) {
+        slots_[idx].link_ = link;
+    }
+
+    [[nodiscard]] const HashType &hash(uint32_t idx) const {
+        return slots_[idx].value_;
+    }
+
+    void set_hash(uint32_t idx, HashType value) {
+        slots_[idx].value_ = std::move(value);
+    }
+
+    [[nodiscard]] const HashType &leaf_hash(uint32_t idx) const {
+        return leaf_hashes_[idx];
+    }
+
+    void set_leaf_hash(uint32_t idx, HashType value) {
+        leaf_hashes_[idx] = std::move(value);
+    }
+
+    void reset(uint32_t idx, const slot_link_t &link) {
+        slots_[idx] = Slot{link, HashType()};
+        if constexpr (LeafHashes) {
+            leaf_hashes_[idx] = HashType();
+        }
+    }
+
+    uint32_t append() {
+        slots_.emplace_back();
+        if constexpr (LeafHashes) {
+            leaf_hashes_.emplace_back();
+        }
+        return uint32_t(slots_.size() - 1);
+    }
+
+    [[nodiscard]] size_t slots() const {
+        return slots_.size();
+    }
+
+    void reserve(size_t slots) {
+        slots_.reserve(slots);
+        if constexpr (LeafHashes) {
+            leaf_hashes_.reserve(slots);
+        }
+    }
+};
+
+/*
+ * CSMT over contiguous node storage.
+ *
+ * Nodes live in one vector and refer to children by 32-bit indices, erased
+ * slots are chained into a free list and reused by the next insert. Links
+ * take 8 bytes per node instead of 16, neighbours allocated together stay
+ * close in memory and the whole tree is a flat array.
+ *
+ * API, tree shape, hashes and proof formats are the same as of Csmt, see
+ * SlotCsmt. At most 2^32 - 1 nodes, i.e. about 2^31 keys.
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class IndexedCsmt
+    : public SlotCsmt<HashPolicy, HashType, ValueType,
+                      VectorSlots<HashType, has_bind_key<HashPolicy, HashType>::value>> {
+public:
+    IndexedCsmt() = default;
+
+    /* Reserves storage for given number of keys */
+    void reserve(size_t keys) {
+        this->slots_.reserve(keys ? 2 * keys - 1 : 0);
+    }
+
+    /* Slots in storage, live and free */
+    [[nodiscard]] size_t capacity() const {
+        return this->slots_.slots();
+    }
+};
+
+#endif // CSMT_INDEXED_CSMT_H
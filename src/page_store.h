@@ -0,0 +1,215 @@
+#ifndef CSMT_PAGE_STORE_H
+#define CSMT_PAGE_STORE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CSMT_POSIX_FILES
+#include <sys/types.h>
+#endif
+
+/*
+ * File of fixed-size pages behind a bounded cache with CLOCK eviction.
+ *
+ * read(page) and write(page) return the cached copy of a page, loading it
+ * on a miss; write also marks it dirty. A miss takes the frame under the
+ * clock hand, skipping (and clearing) frames referenced since the last
+ * pass, so hot pages stay cached. Dirty pages are written back when they
+ * are evicted and by flush(). Pages past the end of file read as zeros.
+ *
+ * Returned pointer is valid until the next call. Not thread-safe, and the
+ * file is consistent only after flush().
+ */
+class PageStore {
+public:
+    static constexpr size_t DEFAULT_PAGE_SIZE = 4096;
+
+    struct stats_t {
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        uint64_t writebacks_ = 0;
+    };
+
+private:
+    static constexpr uint64_t NO_PAGE = UINT64_MAX;
+
+    struct frame_t {
+        uint64_t page_ = NO_PAGE;
+        bool referenced_ = false;
+        bool dirty_ = false;
+    };
+
+    using file_ptr = std::unique_ptr<std::FILE, int (*)(std::FILE *)>;
+
+    const size_t page_size_;
+    file_ptr file_{nullptr, &std::fclose};
+    uint64_t file_pages_ = 0;
+    std::vector<char> data_;
+    std::vector<frame_t> frames_;
+    std::unordered_map<uint64_t, size_t> cached_;
+    size_t hand_ = 0;
+    stats_t stats_;
+
+    // 64-bit offsets where available, files may be larger than 2 GiB
+    void seek(uint64_t page) {
+#ifdef CSMT_POSIX_FILES
+        int result = fseeko(file_.get(), off_t(page * page_size_), SEEK_SET);
+#else
+        int result = std::fseek(file_.get(), long(page * page_size_), SEEK_SET);
+#endif
+        if (result != 0) {
+            throw std::runtime_error("failed to seek page");
+        }
+    }
+
+    char *frame_data(size_t frame) {
+        return data_.data() + frame * page_size_;
+    }
+
+    void write_back(size_t frame) {
+        frame_t &entry = frames_[frame];
+        seek(entry.page_);
+        if (std::fwrite(frame_data(frame), 1, page_size_, file_.get()) != page_size_) {
+            throw std::runtime_error("failed to write page");
+        }
+        entry.dirty_ = false;
+        file_pages_ = std::max(file_pages_, entry.page_ + 1);
+        ++stats_.writebacks_;
+    }
+
+    // frame for a page that is not cached, evicting the first unreferenced one
+    size_t evict() {
+        while (frames_[hand_].referenced_) {
+            frames_[hand_].referenced_ = false;
+            hand_ = (hand_ + 1) % frames_.size();
+        }
+        size_t frame = hand_;
+        hand_ = (hand_ + 1) % frames_.size();
+        frame_t &entry = frames_[frame];
+        if (entry.page_ != NO_PAGE) {
+            if (entry.dirty_) {
+                write_back(frame);
+            }
+            cached_.erase(entry.page_);
+            entry.page_ = NO_PAGE;
+        }
+        return frame;
+    }
+
+    size_t load(uint64_t page) {
+        auto it = cached_.find(page);
+        if (it != cached_.end()) {
+            ++stats_.hits_;
+            frames_[it->second].referenced_ = true;
+            return it->second;
+        }
+        ++stats_.misses_;
+        size_t frame = evict();
+        char *data = frame_data(frame);
+        if (page < file_pages_) {
+            seek(page);
+            if (std::fread(data, 1, page_size_, file_.get()) != page_size_) {
+                throw std::runtime_error("failed to read page");
+            }
+        } else {
+            std::memset(data, 0, page_size_);
+        }
+        frames_[frame] = {page, true, false};
+        cached_.emplace(page, frame);
+        return frame;
+    }
+
+public:
+    /* Opens or creates file at path, caches up to cache_pages pages */
+    PageStore(const std::string &path, size_t page_size, size_t cache_pages)
+        : page_size_(page_size) {
+        if (page_size == 0 || cache_pages == 0) {
+            throw std::invalid_argument("page store needs pages and cache");
+        }
+        bool exists = std::filesystem::exists(path);
+        file_.reset(std::fopen(path.c_str(), exists ? "r+b" : "w+b"));
+        if (!file_) {
+            throw std::runtime_error("failed to open " + path);
+        }
+        // pages are cached here, stdio buffer would only copy them again
+        std::setvbuf(file_.get(), nullptr, _IONBF, 0);
+        if (exists) {
+            file_pages_ = std::filesystem::file_size(path) / page_size_;
+        }
+        resize_cache(cache_pages);
+    }
+
+    PageStore(const PageStore &) = delete;
+    PageStore &operator=(const PageStore &) = delete;
+
+    ~PageStore() {
+        try {
+            flush();
+        } catch (...) {
+            // pages not written back are lost as in a crash
+        }
+    }
+
+    [[nodiscard]] const char *read(uint64_t page) {
+        return frame_data(load(page));
+    }
+
+    [[nodiscard]] char *write(uint64_t page) {
+        size_t frame = load(page);
+        frames_[frame].dirty_ = true;
+        return frame_data(frame);
+    }
+
+    /* Writes back all dirty pages */
+    void flush() {
+        for (size_t frame = 0; frame < frames_.size(); ++frame) {
+            if (frames_[frame].page_ != NO_PAGE && frames_[frame].dirty_) {
+                write_back(frame);
+            }
+        }
+        if (std::fflush(file_.get()) != 0) {
+            throw std::runtime_error("failed to flush pages");
+        }
+    }
+
+    /* Flushes and empties the cache, then makes room for given number of pages */
+    void resize_cache(size_t cache_pages) {
+        if (cache_pages == 0) {
+            throw std::invalid_argument("page store needs cache");
+        }
+        if (!frames_.empty()) {
+            flush();
+        }
+        cached_.clear();
+        frames_.assign(cache_pages, frame_t());
+        data_.assign(cache_pages * page_size_, 0);
+        hand_ = 0;
+    }
+
+    [[nodiscard]] size_t page_size() const {
+        return page_size_;
+    }
+
+    [[nodiscard]] size_t cache_pages() const {
+        return frames_.size();
+    }
+
+    [[nodiscard]] const stats_t &stats() const {
+        return stats_;
+    }
+
+    void reset_stats() {
+        stats_ = stats_t();
+    }
+};
+
+#endif // CSMT_PAGE_STORE_H
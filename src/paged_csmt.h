@@ -0,0 +1,256 @@
+#ifndef CSMT_PAGED_CSMT_H
+#define CSMT_PAGED_CSMT_H
+
+#include "csmt_snapshot.h"
+#include "page_store.h"
+#include "slot_csmt.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// slots packed into pages of a PageStore after the metadata page, link and hash side by side,
+// followed by leaf hash if kept
+template <typename HashType, bool LeafHashes = false>
+class PageSlots {
+    using hash_io = snapshot_bytes<HashType>;
+
+    mutable PageStore store_;
+    const size_t hash_size_;
+    const size_t record_size_;
+    const size_t per_page_;
+    uint64_t count_ = 0;
+
+    [[nodiscard]] uint64_t page_of(uint32_t idx) const {
+        return 1 + idx / per_page_;
+    }
+
+    [[nodiscard]] size_t offset_of(uint32_t idx) const {
+        return idx % per_page_ * record_size_;
+    }
+
+public:
+    PageSlots(const std::string &path, size_t page_size, size_t cache_pages, size_t hash_size)
+        : store_(path, page_size, cache_pages)
+        , hash_size_(hash_size)
+        , record_size_((sizeof(slot_link_t) + (LeafHashes ? 2 : 1) * hash_size + 7) / 8 * 8)
+        , per_page_(page_size / record_size_) {
+        if (per_page_ == 0) {
+            throw std::invalid_argument("page is too small for a node");
+        }
+    }
+
+    [[nodiscard]] slot_link_t link(uint32_t idx) const {
+        slot_link_t result;
+        std::memcpy(&result, store_.read(page_of(idx)) + offset_of(idx), sizeof(slot_link_t));
+        return result;
+    }
+
+    void set_link(uint32_t idx, const slot_link_t &link) {
+        std::memcpy(store_.write(page_of(idx)) + offset_of(idx), &link, sizeof(slot_link_t));
+    }
+
+    [[nodiscard]] HashType hash(uint32_t idx) const {
+        return hash_io::load(store_.read(page_of(idx)) + offset_of(idx) + sizeof(slot_link_t),
+                             hash_size_);
+    }
+
+    void set_hash(uint32_t idx, const HashType &value) {
+        if (hash_io::size(value) != hash_size_) {
+            throw std::invalid_argument("paged tree needs hashes of the same size");
+        }
+        std::memcpy(store_.write(page_of(idx)) + offset_of(idx) + sizeof(slot_link_t),
+                    hash_io::data(value), hash_size_);
+    }
+
+    [[nodiscard]] HashType leaf_hash(uint32_t idx) const {
+        return hash_io::load(store_.read(page_of(idx)) + offset_of(idx) + sizeof(slot_link_t) +
+                                 hash_size_,
+                             hash_size_);
+    }
+
+    void set_leaf_hash(uint32_t idx, const HashType &value) {
+        if (hash_io::size(value) != hash_size_) {
+            throw std::invalid_argument("paged tree needs hashes of the same size");
+        }
+        std::memcpy(store_.write(page_of(idx)) + offset_of(idx) + sizeof(slot_link_t) + hash_size_,
+                    hash_io::data(value), hash_size_);
+    }
+
+    void reset(uint32_t idx, const slot_link_t &link) {
+        set_link(idx, link);
+    }
+
+    uint32_t append() {
+        return uint32_t(count_++);
+    }
+
+    [[nodiscard]] size_t slots() const {
+        return size_t(count_);
+    }
+
+    void set_slots(uint64_t count) {
+        count_ = count;
+    }
+
+    [[nodiscard]] size_t hash_size() const {
+        return hash_size_;
+    }
+
+    /* Pages holding slots, live and free */
+    [[nodiscard]] size_t pages() const {
+        return size_t((count_ + per_page_ - 1) / per_page_);
+    }
+
+    [[nodiscard]] PageStore &store() const {
+        return store_;
+    }
+};
+
+/*
+ * CSMT with nodes in a file, for trees larger than memory.
+ *
+ * Nodes are fixed-size records (links and binary hash, plus leaf hash if
+ * the policy has bind_key) addressed by 32-bit index, packed into pages of
+ * a PageStore. Only the pages in its cache are
+ * in memory: upper levels are touched by every descent and stay there,
+ * the rest is read on demand. Erased slots are reused through a free list
+ * as in IndexedCsmt.
+ *
+ * API, tree shape, hashes and proof formats are the same as of Csmt, see
+ * SlotCsmt. Hashes must all have the size of the hash of an empty value
+ * (see snapshot_bytes). Page 0 keeps tree metadata: flush() makes the file
+ * a complete tree that can be opened again, it is not crash safe (see
+ * DurableCsmt for that). Stale marks of lazy mode are stored with links, so
+ * a tree reopened before commit() rehashes them on first read.
+ *
+ * Usage:
+ *  PagedCsmt<Policy, Hash> tree("tree.pages", 1024); // 1024 cached pages
+ *  tree.insert(key, value);
+ *  tree.set_cache_pages(64);
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class PagedCsmt
+    : public SlotCsmt<HashPolicy, HashType, ValueType,
+                      PageSlots<HashType, has_bind_key<HashPolicy, HashType>::value>> {
+    using base_type = SlotCsmt<HashPolicy, HashType, ValueType,
+                               PageSlots<HashType, has_bind_key<HashPolicy, HashType>::value>>;
+
+public:
+    using index_t = typename base_type::index_t;
+
+    static constexpr uint64_t MAGIC = 0x31474150544d5343; // "CSMTPAG1" in little endian
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+private:
+    struct header_t {
+        uint64_t magic_;
+        uint32_t format_version_;
+        uint32_t page_size_;
+        uint32_t hash_size_;
+        index_t root_;
+        index_t free_;
+        uint32_t padding_;
+        uint64_t node_count_;
+        uint64_t size_;
+    };
+
+    static_assert(sizeof(header_t) == 48, "unexpected padding");
+
+    [[nodiscard]] PageStore &store() const {
+        return this->slots_.store();
+    }
+
+    void load_header() {
+        header_t header;
+        std::memcpy(&header, store().read(0), sizeof(header_t));
+        if (header.magic_ == 0) {
+            return; // new file
+        }
+        if (header.magic_ != MAGIC || header.format_version_ != FORMAT_VERSION) {
+            throw std::runtime_error("not a paged tree or other version");
+        }
+        if (header.page_size_ != store().page_size() ||
+            header.hash_size_ != this->slots_.hash_size()) {
+            throw std::runtime_error("paged tree has other page or hash size");
+        }
+        if (header.node_count_ > this->NIL || (header.root_ != this->NIL &&
+                                                header.root_ >= header.node_count_)) {
+            throw std::runtime_error("paged tree is damaged");
+        }
+        this->root_ = header.root_;
+        this->free_ = header.free_;
+        this->slots_.set_slots(header.node_count_);
+        this->size_ = size_t(header.size_);
+    }
+
+    void store_header() {
+        header_t header{};
+        header.magic_ = MAGIC;
+        header.format_version_ = FORMAT_VERSION;
+        header.page_size_ = uint32_t(store().page_size());
+        header.hash_size_ = uint32_t(this->slots_.hash_size());
+        header.root_ = this->root_;
+        header.free_ = this->free_;
+        header.node_count_ = this->slots_.slots();
+        header.size_ = this->size_;
+        std::memcpy(store().write(0), &header, sizeof(header_t));
+    }
+
+public:
+    /* Opens or creates tree in file at path, caches up to cache_pages pages */
+    PagedCsmt(const std::string &path, size_t cache_pages,
+              size_t page_size = PageStore::DEFAULT_PAGE_SIZE)
+        : base_type(path, page_size, cache_pages,
+                    snapshot_bytes<HashType>::size(HashPolicy::leaf_hash(ValueType()))) {
+        if (page_size < sizeof(header_t)) {
+            throw std::invalid_argument("page is too small for a node");
+        }
+        load_header();
+    }
+
+    PagedCsmt(const PagedCsmt &) = delete;
+    PagedCsmt &operator=(const PagedCsmt &) = delete;
+
+    ~PagedCsmt() {
+        try {
+            store_header();
+        } catch (...) {
+            // file keeps the last flushed tree
+        }
+    }
+
+    /* Commits stale hashes, writes metadata and all cached changes to the file */
+    void flush() {
+        this->commit();
+        store_header();
+        store().flush();
+    }
+
+    /* Flushes and resizes node cache */
+    void set_cache_pages(size_t cache_pages) {
+        store_header();
+        store().resize_cache(cache_pages);
+    }
+
+    [[nodiscard]] size_t get_cache_pages() const {
+        return store().cache_pages();
+    }
+
+    /* Pages holding nodes, live and free */
+    [[nodiscard]] size_t pages() const {
+        return this->slots_.pages();
+    }
+
+    [[nodiscard]] const PageStore::stats_t &cache_stats() const {
+        return store().stats();
+    }
+
+    void reset_cache_stats() {
+        store().reset_stats();
+    }
+};
+
+#endif // CSMT_PAGED_CSMT_H
@@ -0,0 +1,413 @@
+#ifndef CSMT_PERSISTENT_CSMT_H
+#define CSMT_PERSISTENT_CSMT_H
+
+#include "csmt.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Persistent CSMT with path copying.
+ *
+ * Nodes are immutable and shared between versions: insert and erase copy
+ * only the nodes on the path to the key, so every version costs O(depth)
+ * new nodes and old roots stay valid. Tree shape and hashes are the same
+ * as of Csmt with the same keys, proofs are checked by Csmt::verify and
+ * Csmt::verify_compact_proof.
+ *
+ * Every mutation makes a new version, numbered from 1 (0 is the empty
+ * tree). Versions are retained until prune() drops them, a Snapshot keeps
+ * its nodes alive on its own. Snapshots are immutable and may be read from
+ * other threads while the tree is mutated, the tree itself is not thread
+ * safe.
+ *
+ * Usage:
+ *  PersistentCsmt<Policy> tree;
+ *  tree.insert(1, "a");
+ *  auto before = tree.snapshot();
+ *  tree.erase(1);
+ *  before.membership_proof(1); // still proves "a" against before.root_hash()
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string>
+class PersistentCsmt {
+public:
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType>;
+    using proof_t = typename csmt_type::proof_t;
+    using compact_proof_t = typename csmt_type::compact_proof_t;
+    using op_t = typename csmt_type::op_t;
+
+private:
+    template <typename, typename, typename>
+    friend class CsmtSnapshot;
+
+    struct Node;
+    using node_ptr = std::shared_ptr<const Node>;
+
+    // leaves keep only the hash their parents see, see has_bind_key
+    struct Node {
+        uint64_t key_;
+        HashType value_;
+        node_ptr left_;
+        node_ptr right_;
+        uint8_t split_ = 0;
+
+        [[nodiscard]] bool is_leaf() const {
+            return !left_;
+        }
+    };
+
+    // Reader access to nodes of a version
+    struct nodes_t {
+        using handle_t = const Node *;
+
+        static constexpr const Node *NIL = nullptr;
+
+        static typename csmt_type::template link_t<const Node *> link(const Node *node) {
+            return {node->key_, node->left_.get(), node->right_.get(), node->split_};
+        }
+
+        static const HashType &hash(const Node *node) {
+            return node->value_;
+        }
+
+        static typename csmt_type::Blob blob(const Node *node) {
+            return {node->key_, node->value_};
+        }
+    };
+
+    using reader_t = typename csmt_type::template Reader<nodes_t>;
+    using path_t = typename reader_t::path_t;
+
+    static const node_ptr &child_link(const Node *root, uint64_t key) {
+        return ((key >> root->split_) & 1u ? root->right_ : root->left_);
+    }
+
+    static node_ptr make_leaf(uint64_t key, const HashType &leaf_hash) {
+        HashType hash = csmt_type::bound_hash(key, leaf_hash);
+        return std::make_shared<const Node>(Node{key, std::move(hash), {}, {}});
+    }
+
+    static node_ptr make_node(node_ptr lhs, node_ptr rhs) {
+        uint64_t key = rhs->key_;
+        auto split = uint8_t(csmt_type::log2(lhs->key_ ^ rhs->key_));
+        HashType value = HashPolicy::merge_hash(lhs->value_, rhs->value_);
+        return std::make_shared<const Node>(
+            Node{key, std::move(value), std::move(lhs), std::move(rhs), split});
+    }
+
+    // copies path[0, depth) bottom-up with child on the way to key replaced
+    static node_ptr copy_path(const path_t &path, size_t depth, uint64_t key, node_ptr child) {
+        while (depth > 0) {
+            const Node *parent = path[--depth];
+            if ((key >> parent->split_) & 1u) {
+                child = make_node(parent->left_, std::move(child));
+            } else {
+                child = make_node(std::move(child), parent->right_);
+            }
+        }
+        return child;
+    }
+
+    // change of apply_batch with hashed leaf value, erased key has no value
+    struct change_t {
+        uint64_t key_;
+        HashType hash_;
+        bool erase_;
+    };
+
+    // links disjoint subtrees given in key order into one, see Csmt::link
+    static node_ptr link(std::vector<node_ptr> &items) {
+        std::vector<node_ptr> stack;
+        std::vector<uint64_t> gaps; // gaps[i] is distance between stack[i] and stack[i + 1]
+        auto merge_top = [&stack]() {
+            node_ptr rhs = std::move(stack.back());
+            stack.pop_back();
+            stack.back() = make_node(std::move(stack.back()), std::move(rhs));
+        };
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i > 0) {
+                uint64_t gap = csmt_type::distance(stack.back()->key_, items[i]->key_);
+                while (!gaps.empty() && gaps.back() < gap) {
+                    gaps.pop_back();
+                    merge_top();
+                }
+                gaps.push_back(gap);
+            }
+            stack.push_back(std::move(items[i]));
+        }
+        while (stack.size() > 1) {
+            merge_top();
+        }
+        return (stack.empty() ? nullptr : std::move(stack.back()));
+    }
+
+    /*
+     * Applies sorted unique changes [first, last) to subtree (may be null),
+     * see Csmt::apply. Changed nodes are copied and hashed once, untouched
+     * subtrees are shared with the old version.
+     */
+    static node_ptr apply(const node_ptr &root, const change_t *first, const change_t *last,
+                          size_t &size) {
+        if (first == last) {
+            return root;
+        }
+        std::vector<node_ptr> items;
+        auto add_inserts = [&items, &size](const change_t *from, const change_t *to) {
+            for (; from != to; ++from) {
+                if (!from->erase_) {
+                    items.push_back(make_leaf(from->key_, from->hash_));
+                    ++size;
+                }
+            }
+        };
+        if (!root) {
+            add_inserts(first, last);
+            return link(items);
+        }
+
+        const change_t *inner_first = first;
+        const change_t *inner_last = last;
+        node_ptr result = root;
+        if (root->is_leaf()) {
+            uint64_t key = root->key_;
+            inner_first = std::partition_point(first, last, [key](const change_t &change) {
+                return change.key_ < key;
+            });
+            inner_last = inner_first;
+            if (inner_first != last && inner_first->key_ == key) {
+                ++inner_last;
+                if (inner_first->erase_) {
+                    result = nullptr;
+                    --size;
+                } else {
+                    result = make_leaf(key, inner_first->hash_);
+                }
+            }
+        } else {
+            // keys of subtree share bits above split bit, left has it unset, right set
+            uint64_t split = root->split_;
+            uint64_t prefix = (root->key_ >> split) >> 1u;
+            auto prefix_of = [split](const change_t &change) {
+                return (change.key_ >> split) >> 1u;
+            };
+            inner_first = std::partition_point(first, last, [&](const change_t &change) {
+                return prefix_of(change) < prefix;
+            });
+            inner_last = std::partition_point(inner_first, last, [&](const change_t &change) {
+                return prefix_of(change) == prefix;
+            });
+            const change_t *inner_mid =
+                std::partition_point(inner_first, inner_last, [&](const change_t &change) {
+                    return ((change.key_ >> split) & 1u) == 0;
+                });
+            node_ptr lhs = apply(root->left_, inner_first, inner_mid, size);
+            node_ptr rhs = apply(root->right_, inner_mid, inner_last, size);
+            if (!lhs || !rhs) {
+                result = (lhs ? std::move(lhs) : std::move(rhs));
+            } else if (lhs != root->left_ || rhs != root->right_) {
+                result = make_node(std::move(lhs), std::move(rhs));
+            }
+        }
+
+        // keys outside of subtree prefix can only be new neighbours of it
+        add_inserts(first, inner_first);
+        if (result) {
+            items.push_back(std::move(result));
+        }
+        add_inserts(inner_last, last);
+        return link(items);
+    }
+
+public:
+    /* Immutable version of the tree, cheap to copy */
+    class Snapshot {
+        friend class PersistentCsmt;
+        template <typename, typename, typename>
+        friend class CsmtSnapshot;
+
+        node_ptr root_;
+        size_t size_ = 0;
+
+        Snapshot(node_ptr root, size_t size)
+            : root_(std::move(root))
+            , size_(size) {
+        }
+
+        [[nodiscard]] reader_t reader() const {
+            return reader_t(nodes_t(), root_.get());
+        }
+
+    public:
+        Snapshot() = default;
+
+        [[nodiscard]] bool contains(uint64_t key) const {
+            return reader().contains(key);
+        }
+
+        [[nodiscard]] size_t size() const {
+            return size_;
+        }
+
+        [[nodiscard]] HashType root_hash() const {
+            return reader().root_hash();
+        }
+
+        /* Same format as Csmt::membership_proof */
+        [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+            return reader().membership_proof(key);
+        }
+
+        /* Same format as Csmt::compact_proof */
+        [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+            return reader().compact_proof(key);
+        }
+    };
+
+private:
+    Snapshot head_;
+    uint64_t version_ = 0;
+    std::map<uint64_t, Snapshot> versions_{{0, Snapshot()}};
+
+    void publish(node_ptr root, size_t size) {
+        head_ = Snapshot(std::move(root), size);
+        versions_.emplace(++version_, head_);
+    }
+
+public:
+    PersistentCsmt() = default;
+
+    /* Copies share all nodes, so copying is O(versions) */
+    PersistentCsmt(const PersistentCsmt &) = default;
+    PersistentCsmt &operator=(const PersistentCsmt &) = default;
+    PersistentCsmt(PersistentCsmt &&) = default;
+    PersistentCsmt &operator=(PersistentCsmt &&) = default;
+
+    void insert(uint64_t key, const ValueType &value) {
+        node_ptr leaf = make_leaf(key, HashPolicy::leaf_hash(value));
+        if (!head_.root_) {
+            publish(std::move(leaf), 1);
+            return;
+        }
+
+        path_t path;
+        const Node *stop;
+        size_t depth = head_.reader().descend(key, path, stop);
+        size_t size = head_.size_;
+        if (!stop->is_leaf() || stop->key_ != key) {
+            // stop becomes sibling of the new leaf, take shared ownership of it
+            node_ptr sibling = (depth ? child_link(path[depth - 1], key) : head_.root_);
+            leaf = (key < stop->key_ ? make_node(std::move(leaf), std::move(sibling))
+                                     : make_node(std::move(sibling), std::move(leaf)));
+            ++size;
+        }
+        publish(copy_path(path, depth, key, std::move(leaf)), size);
+    }
+
+    void erase(uint64_t key) {
+        path_t path;
+        size_t depth = 0;
+        if (!head_.reader().find(key, path, depth)) {
+            return;
+        }
+        if (depth == 0) {
+            publish(nullptr, 0);
+            return;
+        }
+        // parent is replaced by the other child
+        const Node *parent = path[--depth];
+        node_ptr sibling = ((key >> parent->split_) & 1u ? parent->left_ : parent->right_);
+        publish(copy_path(path, depth, key, std::move(sibling)), head_.size_ - 1);
+    }
+
+    /*
+     * Applies range of op_t as one new version, as if they were called one by
+     * one. Shared ancestors of changed keys are copied and hashed once per
+     * batch, the tree is left as it was on exception.
+     */
+    template <typename Range>
+    void apply_batch(const Range &ops) {
+        std::vector<change_t> changes;
+        for (const op_t &op : ops) {
+            bool erase = op.kind_ == op_t::kind_t::ERASE;
+            changes.push_back({op.key_, (erase ? HashType() : HashPolicy::leaf_hash(op.value_)),
+                               erase});
+        }
+        // sorted by key, for repeated keys only the last one is kept
+        std::stable_sort(changes.begin(), changes.end(),
+                         [](const change_t &lhs, const change_t &rhs) {
+                             return lhs.key_ < rhs.key_;
+                         });
+        auto last = std::unique(changes.rbegin(), changes.rend(),
+                                [](const change_t &lhs, const change_t &rhs) {
+                                    return lhs.key_ == rhs.key_;
+                                });
+        changes.erase(changes.begin(), last.base());
+        if (changes.empty()) {
+            return;
+        }
+        size_t size = head_.size_;
+        node_ptr root = apply(head_.root_, changes.data(), changes.data() + changes.size(), size);
+        publish(std::move(root), size);
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        return head_.contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return head_.size();
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        return head_.root_hash();
+    }
+
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        return head_.membership_proof(key);
+    }
+
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        return head_.compact_proof(key);
+    }
+
+    /* Number of the current version */
+    [[nodiscard]] uint64_t version() const {
+        return version_;
+    }
+
+    [[nodiscard]] Snapshot snapshot() const {
+        return head_;
+    }
+
+    /* Retained version, empty if it was pruned or does not exist yet */
+    [[nodiscard]] std::optional<Snapshot> snapshot(uint64_t version) const {
+        auto it = versions_.find(version);
+        if (it == versions_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    /*
+     * Drops retained versions older than given one, current version is
+     * always kept. Nodes are freed once no version or Snapshot uses them.
+     */
+    void prune(uint64_t version) {
+        versions_.erase(versions_.begin(), versions_.lower_bound(std::min(version, version_)));
+    }
+
+    /* Number of retained versions */
+    [[nodiscard]] size_t versions() const {
+        return versions_.size();
+    }
+};
+
+#endif // CSMT_PERSISTENT_CSMT_H
@@ -0,0 +1,166 @@
+#ifndef CSMT_POOL_ALLOCATOR_H
+#define CSMT_POOL_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Slab pool for small fixed-size objects.
+ *
+ * Memory is carved from large slabs with a bump pointer, freed blocks go to
+ * a free list of their size class and are reused by the next allocation of
+ * the same size. Slabs are returned to the system only when pool dies.
+ *
+ * Not thread safe: one pool per tree (or per thread) is expected.
+ */
+class NodePool {
+public:
+    static constexpr size_t DEFAULT_SLAB_SIZE = 64 * 1024;
+    static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+    static constexpr size_t MAX_POOLED_SIZE = 512;
+
+private:
+    struct FreeBlock {
+        FreeBlock *next_;
+    };
+
+    static constexpr size_t CLASSES = MAX_POOLED_SIZE / ALIGNMENT;
+
+    const size_t slab_size_;
+    std::vector<std::unique_ptr<unsigned char[]>> slabs_;
+    unsigned char *cursor_ = nullptr;
+    unsigned char *end_ = nullptr;
+    FreeBlock *free_lists_[CLASSES] = {};
+
+    static size_t size_class(size_t bytes) {
+        return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+    }
+
+    void add_slab() {
+        slabs_.emplace_back(new unsigned char[slab_size_]);
+        cursor_ = slabs_.back().get();
+        end_ = cursor_ + slab_size_;
+    }
+
+public:
+    explicit NodePool(size_t slab_size = DEFAULT_SLAB_SIZE)
+        : slab_size_(slab_size < MAX_POOLED_SIZE ? MAX_POOLED_SIZE : slab_size) {
+    }
+
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+
+    void *allocate(size_t bytes) {
+        if (bytes == 0 || bytes > MAX_POOLED_SIZE) {
+            return ::operator new(bytes);
+        }
+        size_t cls = size_class(bytes);
+        if (FreeBlock *block = free_lists_[cls]) {
+            free_lists_[cls] = block->next_;
+            return block;
+        }
+        size_t rounded = (cls + 1) * ALIGNMENT;
+        if (static_cast<size_t>(end_ - cursor_) < rounded) {
+            add_slab();
+        }
+        void *result = cursor_;
+        cursor_ += rounded;
+        return result;
+    }
+
+    void deallocate(void *ptr, size_t bytes) noexcept {
+        if (bytes == 0 || bytes > MAX_POOLED_SIZE) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t cls = size_class(bytes);
+        auto *block = static_cast<FreeBlock *>(ptr);
+        block->next_ = free_lists_[cls];
+        free_lists_[cls] = block;
+    }
+
+    [[nodiscard]] size_t slabs() const {
+        return slabs_.size();
+    }
+
+    [[nodiscard]] size_t reserved_bytes() const {
+        return slabs_.size() * slab_size_;
+    }
+};
+
+/*
+ * Standard allocator over shared NodePool.
+ *
+ * Copies and rebinds share the same pool, so a Csmt and all allocator
+ * copies made from it reuse each other's freed nodes. Default constructed
+ * allocator owns a fresh pool.
+ *
+ * Usage:
+ *  Csmt<Policy, HashType, ValueType, PoolAllocator<void>> tree;
+ */
+template <typename T>
+class PoolAllocator {
+    template <typename U>
+    friend class PoolAllocator;
+
+    std::shared_ptr<NodePool> pool_;
+
+    static constexpr bool is_pooled(size_t n) {
+        return n == 1 && alignof(T) <= NodePool::ALIGNMENT;
+    }
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    PoolAllocator()
+        : pool_(std::make_shared<NodePool>()) {
+    }
+
+    explicit PoolAllocator(std::shared_ptr<NodePool> pool)
+        : pool_(std::move(pool)) {
+    }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept
+        : pool_(other.pool_) {
+    }
+
+    T *allocate(size_t n) {
+        if (is_pooled(n)) {
+            return static_cast<T *>(pool_->allocate(sizeof(T)));
+        }
+        // honours alignof(T) and checks n * sizeof(T) for overflow
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        if (is_pooled(n)) {
+            pool_->deallocate(ptr, sizeof(T));
+        } else {
+            std::allocator<T>().deallocate(ptr, n);
+        }
+    }
+
+    [[nodiscard]] const std::shared_ptr<NodePool> &pool() const {
+        return pool_;
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &other) const noexcept {
+        return pool_ == other.pool_;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &other) const noexcept {
+        return pool_ != other.pool_;
+    }
+};
+
+#endif // CSMT_POOL_ALLOCATOR_H
@@ -0,0 +1,214 @@
+#ifndef CSMT_SHARDED_CSMT_H
+#define CSMT_SHARDED_CSMT_H
+
+#include "csmt.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * CSMT split into 2^k shards by the high k bits of key, each shard is a
+ * Csmt with its own lock, so writers of different shards do not wait on
+ * each other.
+ *
+ * Keys of different shards differ above any split inside a shard, so the
+ * full tree is the shard roots linked by the highest differing bit of
+ * neighbours: root hash and proofs are exactly the ones of a single Csmt
+ * over the same keys. Whole-tree reads wait for writers of all shards.
+ *
+ * Usage:
+ *  ShardedCsmt<Policy> tree(4); // 16 shards
+ *  tree.insert(key, value);     // from any thread
+ *  tree.root_hash();            // same as Csmt<Policy> with the same keys
+ */
+template <typename HashPolicy = DefaultHashPolicy, typename HashType = std::string,
+          typename ValueType = std::string, typename Alloc = std::allocator<void>>
+class ShardedCsmt {
+public:
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType, Alloc>;
+    using proof_t = typename csmt_type::proof_t;
+    using op_t = typename csmt_type::op_t;
+
+    static constexpr size_t MAX_SHARD_BITS = 16;
+
+private:
+    struct Shard {
+        std::mutex mutex_;
+        csmt_type tree_;
+    };
+
+    const size_t shard_bits_;
+    std::unique_ptr<Shard[]> shards_;
+    // shard users hold it shared, whole-tree readers exclusively
+    mutable std::shared_mutex tree_mutex_;
+    std::shared_ptr<ThreadPool> pool_;
+
+    [[nodiscard]] size_t shard_of(uint64_t key) const {
+        return (shard_bits_ ? size_t(key >> (64 - shard_bits_)) : 0);
+    }
+
+    [[nodiscard]] size_t shard_count() const {
+        return size_t(1) << shard_bits_;
+    }
+
+    /*
+     * Links shard roots like Csmt::link does nodes: neighbour roots meet at
+     * the highest bit where their keys differ, lower meetings go first.
+     * Pairs merged above target shard are appended to path bottom-up.
+     * Tree must be locked exclusively.
+     */
+    HashType link_roots(size_t target, proof_t *path) const {
+        struct item_t {
+            HashType hash_;
+            bool target_;
+        };
+        std::vector<item_t> stack;
+        std::vector<uint64_t> gaps; // gaps[i] is distance between stack[i] and stack[i + 1]
+
+        auto merge_top = [&]() {
+            item_t rhs = std::move(stack.back());
+            stack.pop_back();
+            item_t &lhs = stack.back();
+            if (path && (lhs.target_ || rhs.target_)) {
+                path->push_back(lhs.hash_);
+                path->push_back(rhs.hash_);
+            }
+            lhs.hash_ = HashPolicy::merge_hash(lhs.hash_, rhs.hash_);
+            lhs.target_ = lhs.target_ || rhs.target_;
+            gaps.pop_back();
+        };
+
+        uint64_t last_key = 0;
+        for (size_t shard = 0; shard < shard_count(); ++shard) {
+            const csmt_type &tree = shards_[shard].tree_;
+            if (tree.size() == 0) {
+                continue;
+            }
+            // keys of two shards differ first in shard bits, lowest keys will do
+            uint64_t key = (shard_bits_ ? uint64_t(shard) << (64 - shard_bits_) : 0);
+            if (!stack.empty()) {
+                uint64_t gap = csmt_type::distance(last_key, key);
+                while (!gaps.empty() && gaps.back() < gap) {
+                    merge_top();
+                }
+                gaps.push_back(gap);
+            }
+            stack.push_back({tree.root_hash(), shard == target});
+            last_key = key;
+        }
+        while (!gaps.empty()) {
+            merge_top();
+        }
+        return (stack.empty() ? HashType() : stack.back().hash_);
+    }
+
+public:
+    explicit ShardedCsmt(size_t shard_bits = 4)
+        : shard_bits_(shard_bits) {
+        if (shard_bits > MAX_SHARD_BITS) {
+            throw std::invalid_argument("too many shard bits");
+        }
+        shards_.reset(new Shard[shard_count()]);
+    }
+
+    ShardedCsmt(const ShardedCsmt &) = delete;
+    ShardedCsmt &operator=(const ShardedCsmt &) = delete;
+
+    void insert(uint64_t key, const ValueType &value) {
+        std::shared_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        Shard &shard = shards_[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        shard.tree_.insert(key, value);
+    }
+
+    void erase(uint64_t key) {
+        std::shared_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        Shard &shard = shards_[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        shard.tree_.erase(key);
+    }
+
+    /*
+     * Splits ops by shard, keeping their order, and applies each part with
+     * Csmt::apply_batch. Parts go to pool threads if set_threads was called.
+     */
+    template <typename Range>
+    void apply_batch(const Range &ops) {
+        std::vector<std::vector<op_t>> parts(shard_count());
+        for (const op_t &op : ops) {
+            parts[shard_of(op.key_)].push_back(op);
+        }
+        std::shared_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        auto apply_part = [this, &parts](size_t shard) {
+            if (!parts[shard].empty()) {
+                std::lock_guard<std::mutex> lock(shards_[shard].mutex_);
+                shards_[shard].tree_.apply_batch(parts[shard]);
+            }
+        };
+        if (pool_) {
+            pool_->run(shard_count(), apply_part);
+        } else {
+            for (size_t shard = 0; shard < shard_count(); ++shard) {
+                apply_part(shard);
+            }
+        }
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        std::shared_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        Shard &shard = shards_[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        return shard.tree_.contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::shared_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        size_t result = 0;
+        for (size_t shard = 0; shard < shard_count(); ++shard) {
+            std::lock_guard<std::mutex> lock(shards_[shard].mutex_);
+            result += shards_[shard].tree_.size();
+        }
+        return result;
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        std::unique_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        return link_roots(shard_count(), nullptr);
+    }
+
+    /* Shard proof with the top-level pairs stitched on, same as of Csmt */
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        size_t target = shard_of(key);
+        std::unique_lock<std::shared_mutex> tree_lock(tree_mutex_);
+        proof_t proof = shards_[target].tree_.membership_proof(key);
+        if (proof.empty()) {
+            return proof;
+        }
+        proof.pop_back();
+        HashType root = link_roots(target, &proof);
+        proof.push_back(std::move(root));
+        return proof;
+    }
+
+    /* Pool for apply_batch, at most one part per shard runs at a time */
+    void set_threads(size_t threads) {
+        pool_ = (threads > 1 ? std::make_shared<ThreadPool>(threads) : nullptr);
+    }
+
+    [[nodiscard]] size_t get_threads() const {
+        return (pool_ ? pool_->size() : 1);
+    }
+
+    [[nodiscard]] size_t shards() const {
+        return shard_count();
+    }
+};
+
+#endif // CSMT_SHARDED_CSMT_H
@@ -0,0 +1,476 @@
+#ifndef CSMT_SLOT_CSMT_H
+#define CSMT_SLOT_CSMT_H
+
+#include "csmt.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Walk data of a node kept in a numbered slot, see SlotCsmt */
+struct slot_link_t {
+    static constexpr uint32_t NIL = std::numeric_limits<uint32_t>::max();
+
+    uint64_t key_ = 0;
+    uint32_t left_ = NIL; // next free slot for erased nodes
+    uint32_t right_ = NIL;
+    uint8_t split_ = 0;
+    bool dirty_ = false; // hash of interior node is stale, see set_lazy
+    uint8_t padding_[6] = {};
+};
+
+static_assert(sizeof(slot_link_t) == 24, "unexpected padding");
+
+/*
+ * CSMT over storage of numbered node slots, shared by IndexedCsmt and
+ * PagedCsmt.
+ *
+ * Children are referred to by 32-bit slot indices, erased slots are chained
+ * into a free list and reused by the next insert. Reads go through
+ * Csmt::Reader, so API, tree shape, hashes and proof formats are the same
+ * as of Csmt. At most 2^32 - 1 slots, i.e. about 2^31 keys.
+ *
+ * Slots is the storage, the tree is copyable if it is:
+ *  link(idx), set_link(idx, link) -- slot_link_t of slot, read by value or reference
+ *  hash(idx), set_hash(idx, hash) -- hash as parents see it, read by value or reference
+ *  leaf_hash(idx), set_leaf_hash(idx, hash) -- leaf hash of a leaf, if HashPolicy has bind_key
+ *  reset(idx, link)               -- new link of a taken or freed slot, hash is dropped
+ *  append()                       -- adds a slot at the end, returns its index
+ *  slots()                        -- number of slots, live and free
+ */
+template <typename HashPolicy, typename HashType, typename ValueType, typename Slots>
+class SlotCsmt {
+public:
+    using index_t = uint32_t;
+    using csmt_type = Csmt<HashPolicy, HashType, ValueType>;
+    using Blob = typename csmt_type::Blob;
+    using proof_t = typename csmt_type::proof_t;
+    using compact_proof_t = typename csmt_type::compact_proof_t;
+    using non_membership_proof_t = typename csmt_type::non_membership_proof_t;
+    using multiproof_t = typename csmt_type::multiproof_t;
+    using range_proof_t = typename csmt_type::range_proof_t;
+    using op_t = typename csmt_type::op_t;
+
+    static constexpr index_t NIL = slot_link_t::NIL;
+
+protected:
+    using Link = slot_link_t;
+
+    // Reader access to slots
+    struct nodes_t {
+        using handle_t = index_t;
+
+        static constexpr index_t NIL = SlotCsmt::NIL;
+
+        const Slots *slots_ = nullptr;
+
+        [[nodiscard]] decltype(auto) link(index_t idx) const {
+            return slots_->link(idx);
+        }
+
+        [[nodiscard]] decltype(auto) hash(index_t idx) const {
+            return slots_->hash(idx);
+        }
+
+        [[nodiscard]] Blob blob(index_t idx) const {
+            if constexpr (csmt_type::BINDS_KEYS) {
+                return {slots_->link(idx).key_, slots_->leaf_hash(idx)};
+            } else {
+                return {slots_->link(idx).key_, slots_->hash(idx)};
+            }
+        }
+    };
+
+    using reader_t = typename csmt_type::template Reader<nodes_t>;
+    using path_t = typename reader_t::path_t;
+
+    // lazy hashes are written by const readers, see set_lazy
+    mutable Slots slots_;
+    index_t root_ = NIL;
+    index_t free_ = NIL;
+    size_t size_ = 0;
+    bool lazy_ = false;
+
+    template <typename... Args>
+    explicit SlotCsmt(Args &&...args)
+        : slots_(std::forward<Args>(args)...) {
+    }
+
+    [[nodiscard]] reader_t reader() const {
+        return reader_t(nodes_t{&slots_}, root_);
+    }
+
+    index_t allocate(const Link &link) {
+        index_t idx;
+        if (free_ != NIL) {
+            idx = free_;
+            free_ = slots_.link(idx).left_;
+        } else {
+            if (slots_.slots() >= NIL) {
+                throw std::length_error("node storage is full");
+            }
+            idx = slots_.append();
+        }
+        slots_.reset(idx, link);
+        return idx;
+    }
+
+    void release(index_t idx) {
+        Link link;
+        link.left_ = free_;
+        slots_.reset(idx, link);
+        free_ = idx;
+    }
+
+    // stores leaf hash of leaf with key, and the hash its parent sees
+    void set_leaf(index_t idx, uint64_t key, HashType hash) {
+        if constexpr (csmt_type::BINDS_KEYS) {
+            slots_.set_hash(idx, HashPolicy::bind_key(key, hash));
+            slots_.set_leaf_hash(idx, std::move(hash));
+        } else {
+            slots_.set_hash(idx, std::move(hash));
+        }
+    }
+
+    index_t make_leaf(uint64_t key, HashType hash) {
+        index_t idx = allocate(Link{key});
+        try {
+            set_leaf(idx, key, std::move(hash));
+        } catch (...) {
+            release(idx);
+            throw;
+        }
+        return idx;
+    }
+
+    // recomputes key and hash of interior node from its children
+    void rehash(index_t idx) const {
+        Link link = slots_.link(idx);
+        HashType value = HashPolicy::merge_hash(slots_.hash(link.left_), slots_.hash(link.right_));
+        link.key_ = slots_.link(link.right_).key_;
+        link.dirty_ = false;
+        slots_.set_hash(idx, std::move(value));
+        slots_.set_link(idx, link);
+    }
+
+    // refreshes interior node after its child changed, lazy mode only marks hash stale
+    void update(index_t idx) {
+        if (lazy_) {
+            Link link = slots_.link(idx);
+            link.key_ = slots_.link(link.right_).key_;
+            link.dirty_ = true;
+            slots_.set_link(idx, link);
+        } else {
+            rehash(idx);
+        }
+    }
+
+    index_t make_node(index_t lhs, index_t rhs) {
+        Link link;
+        uint64_t lkey = slots_.link(lhs).key_;
+        link.key_ = slots_.link(rhs).key_;
+        link.left_ = lhs;
+        link.right_ = rhs;
+        link.split_ = uint8_t(csmt_type::log2(lkey ^ link.key_));
+        link.dirty_ = true;
+        index_t idx = allocate(link);
+        if (!lazy_) {
+            try {
+                rehash(idx);
+            } catch (...) {
+                release(idx);
+                throw;
+            }
+        }
+        return idx;
+    }
+
+    // replaces child on the way to key at given depth, root for depth 0
+    void relink(const path_t &path, size_t depth, uint64_t key, index_t child) {
+        if (depth == 0) {
+            root_ = child;
+            return;
+        }
+        Link parent = slots_.link(path[depth - 1]);
+        ((key >> parent.split_) & 1u ? parent.right_ : parent.left_) = child;
+        slots_.set_link(path[depth - 1], parent);
+    }
+
+    // inserts or updates leaf with hash already computed
+    void put(uint64_t key, HashType hash) {
+        if (root_ == NIL) {
+            root_ = make_leaf(key, std::move(hash));
+            size_ = 1;
+            return;
+        }
+
+        path_t path;
+        index_t stop;
+        size_t depth = reader().descend(key, path, stop);
+        Link link = slots_.link(stop);
+        if (link.left_ == NIL && link.key_ == key) {
+            set_leaf(stop, key, std::move(hash));
+        } else {
+            index_t leaf = make_leaf(key, std::move(hash));
+            index_t node;
+            try {
+                node = (key < link.key_ ? make_node(leaf, stop) : make_node(stop, leaf));
+            } catch (...) {
+                release(leaf);
+                throw;
+            }
+            relink(path, depth, key, node);
+            ++size_;
+        }
+        while (depth > 0) {
+            update(path[--depth]);
+        }
+    }
+
+    void remove(uint64_t key) {
+        path_t path;
+        size_t depth = 0;
+        index_t leaf = reader().find(key, path, depth);
+        if (leaf == NIL) {
+            return;
+        }
+
+        --size_;
+        release(leaf);
+        if (depth == 0) {
+            root_ = NIL;
+            return;
+        }
+        // parent is replaced by the other child
+        index_t parent = path[--depth];
+        Link link = slots_.link(parent);
+        relink(path, depth, key, link.left_ == leaf ? link.right_ : link.left_);
+        release(parent);
+        while (depth > 0) {
+            update(path[--depth]);
+        }
+    }
+
+    // buckets stale interior nodes of subtree by height, returns height of root
+    size_t collect_dirty(index_t idx, std::vector<std::vector<index_t>> &levels) const {
+        Link link = slots_.link(idx);
+        if (!link.dirty_) {
+            return 0;
+        }
+        size_t height =
+            std::max(collect_dirty(link.left_, levels), collect_dirty(link.right_, levels)) + 1;
+        if (levels.size() < height) {
+            levels.resize(height);
+        }
+        levels[height - 1].push_back(idx);
+        return height;
+    }
+
+    // rehashes independent interior nodes, in one batch if policy supports it
+    void rehash_many(const std::vector<index_t> &nodes) const {
+        if constexpr (has_merge_hash_many<HashPolicy, HashType>::value) {
+            // slots may hand out hashes by value, so children are copied
+            size_t count = nodes.size();
+            std::vector<HashType> children;
+            children.reserve(2 * count);
+            for (index_t idx : nodes) {
+                Link link = slots_.link(idx);
+                children.push_back(slots_.hash(link.left_));
+                children.push_back(slots_.hash(link.right_));
+            }
+            std::vector<const HashType *> lhs(count);
+            std::vector<const HashType *> rhs(count);
+            std::vector<HashType> values(count);
+            for (size_t i = 0; i < count; ++i) {
+                lhs[i] = &children[2 * i];
+                rhs[i] = &children[2 * i + 1];
+            }
+            HashPolicy::merge_hash_many(lhs.data(), rhs.data(), values.data(), count);
+            for (size_t i = 0; i < count; ++i) {
+                Link link = slots_.link(nodes[i]);
+                link.key_ = slots_.link(link.right_).key_;
+                link.dirty_ = false;
+                slots_.set_hash(nodes[i], std::move(values[i]));
+                slots_.set_link(nodes[i], link);
+            }
+        } else {
+            for (index_t idx : nodes) {
+                rehash(idx);
+            }
+        }
+    }
+
+    // hashes each stale interior node once, a whole level per batch
+    void flush() const {
+        if (root_ == NIL || !slots_.link(root_).dirty_) {
+            return;
+        }
+        std::vector<std::vector<index_t>> levels;
+        collect_dirty(root_, levels);
+        for (const std::vector<index_t> &level : levels) {
+            rehash_many(level);
+        }
+    }
+
+public:
+    using const_iterator = typename reader_t::const_iterator;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    void insert(uint64_t key, const ValueType &value) {
+        put(key, HashPolicy::leaf_hash(value));
+    }
+
+    void erase(uint64_t key) {
+        remove(key);
+    }
+
+    /*
+     * Applies range of op_t as if they were called one by one. Leaves are
+     * hashed first, then ops go in key order with interior hashes marked
+     * stale, so each changed interior node is rehashed once per batch.
+     * On exception a part of ops may be applied.
+     */
+    template <typename Range>
+    void apply_batch(const Range &ops) {
+        struct change_t {
+            const op_t *op_;
+            HashType hash_;
+        };
+        std::vector<change_t> changes;
+        for (const op_t &op : ops) {
+            bool erase = op.kind_ == op_t::kind_t::ERASE;
+            changes.push_back({&op, erase ? HashType() : HashPolicy::leaf_hash(op.value_)});
+        }
+        // ops on one key keep their order, others commute
+        auto by_key = [](const change_t &lhs, const change_t &rhs) {
+            return lhs.op_->key_ < rhs.op_->key_;
+        };
+        if (!std::is_sorted(changes.begin(), changes.end(), by_key)) {
+            std::stable_sort(changes.begin(), changes.end(), by_key);
+        }
+
+        bool lazy = lazy_;
+        lazy_ = true;
+        try {
+            for (change_t &change : changes) {
+                if (change.op_->kind_ == op_t::kind_t::ERASE) {
+                    remove(change.op_->key_);
+                } else {
+                    put(change.op_->key_, std::move(change.hash_));
+                }
+            }
+        } catch (...) {
+            lazy_ = lazy;
+            throw;
+        }
+        lazy_ = lazy;
+        if (!lazy_) {
+            flush();
+        }
+    }
+
+    [[nodiscard]] bool contains(uint64_t key) const {
+        return reader().contains(key);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    [[nodiscard]] HashType root_hash() const {
+        flush();
+        return reader().root_hash();
+    }
+
+    /* Same format as Csmt::membership_proof */
+    [[nodiscard]] proof_t membership_proof(uint64_t key) const {
+        flush();
+        return reader().membership_proof(key);
+    }
+
+    /* Same format as Csmt::compact_proof */
+    [[nodiscard]] std::optional<compact_proof_t> compact_proof(uint64_t key) const {
+        flush();
+        return reader().compact_proof(key);
+    }
+
+    /* Same format as Csmt::non_membership_proof */
+    [[nodiscard]] std::optional<non_membership_proof_t> non_membership_proof(uint64_t key) const {
+        flush();
+        return reader().non_membership_proof(key);
+    }
+
+    /* Same format as Csmt::membership_multiproof */
+    [[nodiscard]] std::optional<multiproof_t> membership_multiproof(
+        std::vector<uint64_t> keys) const {
+        flush();
+        return reader().membership_multiproof(std::move(keys));
+    }
+
+    /* Same format as Csmt::range_proof */
+    [[nodiscard]] std::optional<range_proof_t> range_proof(uint64_t first, uint64_t last) const {
+        flush();
+        return reader().range_proof(first, last);
+    }
+
+    [[nodiscard]] const_iterator begin() const {
+        return reader().begin();
+    }
+
+    [[nodiscard]] const_iterator end() const {
+        return reader().end();
+    }
+
+    [[nodiscard]] const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    [[nodiscard]] const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    /* First leaf with key not less than given one */
+    [[nodiscard]] const_iterator lower_bound(uint64_t key) const {
+        return reader().lower_bound(key);
+    }
+
+    /* First leaf with key greater than given one */
+    [[nodiscard]] const_iterator successor(uint64_t key) const {
+        return reader().successor(key);
+    }
+
+    /* Last leaf with key less than given one */
+    [[nodiscard]] const_iterator predecessor(uint64_t key) const {
+        return reader().predecessor(key);
+    }
+
+    /* Calls fn(blob) for each leaf with key in [first, last], in key order */
+    template <typename Fn>
+    void for_each_in_range(uint64_t first, uint64_t last, Fn fn) const {
+        reader().for_each_in_range(first, last, std::move(fn));
+    }
+
+    /* Same as Csmt::set_lazy */
+    void set_lazy(bool lazy) {
+        if (!lazy) {
+            commit();
+        }
+        lazy_ = lazy;
+    }
+
+    [[nodiscard]] bool is_lazy() const {
+        return lazy_;
+    }
+
+    void commit() {
+        flush();
+    }
+};
+
+#endif // CSMT_SLOT_CSMT_H
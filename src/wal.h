@@ -0,0 +1,436 @@
+#ifndef CSMT_WAL_H
+#define CSMT_WAL_H
+
+#include "csmt_snapshot.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * Append-only log of inserts and erases with group commit.
+ *
+ * Records get consecutive log sequence numbers (lsn) and are buffered by
+ * append(). sync(lsn) returns once the record is on disk: the first waiting
+ * thread writes the whole buffer and syncs the file, the ones arriving
+ * meanwhile wait and are covered by the next sync together, so concurrent
+ * writers share one fsync.
+ *
+ * Log is a directory of segments named by their first lsn. rotate() starts
+ * a new segment, truncate(lsn) removes segments with records up to lsn only,
+ * e.g. once a checkpoint covers them.
+ *
+ * append_batch() buffers several records at once behind a BATCH record with
+ * their count. Recovery replays a batch only if all of its records are intact.
+ *
+ * Opening replays records after given lsn. Broken tail of the last segment
+ * (torn by a crash) is cut off, damage anywhere else throws. After a failed
+ * write or sync the log refuses further appends.
+ */
+class WriteAheadLog {
+public:
+    // BATCH records are not replayed, their key is the number of records in the batch
+    enum class kind_t : uint8_t { INSERT = 1, ERASE = 2, BATCH = 3 };
+
+    struct record_t {
+        uint64_t lsn_;
+        kind_t kind_;
+        uint64_t key_;
+        std::string_view value_; // valid during replay callback only
+    };
+
+    // record for append_batch, value is copied
+    struct entry_t {
+        kind_t kind_;
+        uint64_t key_;
+        const char *value_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // buffered bytes written out without sync when writers do not sync each record
+    static constexpr size_t FLUSH_BYTES = 1 << 20;
+
+private:
+    // checksum covers the header after it and the value
+    struct header_t {
+        uint64_t checksum_;
+        uint64_t lsn_;
+        uint64_t key_;
+        uint32_t size_;
+        uint8_t kind_;
+        uint8_t padding_[3];
+    };
+
+    static_assert(sizeof(header_t) == 32, "unexpected padding");
+
+    struct segment_t {
+        uint64_t first_lsn_;
+        std::string path_;
+    };
+
+    using file_ptr = std::unique_ptr<std::FILE, int (*)(std::FILE *)>;
+
+    const std::string dir_;
+    std::vector<segment_t> segments_;
+    file_ptr file_{nullptr, &std::fclose};
+    std::string buffer_;
+    uint64_t last_lsn_ = 0;
+    uint64_t durable_lsn_ = 0;
+    uint64_t syncs_ = 0;
+    bool syncing_ = false;
+    bool failed_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable synced_;
+
+    static uint64_t record_checksum(const header_t &header, const char *value) {
+        uint64_t sum = file_utils::checksum_bytes(reinterpret_cast<const char *>(&header) + 8,
+                                                  sizeof(header_t) - 8);
+        return file_utils::checksum_bytes(value, header.size_, sum);
+    }
+
+    std::string segment_path(uint64_t first_lsn) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "wal-%016llx.log", (unsigned long long)first_lsn);
+        return (std::filesystem::path(dir_) / name).string();
+    }
+
+    static std::string read_file(const std::string &path) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw std::runtime_error("failed to open " + path);
+        }
+        return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    // header of an intact record with given lsn at pos of data
+    static bool read_record(const std::string &data, size_t pos, uint64_t lsn,
+                            header_t &header) {
+        if (pos + sizeof(header_t) > data.size()) {
+            return false;
+        }
+        std::memcpy(&header, data.data() + pos, sizeof(header_t));
+        return header.size_ <= data.size() - pos - sizeof(header_t) && header.lsn_ == lsn &&
+               record_checksum(header, data.data() + pos + sizeof(header_t)) == header.checksum_;
+    }
+
+    // whether all records of the batch with given header at pos follow it intact
+    static bool batch_complete(const std::string &data, size_t pos, const header_t &batch) {
+        pos += sizeof(header_t) + batch.size_;
+        header_t header;
+        for (uint64_t idx = 1; idx <= batch.key_; ++idx) {
+            if (!read_record(data, pos, batch.lsn_ + idx, header)) {
+                return false;
+            }
+            pos += sizeof(header_t) + header.size_;
+        }
+        return true;
+    }
+
+    static void write_out(std::FILE *file, const std::string &data) {
+        if (!data.empty() && std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+            throw std::runtime_error("failed to write log");
+        }
+    }
+
+    void open_segment(uint64_t first_lsn) {
+        std::string path = segment_path(first_lsn);
+        file_.reset(std::fopen(path.c_str(), "ab"));
+        if (!file_) {
+            throw std::runtime_error("failed to create " + path);
+        }
+        if (segments_.empty() || segments_.back().path_ != path) {
+            segments_.push_back({first_lsn, path});
+            file_utils::sync_directory(dir_);
+        }
+    }
+
+    // writes buffer out and syncs, caller holds mutex and no sync is running
+    void sync_locked() {
+        try {
+            write_out(file_.get(), buffer_);
+            file_utils::sync_file(file_.get());
+        } catch (...) {
+            failed_ = true;
+            throw;
+        }
+        buffer_.clear();
+        durable_lsn_ = last_lsn_;
+        ++syncs_;
+    }
+
+    /*
+     * Scans segments in order, calls replay for records after after_lsn and
+     * cuts broken tail of the last segment.
+     */
+    template <typename Fn>
+    void recover(uint64_t after_lsn, Fn &replay) {
+        std::filesystem::create_directories(dir_);
+        for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() != 24 || name.compare(0, 4, "wal-") != 0 ||
+                name.compare(20, 4, ".log") != 0) {
+                continue;
+            }
+            std::string digits = name.substr(4, 16);
+            if (digits.find_first_not_of("0123456789abcdef") == std::string::npos) {
+                segments_.push_back({std::stoull(digits, nullptr, 16), entry.path().string()});
+            }
+        }
+        std::sort(segments_.begin(), segments_.end(),
+                  [](const segment_t &lhs, const segment_t &rhs) {
+                      return lhs.first_lsn_ < rhs.first_lsn_;
+                  });
+
+        last_lsn_ = after_lsn;
+        uint64_t next_lsn = 0; // lsn following the last segment
+        for (size_t idx = 0; idx < segments_.size(); ++idx) {
+            const segment_t &segment = segments_[idx];
+            std::string data = read_file(segment.path_);
+            uint64_t expected = segment.first_lsn_;
+            size_t pos = 0;
+            header_t header;
+            while (read_record(data, pos, expected, header)) {
+                if (kind_t(header.kind_) == kind_t::BATCH && !batch_complete(data, pos, header)) {
+                    break;
+                }
+                if (header.lsn_ > last_lsn_) {
+                    if (header.lsn_ != last_lsn_ + 1) {
+                        throw std::runtime_error("log has a gap before lsn " +
+                                                 std::to_string(header.lsn_));
+                    }
+                    if (kind_t(header.kind_) != kind_t::BATCH) {
+                        const char *value = data.data() + pos + sizeof(header_t);
+                        replay(record_t{header.lsn_, kind_t(header.kind_), header.key_,
+                                        std::string_view(value, header.size_)});
+                    }
+                    last_lsn_ = header.lsn_;
+                }
+                ++expected;
+                pos += sizeof(header_t) + header.size_;
+            }
+            if (pos != data.size()) {
+                if (idx + 1 != segments_.size()) {
+                    throw std::runtime_error("log segment is damaged: " + segment.path_);
+                }
+                std::filesystem::resize_file(segment.path_, pos);
+            }
+            next_lsn = expected;
+        }
+        durable_lsn_ = last_lsn_;
+
+        // continue the last segment if it ends right before the next record
+        if (!segments_.empty() && next_lsn == last_lsn_ + 1) {
+            open_segment(segments_.back().first_lsn_);
+        } else {
+            open_segment(last_lsn_ + 1);
+        }
+    }
+
+    // appends record with given lsn to buffer_, caller holds mutex
+    void buffer_record(uint64_t lsn, kind_t kind, uint64_t key, const char *value, size_t size) {
+        header_t header{};
+        header.lsn_ = lsn;
+        header.key_ = key;
+        header.size_ = uint32_t(size);
+        header.kind_ = uint8_t(kind);
+        header.checksum_ = record_checksum(header, value);
+        buffer_.append(reinterpret_cast<const char *>(&header), sizeof(header_t));
+        if (size) {
+            buffer_.append(value, size);
+        }
+    }
+
+    // writes out a full buffer unless a sync will, caller holds mutex
+    void flush_full() {
+        if (buffer_.size() >= FLUSH_BYTES && !syncing_) {
+            try {
+                write_out(file_.get(), buffer_);
+            } catch (...) {
+                failed_ = true;
+                throw;
+            }
+            buffer_.clear();
+        }
+    }
+
+public:
+    /* Opens log in dir, calls replay(record) for each record after after_lsn */
+    template <typename Fn>
+    WriteAheadLog(std::string dir, uint64_t after_lsn, Fn replay)
+        : dir_(std::move(dir)) {
+        recover(after_lsn, replay);
+    }
+
+    explicit WriteAheadLog(std::string dir)
+        : WriteAheadLog(std::move(dir), 0, [](const record_t &) {}) {
+    }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    ~WriteAheadLog() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!failed_ && !buffer_.empty()) {
+            try {
+                write_out(file_.get(), buffer_);
+            } catch (...) {
+                // records were never reported durable
+            }
+        }
+    }
+
+    /* Buffers record and returns its lsn, it is durable after sync(lsn) */
+    uint64_t append(kind_t kind, uint64_t key, const char *value = nullptr, size_t size = 0) {
+        if (size > UINT32_MAX) {
+            throw std::length_error("log record is too large");
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            throw std::runtime_error("log failed to write earlier");
+        }
+        buffer_record(last_lsn_ + 1, kind, key, value, size);
+        ++last_lsn_;
+        flush_full();
+        return last_lsn_;
+    }
+
+    /*
+     * Buffers entries as one batch and returns lsn of the last one. Nothing
+     * is buffered if it throws. Empty batch is not logged.
+     */
+    uint64_t append_batch(const std::vector<entry_t> &entries) {
+        for (const entry_t &entry : entries) {
+            if (entry.size_ > UINT32_MAX) {
+                throw std::length_error("log record is too large");
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            throw std::runtime_error("log failed to write earlier");
+        }
+        if (entries.empty()) {
+            return last_lsn_;
+        }
+        size_t mark = buffer_.size();
+        uint64_t lsn = last_lsn_ + 1;
+        try {
+            buffer_record(lsn, kind_t::BATCH, entries.size(), nullptr, 0);
+            for (const entry_t &entry : entries) {
+                buffer_record(++lsn, entry.kind_, entry.key_, entry.value_, entry.size_);
+            }
+        } catch (...) {
+            buffer_.resize(mark);
+            throw;
+        }
+        last_lsn_ = lsn;
+        flush_full();
+        return last_lsn_;
+    }
+
+    /* Waits until records up to lsn are on disk, joining a running sync if any */
+    void sync(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (durable_lsn_ < lsn) {
+            if (failed_) {
+                throw std::runtime_error("log failed to write earlier");
+            }
+            if (syncing_) {
+                synced_.wait(lock);
+                continue;
+            }
+            syncing_ = true;
+            std::string batch;
+            batch.swap(buffer_);
+            uint64_t upto = last_lsn_;
+            std::FILE *file = file_.get(); // rotate() waits for this sync
+            lock.unlock();
+            try {
+                write_out(file, batch);
+                file_utils::sync_file(file);
+            } catch (...) {
+                lock.lock();
+                failed_ = true;
+                syncing_ = false;
+                synced_.notify_all();
+                throw;
+            }
+            lock.lock();
+            durable_lsn_ = upto;
+            ++syncs_;
+            syncing_ = false;
+            synced_.notify_all();
+        }
+    }
+
+    /* Syncs everything appended so far */
+    void sync() {
+        sync(last_lsn());
+    }
+
+    /*
+     * Syncs current segment and starts a new one with the next record.
+     * Returns the last lsn in the old segments.
+     */
+    uint64_t rotate() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        synced_.wait(lock, [this] { return !syncing_; });
+        if (failed_) {
+            throw std::runtime_error("log failed to write earlier");
+        }
+        sync_locked();
+        synced_.notify_all();
+        if (segments_.back().first_lsn_ != last_lsn_ + 1) {
+            open_segment(last_lsn_ + 1);
+        }
+        return last_lsn_;
+    }
+
+    /* Removes segments that hold records up to lsn only */
+    void truncate(uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t removed = 0;
+        while (removed + 1 < segments_.size() && segments_[removed + 1].first_lsn_ <= lsn + 1) {
+            std::filesystem::remove(segments_[removed].path_);
+            ++removed;
+        }
+        if (removed) {
+            segments_.erase(segments_.begin(), segments_.begin() + ptrdiff_t(removed));
+            file_utils::sync_directory(dir_);
+        }
+    }
+
+    [[nodiscard]] uint64_t last_lsn() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_lsn_;
+    }
+
+    [[nodiscard]] uint64_t durable_lsn() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return durable_lsn_;
+    }
+
+    /* Number of file syncs done, one per group commit */
+    [[nodiscard]] uint64_t syncs() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return syncs_;
+    }
+
+    [[nodiscard]] size_t segments() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return segments_.size();
+    }
+};
+
+#endif // CSMT_WAL_H
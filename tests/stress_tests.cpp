@@ -1,12 +1,24 @@
+#include "benchmark/hash_policy.h"
 #include "contrib/gtest/gtest.h"
+#include "src/concurrent_csmt.h"
 #include "src/csmt.h"
+#include "src/durable_csmt.h"
+#include "src/sharded_csmt.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <filesystem>
 #include <functional>
 #include <random>
+#include <set>
+#include <thread>
 #include <unordered_set>
 
+// proofs commit to keys, so forged keys are caught, see has_bind_key
+using KeyedCsmt = Csmt<HashPolicySHA256TreeKeyed>;
+
 TEST(stress, spam_insert) {
     constexpr size_t OPERATIONS = 10000;
 
@@ -86,6 +98,456 @@ TEST(stress, spam_membership_proof) {
     }
 }
 
+TEST(stress, spam_compact_proof) {
+    constexpr size_t OPERATIONS = 10000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    KeyedCsmt tree;
+    std::unordered_set<uint64_t> keys;
+
+    for (size_t iter = 0; iter < OPERATIONS; iter++) {
+        uint64_t key = key_gen(generator);
+        keys.insert(key);
+        tree.insert(key, value_gen(key));
+    }
+
+    std::string root = tree.membership_proof(*keys.begin()).back();
+    for (uint64_t key : keys) {
+        auto proof = tree.compact_proof(key);
+        ASSERT_TRUE(proof.has_value());
+        ASSERT_EQ(2 * proof->siblings_.size() + 1, tree.membership_proof(key).size());
+        ASSERT_TRUE(KeyedCsmt::verify_compact_proof(key, value_gen(key), *proof, root));
+        ASSERT_FALSE(KeyedCsmt::verify_compact_proof(key, value_gen(key + 1), *proof, root));
+        ASSERT_FALSE(KeyedCsmt::verify_compact_proof(key + 1, value_gen(key), *proof, root));
+    }
+    ASSERT_FALSE(tree.compact_proof(key_gen(generator)).has_value());
+}
+
+TEST(stress, non_membership_proof) {
+    constexpr size_t KEYS = 10000;
+    constexpr size_t QUERIES = 10000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+
+    KeyedCsmt tree;
+    std::set<uint64_t> keys;
+    for (size_t iter = 0; iter < KEYS; iter++) {
+        uint64_t key = key_gen(generator);
+        keys.insert(key);
+        tree.insert(key, "VALUE" + std::to_string(key));
+    }
+    std::string root = tree.root_hash();
+
+    for (size_t iter = 0; iter < QUERIES; iter++) {
+        uint64_t key = key_gen(generator);
+        auto proof = tree.non_membership_proof(key);
+        auto upper = keys.lower_bound(key);
+        if (upper != keys.end() && *upper == key) {
+            ASSERT_FALSE(proof.has_value());
+            continue;
+        }
+        ASSERT_TRUE(proof.has_value());
+        ASSERT_EQ(proof->upper_.has_value(), upper != keys.end());
+        ASSERT_EQ(proof->lower_.has_value(), upper != keys.begin());
+        if (proof->upper_) {
+            ASSERT_EQ(proof->upper_->key_, *upper);
+        }
+        if (proof->lower_) {
+            ASSERT_EQ(proof->lower_->key_, *std::prev(upper));
+        }
+        ASSERT_TRUE(KeyedCsmt::verify_non_membership(key, *proof, root));
+
+        // neighbour moved closer to key no longer matches its leaf
+        auto forged = *proof;
+        auto &neighbour = (forged.lower_ ? forged.lower_ : forged.upper_);
+        neighbour->key_ += (forged.lower_ ? 1 : -1);
+        if (neighbour->key_ != key) {
+            ASSERT_FALSE(KeyedCsmt::verify_non_membership(key, forged, root));
+        }
+    }
+    ASSERT_FALSE(tree.non_membership_proof(*keys.begin()).has_value());
+}
+
+TEST(stress, multiproof) {
+    constexpr size_t KEYS = 10000;
+    constexpr size_t PROVEN = 1000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    KeyedCsmt tree;
+    std::vector<uint64_t> keys;
+    for (size_t iter = 0; iter < KEYS; iter++) {
+        keys.push_back(key_gen(generator));
+        tree.insert(keys.back(), value_gen(keys.back()));
+    }
+    std::string root = tree.root_hash();
+
+    std::shuffle(keys.begin(), keys.end(), generator);
+    std::vector<uint64_t> proven(keys.begin(), keys.begin() + PROVEN);
+    auto proof = tree.membership_multiproof(proven);
+    ASSERT_TRUE(proof.has_value());
+
+    std::sort(proven.begin(), proven.end());
+    std::vector<std::string> values;
+    size_t single_hashes = 0;
+    for (uint64_t key : proven) {
+        values.push_back(value_gen(key));
+        single_hashes += tree.compact_proof(key)->siblings_.size();
+    }
+    ASSERT_TRUE(KeyedCsmt::verify_multiproof(proven, values, *proof, root));
+    ASSERT_LT(proof->hashes_.size(), single_hashes);
+
+    // leaves are bound to keys, so values can not be claimed for other keys
+    std::vector<uint64_t> shifted = proven;
+    shifted.back() += 1;
+    ASSERT_FALSE(KeyedCsmt::verify_multiproof(shifted, values, *proof, root));
+
+    values.back() += "X";
+    ASSERT_FALSE(KeyedCsmt::verify_multiproof(proven, values, *proof, root));
+}
+
+TEST(stress, verify_many) {
+    using tree_t = Csmt<HashPolicySHA256TreeKeyed>;
+
+    constexpr size_t KEYS = 5000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    for (size_t i = 0; i < KEYS; i++) {
+        uint64_t key = key_gen(generator);
+        items.emplace_back(key, value_gen(key));
+    }
+    tree_t tree = tree_t::build(items);
+    std::string root = tree.root_hash();
+
+    std::vector<tree_t::proof_t> proofs;
+    std::vector<tree_t::proof_ref_t> refs;
+    for (const auto &[key, value] : items) {
+        proofs.push_back(tree.membership_proof(key));
+    }
+    // every tenth value is forged, as is every tenth key
+    std::vector<std::string> values;
+    for (size_t i = 0; i < KEYS; i++) {
+        values.push_back(i % 10 == 0 ? value_gen(i) : items[i].second);
+    }
+    for (size_t i = 0; i < KEYS; i++) {
+        refs.push_back({items[i].first + (i % 10 == 5), &values[i], &proofs[i]});
+    }
+
+    ThreadPool pool(4);
+    std::unique_ptr<bool[]> results(new bool[KEYS]);
+    for (ThreadPool *threads : {(ThreadPool *)nullptr, &pool}) {
+        ASSERT_FALSE(tree_t::verify_many(refs.data(), KEYS, root, results.get(), threads));
+        for (size_t i = 0; i < KEYS; i++) {
+            ASSERT_EQ(results[i], tree_t::verify(refs[i].key_, values[i], proofs[i], root));
+            ASSERT_EQ(results[i], i % 5 != 0);
+        }
+    }
+    ASSERT_TRUE(tree_t::verify_many(refs.data() + 1, 4, root, nullptr, &pool));
+}
+
+TEST(stress, concurrent_readers) {
+    constexpr size_t KEYS = 2000;
+    constexpr size_t READERS = 4;
+    constexpr size_t WRITES = 20000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    // even keys are stable, writer churns odd ones
+    ConcurrentCsmt<> tree;
+    for (uint64_t key = 0; key < KEYS; key += 2) {
+        tree.insert(key, value_gen(key));
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> readers;
+    for (size_t reader = 0; reader < READERS; ++reader) {
+        readers.emplace_back([&, seed = generator()] {
+            std::mt19937 reader_generator(seed);
+            std::uniform_int_distribution<uint64_t> key_gen(0, KEYS / 2 - 1);
+            while (!done.load()) {
+                uint64_t key = 2 * key_gen(reader_generator);
+                auto proof = tree.membership_proof(key);
+                if (proof.empty() ||
+                    !Csmt<>::verify(key, value_gen(key), proof, proof.back())) {
+                    ++failures;
+                }
+            }
+        });
+    }
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, KEYS / 2 - 1);
+    for (size_t iter = 0; iter < WRITES; ++iter) {
+        uint64_t key = 2 * key_gen(generator) + 1;
+        if (iter % 3 == 0) {
+            tree.erase(key);
+        } else {
+            tree.insert(key, value_gen(iter));
+        }
+    }
+    done.store(true);
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(failures.load(), 0u);
+}
+
+TEST(stress, sharded_writers) {
+    constexpr size_t WRITERS = 4;
+    constexpr size_t KEYS_PER_WRITER = 5000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::vector<uint64_t>> keys(WRITERS);
+    Csmt<> expected;
+    for (auto &writer_keys : keys) {
+        for (size_t i = 0; i < KEYS_PER_WRITER; ++i) {
+            writer_keys.push_back((uint64_t(generator()) << 32u) | generator());
+            expected.insert(writer_keys.back(), value_gen(writer_keys.back()));
+        }
+    }
+
+    ShardedCsmt<> tree(4);
+    std::vector<std::thread> writers;
+    for (const auto &writer_keys : keys) {
+        writers.emplace_back([&tree, &writer_keys, &value_gen] {
+            for (uint64_t key : writer_keys) {
+                tree.insert(key, value_gen(key));
+                tree.insert(key + 1, value_gen(key));
+                tree.erase(key + 1);
+            }
+        });
+    }
+    for (std::thread &writer : writers) {
+        writer.join();
+    }
+
+    ASSERT_EQ(tree.size(), expected.size());
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+}
+
+TEST(stress, durable_writers) {
+    constexpr size_t WRITERS = 4;
+    constexpr size_t KEYS_PER_WRITER = 500;
+
+    using tree_t = DurableCsmt<HashPolicySHA256Tree>;
+    std::string dir = (std::filesystem::temp_directory_path() / "csmt_stress_durable").string();
+    std::filesystem::remove_all(dir);
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::vector<uint64_t>> keys(WRITERS);
+    Csmt<HashPolicySHA256Tree> expected;
+    for (auto &writer_keys : keys) {
+        for (size_t i = 0; i < KEYS_PER_WRITER; ++i) {
+            writer_keys.push_back((uint64_t(generator()) << 32u) | generator());
+            expected.insert(writer_keys.back(), value_gen(writer_keys.back()));
+        }
+    }
+
+    {
+        tree_t::options_t options;
+        options.checkpoint_every_ = 700;
+        tree_t tree(dir, options);
+        std::vector<std::thread> writers;
+        for (const auto &writer_keys : keys) {
+            writers.emplace_back([&tree, &writer_keys, &value_gen] {
+                for (uint64_t key : writer_keys) {
+                    tree.insert(key, value_gen(key));
+                    tree.insert(key + 1, value_gen(key));
+                    tree.erase(key + 1);
+                }
+            });
+        }
+        for (std::thread &writer : writers) {
+            writer.join();
+        }
+        tree.sync();
+
+        ASSERT_EQ(tree.lsn(), 3 * WRITERS * KEYS_PER_WRITER);
+        ASSERT_EQ(tree.durable_lsn(), tree.lsn());
+        ASSERT_LE(tree.log().syncs(), tree.lsn());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    }
+
+    tree_t tree(dir);
+    ASSERT_EQ(tree.lsn(), 3 * WRITERS * KEYS_PER_WRITER);
+    ASSERT_EQ(tree.size(), expected.size());
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    std::filesystem::remove_all(dir);
+}
+
+TEST(stress, ordered_iteration) {
+    constexpr size_t KEYS = 5000;
+    constexpr size_t QUERIES = 2000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    // keys in a narrow range as well, so that queries hit neighbours
+    auto key_gen = [&generator]() -> uint64_t {
+        uint64_t key = (uint64_t(generator()) << 32u) | generator();
+        return (generator() % 2 ? key : key % 100000);
+    };
+
+    Csmt<> tree;
+    std::set<uint64_t> expected;
+    for (size_t i = 0; i < KEYS; ++i) {
+        uint64_t key = key_gen();
+        tree.insert(key, std::to_string(key));
+        expected.insert(key);
+        if (i % 4 == 0) {
+            uint64_t erased = key_gen();
+            tree.erase(erased);
+            expected.erase(erased);
+        }
+    }
+
+    std::vector<uint64_t> keys;
+    for (const auto &blob : tree) {
+        keys.push_back(blob.key_);
+    }
+    ASSERT_EQ(keys, std::vector<uint64_t>(expected.begin(), expected.end()));
+    keys.clear();
+    for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+        keys.push_back(it->key_);
+    }
+    ASSERT_EQ(keys, std::vector<uint64_t>(expected.rbegin(), expected.rend()));
+
+    for (size_t i = 0; i < QUERIES; ++i) {
+        uint64_t key = (i % 2 ? *std::next(expected.begin(), generator() % expected.size()) : key_gen());
+
+        auto bound = tree.lower_bound(key);
+        auto expected_bound = expected.lower_bound(key);
+        ASSERT_EQ(bound == tree.end(), expected_bound == expected.end());
+        if (bound != tree.end()) {
+            ASSERT_EQ(bound->key_, *expected_bound);
+        }
+
+        auto next = tree.successor(key);
+        auto expected_next = expected.upper_bound(key);
+        ASSERT_EQ(next == tree.end(), expected_next == expected.end());
+        if (next != tree.end()) {
+            ASSERT_EQ(next->key_, *expected_next);
+        }
+
+        auto prev = tree.predecessor(key);
+        ASSERT_EQ(prev == tree.end(), expected_bound == expected.begin());
+        if (prev != tree.end()) {
+            ASSERT_EQ(prev->key_, *std::prev(expected_bound));
+        }
+
+        uint64_t last = key + generator() % (i % 3 ? 1000 : 1000000);
+        last = std::max(last, key);
+        keys.clear();
+        tree.for_each_in_range(key, last, [&keys](const Csmt<>::Blob &blob) {
+            keys.push_back(blob.key_);
+        });
+        ASSERT_EQ(keys, std::vector<uint64_t>(expected.lower_bound(key), expected.upper_bound(last)));
+    }
+}
+
+TEST(stress, range_proof) {
+    constexpr size_t KEYS = 5000;
+    constexpr size_t QUERIES = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    auto key_gen = [&generator]() -> uint64_t {
+        uint64_t key = (uint64_t(generator()) << 32u) | generator();
+        return (generator() % 2 ? key : key % 100000);
+    };
+
+    KeyedCsmt tree;
+    std::set<uint64_t> expected;
+    for (size_t i = 0; i < KEYS; ++i) {
+        uint64_t key = key_gen();
+        tree.insert(key, std::to_string(key));
+        expected.insert(key);
+    }
+    std::string root = tree.root_hash();
+
+    for (size_t i = 0; i < QUERIES; ++i) {
+        uint64_t first = key_gen();
+        uint64_t last = std::max(first, first + generator() % (i % 3 ? 1000 : 1000000));
+        auto proof = tree.range_proof(first, last);
+        ASSERT_TRUE(proof.has_value());
+        ASSERT_TRUE(KeyedCsmt::verify_range_proof(first, last, *proof, root));
+
+        std::vector<uint64_t> keys;
+        for (uint64_t key : proof->keys_) {
+            if (key >= first && key <= last) {
+                keys.push_back(key);
+            }
+        }
+        ASSERT_EQ(keys, std::vector<uint64_t>(expected.lower_bound(first), expected.upper_bound(last)));
+        ASSERT_LE(proof->subtree_.hashes_.size(), 2 * 64u);
+
+        // leaf claimed for other key must fail
+        if (!keys.empty()) {
+            auto relabelled = *proof;
+            relabelled.keys_[generator() % relabelled.keys_.size()] ^= 1;
+            ASSERT_FALSE(KeyedCsmt::verify_range_proof(first, last, relabelled, root));
+        }
+
+        // proof without one of the keys in range must fail
+        if (!keys.empty()) {
+            uint64_t dropped = keys[generator() % keys.size()];
+            KeyedCsmt::range_proof_t forged;
+            for (size_t idx = 0; idx < proof->keys_.size(); ++idx) {
+                if (proof->keys_[idx] != dropped) {
+                    forged.keys_.push_back(proof->keys_[idx]);
+                    forged.leaves_.push_back(proof->leaves_[idx]);
+                }
+            }
+            if (!forged.keys_.empty()) {
+                forged.subtree_ = *tree.membership_multiproof(forged.keys_);
+            }
+            ASSERT_FALSE(KeyedCsmt::verify_range_proof(first, last, forged, root));
+        }
+    }
+}
+
 TEST(stress, comeback) {
     constexpr size_t KEYS = 6000;
 
@@ -1,20 +1,36 @@
 #include "benchmark/hash_policy.h"
 #include "contrib/gtest/gtest.h"
+#include "src/concurrent_csmt.h"
 #include "src/csmt.h"
+#include "src/csmt_snapshot.h"
+#include "src/csmt_view.h"
+#include "src/indexed_csmt.h"
+#include "src/paged_csmt.h"
+#include "src/persistent_csmt.h"
+#include "src/sharded_csmt.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <optional>
 #include <random>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
-class CsmtStructuralWrapper : public Csmt<HashPolicySHA256Tree> {
+template <typename HashPolicy>
+class CsmtStructuralWrapperOf : public Csmt<HashPolicy> {
 public:
     using tree_line = std::pair<size_t, std::string>;
 
+    using Csmt<HashPolicy>::Csmt;
+
 private:
-    static bool check_structure(std::unique_ptr<Node> const &tree,
+    using Node = typename Csmt<HashPolicy>::Node;
+
+    static bool check_structure(Node const *tree,
                                 std::vector<tree_line> const &repr, size_t &line) {
         if (line >= repr.size()) {
             return false;
@@ -33,8 +49,8 @@ private:
     }
 
     static bool check_same_structure(
-            std::unique_ptr<Node> const &tree1,
-            std::unique_ptr<Node> const &tree2
+            Node const *tree1,
+            Node const *tree2
     ) {
         if (tree1->is_leaf()) {
             if (!tree2->is_leaf()) {
@@ -51,7 +67,7 @@ private:
         }
     }
 
-    static size_t count_memory(std::unique_ptr<Node> const &tree) {
+    static size_t count_memory(Node const *tree) {
         size_t count = 1;
         if (!tree->is_leaf()) {
             count += count_memory(tree->left_);
@@ -63,19 +79,111 @@ private:
 public:
     bool check_structure(std::vector<tree_line> const &representation) {
         size_t line = 0;
-        return check_structure(root_, representation, line);
+        return check_structure(this->root_, representation, line);
     }
 
-    static bool check_same_structure(CsmtStructuralWrapper const &tree1, CsmtStructuralWrapper const &tree2) {
+    static bool check_same_structure(CsmtStructuralWrapperOf const &tree1, CsmtStructuralWrapperOf const &tree2) {
         return check_same_structure(tree1.root_, tree2.root_);
     }
 
-    static size_t count_memory(CsmtStructuralWrapper const &tree) {
+    static size_t count_memory(CsmtStructuralWrapperOf const &tree) {
         return count_memory(tree.root_);
     }
 
+    const void *root_address() const {
+        return this->root_;
+    }
+
 };
 
+using CsmtStructuralWrapper = CsmtStructuralWrapperOf<HashPolicySHA256Tree>;
+
+// every read of tree, proofs and iteration included, matches the same read of expected
+template <typename Tree, typename Expected>
+void expect_same_reads(const Tree &tree, const Expected &expected,
+                       const std::vector<uint64_t> &probes) {
+    ASSERT_EQ(tree.size(), expected.size());
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> expected_keys;
+    for (const auto &blob : tree) {
+        keys.push_back(blob.key_);
+    }
+    for (const auto &blob : expected) {
+        expected_keys.push_back(blob.key_);
+    }
+    ASSERT_EQ(keys, expected_keys);
+    if (!keys.empty()) {
+        ASSERT_EQ(tree.rbegin()->key_, expected.rbegin()->key_);
+    }
+
+    auto key_of = [](const auto &it, const auto &end) {
+        return (it == end ? std::optional<uint64_t>() : std::optional<uint64_t>(it->key_));
+    };
+    for (uint64_t key : probes) {
+        ASSERT_EQ(tree.contains(key), expected.contains(key));
+        ASSERT_EQ(tree.membership_proof(key), expected.membership_proof(key));
+        auto compact = tree.compact_proof(key);
+        auto expected_compact = expected.compact_proof(key);
+        ASSERT_EQ(compact.has_value(), expected_compact.has_value());
+        if (compact) {
+            ASSERT_EQ(compact->siblings_, expected_compact->siblings_);
+            ASSERT_EQ(compact->directions_, expected_compact->directions_);
+        }
+
+        auto absent = tree.non_membership_proof(key);
+        auto expected_absent = expected.non_membership_proof(key);
+        ASSERT_EQ(absent.has_value(), expected_absent.has_value());
+        if (absent) {
+            for (auto side : {&decltype(absent)::value_type::lower_,
+                              &decltype(absent)::value_type::upper_}) {
+                const auto &neighbour = (*absent).*side;
+                const auto &expected_neighbour = (*expected_absent).*side;
+                ASSERT_EQ(neighbour.has_value(), expected_neighbour.has_value());
+                if (neighbour) {
+                    ASSERT_EQ(neighbour->key_, expected_neighbour->key_);
+                    ASSERT_EQ(neighbour->hash_, expected_neighbour->hash_);
+                    ASSERT_EQ(neighbour->proof_.siblings_, expected_neighbour->proof_.siblings_);
+                }
+            }
+        }
+
+        ASSERT_EQ(key_of(tree.lower_bound(key), tree.end()),
+                  key_of(expected.lower_bound(key), expected.end()));
+        ASSERT_EQ(key_of(tree.successor(key), tree.end()),
+                  key_of(expected.successor(key), expected.end()));
+        ASSERT_EQ(key_of(tree.predecessor(key), tree.end()),
+                  key_of(expected.predecessor(key), expected.end()));
+    }
+
+    if (probes.size() >= 2) {
+        uint64_t first = std::min(probes[0], probes[1]);
+        uint64_t last = std::max(probes[0], probes[1]);
+        auto range = tree.range_proof(first, last);
+        auto expected_range = expected.range_proof(first, last);
+        ASSERT_EQ(range->keys_, expected_range->keys_);
+        ASSERT_EQ(range->leaves_, expected_range->leaves_);
+        ASSERT_EQ(range->subtree_.shape_, expected_range->subtree_.shape_);
+        ASSERT_EQ(range->subtree_.hashes_, expected_range->subtree_.hashes_);
+    }
+
+    std::vector<uint64_t> present;
+    for (uint64_t key : probes) {
+        if (expected.contains(key)) {
+            present.push_back(key);
+        }
+    }
+    auto multi = tree.membership_multiproof(present);
+    auto expected_multi = expected.membership_multiproof(present);
+    ASSERT_EQ(multi.has_value(), expected_multi.has_value());
+    if (multi) {
+        ASSERT_EQ(multi->shape_, expected_multi->shape_);
+        ASSERT_EQ(multi->proven_, expected_multi->proven_);
+        ASSERT_EQ(multi->hashes_, expected_multi->hashes_);
+    }
+}
+
 TEST(structural, history_independence_three) {
     std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
         return "VALUE" + std::to_string(key_index);
@@ -126,6 +234,622 @@ TEST(structural, history_independence_large) {
     }
 }
 
+TEST(structural, build_same_as_insert) {
+    constexpr size_t SIZE = 10000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    for (size_t i = 0; i < SIZE; i++) {
+        uint64_t key = (i % 2 ? key_gen(generator) : i);
+        items.emplace_back(key, value_gen(key));
+    }
+
+    CsmtStructuralWrapper expected;
+    for (const auto &[key, value] : items) {
+        expected.insert(key, value);
+    }
+
+    std::sort(items.begin(), items.end());
+    CsmtStructuralWrapper tree(items.begin(), items.end());
+
+    ASSERT_EQ(tree.size(), expected.size());
+    ASSERT_EQ(CsmtStructuralWrapper::count_memory(tree), 2 * SIZE - 1);
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+    for (size_t i = 0; i < SIZE; i += 100) {
+        ASSERT_EQ(tree.membership_proof(items[i].first), expected.membership_proof(items[i].first));
+    }
+}
+
+TEST(structural, build_unsorted_last_wins) {
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::pair<uint64_t, std::string>> items{
+            {5, value_gen(5)}, {1, value_gen(1)}, {5, value_gen(6)},
+            {3, value_gen(3)}, {1, value_gen(2)}, {0, value_gen(0)},
+    };
+
+    CsmtStructuralWrapper expected;
+    for (const auto &[key, value] : items) {
+        expected.insert(key, value);
+    }
+    CsmtStructuralWrapper tree(items.begin(), items.end());
+
+    ASSERT_EQ(tree.size(), 4u);
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+
+    auto built = Csmt<HashPolicySHA256Tree>::build(items);
+    ASSERT_EQ(built.root_hash(), expected.root_hash());
+
+    CsmtStructuralWrapper empty(items.end(), items.end());
+    ASSERT_EQ(empty.size(), 0u);
+    ASSERT_TRUE(empty.root_hash().empty());
+}
+
+TEST(structural, apply_batch_same_as_loop) {
+    using op_t = CsmtStructuralWrapper::op_t;
+
+    constexpr size_t SIZE = 2000;
+    constexpr size_t BATCHES = 20;
+    constexpr size_t BATCH_SIZE = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    // narrow key range, so batches hit existing keys and share ancestors
+    std::uniform_int_distribution<uint64_t> key_gen(0, 4 * SIZE);
+    std::uniform_int_distribution<int> kind_gen(0, 2);
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    CsmtStructuralWrapper tree;
+    CsmtStructuralWrapper expected;
+    for (size_t i = 0; i < SIZE; i++) {
+        uint64_t key = key_gen(generator);
+        tree.insert(key, value_gen(key));
+        expected.insert(key, value_gen(key));
+    }
+
+    for (size_t batch = 0; batch < BATCHES; batch++) {
+        std::vector<op_t> ops;
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            uint64_t key = key_gen(generator);
+            if (kind_gen(generator) == 0) {
+                ops.push_back(op_t::erase(key));
+                expected.erase(key);
+            } else {
+                ops.push_back(op_t::insert(key, value_gen(key + batch)));
+                expected.insert(key, value_gen(key + batch));
+            }
+        }
+        tree.apply_batch(ops);
+
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+        ASSERT_EQ(CsmtStructuralWrapper::count_memory(tree), 2 * tree.size() - 1);
+    }
+}
+
+TEST(structural, lazy_same_as_eager) {
+    using op_t = CsmtStructuralWrapper::op_t;
+
+    constexpr size_t ROUNDS = 20;
+    constexpr size_t OPERATIONS = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, 5000);
+    std::uniform_int_distribution<int> kind_gen(0, 3);
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    CsmtStructuralWrapper tree;
+    CsmtStructuralWrapper expected;
+    tree.set_lazy(true);
+
+    for (size_t round = 0; round < ROUNDS; round++) {
+        std::vector<op_t> ops;
+        for (size_t i = 0; i < OPERATIONS; i++) {
+            uint64_t key = key_gen(generator);
+            switch (kind_gen(generator)) {
+            case 0:
+                tree.erase(key);
+                expected.erase(key);
+                break;
+            case 1:
+                ops.push_back(op_t::insert(key, value_gen(key + round)));
+                break;
+            default:
+                tree.insert(key, value_gen(key + round));
+                expected.insert(key, value_gen(key + round));
+            }
+        }
+        tree.apply_batch(ops);
+        expected.apply_batch(ops);
+
+        uint64_t key = key_gen(generator);
+        ASSERT_EQ(tree.membership_proof(key), expected.membership_proof(key));
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+    }
+}
+
+TEST(structural, parallel_same_as_sequential) {
+    using op_t = CsmtStructuralWrapper::op_t;
+
+    constexpr size_t SIZE = 20000;
+    constexpr size_t THREADS = 4;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::vector<std::pair<uint64_t, std::string>> items;
+    for (size_t i = 0; i < SIZE; i++) {
+        uint64_t key = key_gen(generator);
+        items.emplace_back(key, value_gen(key));
+    }
+
+    CsmtStructuralWrapper expected(items.begin(), items.end());
+    CsmtStructuralWrapper tree(items.begin(), items.end(), {}, THREADS);
+    ASSERT_EQ(tree.get_threads(), THREADS);
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+
+    std::vector<op_t> ops;
+    for (size_t i = 0; i < SIZE; i += 2) {
+        ops.push_back(op_t::insert(items[i].first, value_gen(i)));
+        ops.push_back(op_t::erase(items[i + 1].first));
+        ops.push_back(op_t::insert(key_gen(generator), value_gen(i)));
+    }
+    expected.apply_batch(ops);
+    tree.apply_batch(ops);
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+
+    tree.set_lazy(true);
+    for (size_t i = 0; i < SIZE; i += 3) {
+        tree.insert(items[i].first, value_gen(i + 1));
+        expected.insert(items[i].first, value_gen(i + 1));
+    }
+    tree.commit();
+    ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+}
+
+TEST(structural, persistent_same_as_csmt) {
+    using persistent_t = PersistentCsmt<HashPolicySHA256Tree>;
+
+    constexpr size_t ROUNDS = 20;
+    constexpr size_t OPERATIONS = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, 5000);
+    std::uniform_int_distribution<int> kind_gen(0, 2);
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    persistent_t tree;
+    CsmtStructuralWrapper expected;
+    std::vector<persistent_t::Snapshot> snapshots;
+    std::vector<uint64_t> versions;
+    std::vector<std::pair<uint64_t, CsmtStructuralWrapper::proof_t>> proofs;
+
+    for (size_t round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < OPERATIONS; i++) {
+            uint64_t key = key_gen(generator);
+            if (kind_gen(generator) == 0) {
+                tree.erase(key);
+                expected.erase(key);
+            } else {
+                tree.insert(key, value_gen(key + round));
+                expected.insert(key, value_gen(key + round));
+            }
+        }
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+
+        uint64_t key = key_gen(generator);
+        ASSERT_EQ(tree.membership_proof(key), expected.membership_proof(key));
+        snapshots.push_back(tree.snapshot());
+        versions.push_back(tree.version());
+        proofs.emplace_back(key, expected.membership_proof(key));
+    }
+
+    // old versions are untouched by later mutations
+    for (size_t round = 0; round < ROUNDS; round++) {
+        uint64_t key = proofs[round].first;
+        ASSERT_EQ(snapshots[round].membership_proof(key), proofs[round].second);
+        ASSERT_EQ(tree.snapshot(versions[round])->membership_proof(key), proofs[round].second);
+    }
+
+    tree.prune(versions.back());
+    ASSERT_EQ(tree.versions(), 1 + tree.version() - versions.back());
+    ASSERT_FALSE(tree.snapshot(versions.front()).has_value());
+    ASSERT_EQ(snapshots.front().membership_proof(proofs.front().first), proofs.front().second);
+
+    // batches build the same tree as Csmt::apply_batch
+    using op_t = persistent_t::op_t;
+    for (size_t round = 0; round < ROUNDS; round++) {
+        std::vector<op_t> ops;
+        for (size_t i = 0; i < OPERATIONS; i++) {
+            uint64_t key = key_gen(generator);
+            if (kind_gen(generator) == 0) {
+                ops.push_back(op_t::erase(key));
+            } else {
+                ops.push_back(op_t::insert(key, value_gen(key + round)));
+            }
+        }
+        tree.apply_batch(ops);
+        expected.apply_batch(ops);
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        uint64_t key = key_gen(generator);
+        ASSERT_EQ(tree.membership_proof(key), expected.membership_proof(key));
+    }
+}
+
+TEST(structural, sharded_same_as_csmt) {
+    using op_t = CsmtStructuralWrapper::op_t;
+
+    constexpr size_t SIZE = 5000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    for (size_t shard_bits : {0, 1, 3, 8}) {
+        ShardedCsmt<HashPolicySHA256Tree> tree(shard_bits);
+        tree.set_threads(3);
+        CsmtStructuralWrapper expected;
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+
+        std::vector<op_t> ops;
+        std::vector<uint64_t> keys;
+        for (size_t i = 0; i < SIZE; i++) {
+            // every other key lands into one shard
+            uint64_t key = (i % 2 ? key_gen(generator) : key_gen(generator) >> 10u);
+            keys.push_back(key);
+            if (i % 5 == 0) {
+                ops.push_back(op_t::insert(key, value_gen(i)));
+            } else {
+                tree.insert(key, value_gen(i));
+                expected.insert(key, value_gen(i));
+            }
+        }
+        for (size_t i = 0; i < SIZE; i += 7) {
+            ops.push_back(op_t::erase(keys[i]));
+        }
+        tree.apply_batch(ops);
+        expected.apply_batch(ops);
+
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        for (size_t i = 0; i < SIZE; i += 13) {
+            ASSERT_EQ(tree.membership_proof(keys[i]), expected.membership_proof(keys[i]));
+        }
+    }
+}
+
+TEST(structural, indexed_same_as_csmt) {
+    using indexed_t = IndexedCsmt<HashPolicySHA256Tree>;
+    using op_t = indexed_t::op_t;
+
+    constexpr size_t ROUNDS = 20;
+    constexpr size_t OPERATIONS = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, 5000);
+    std::uniform_int_distribution<int> kind_gen(0, 2);
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    indexed_t tree;
+    CsmtStructuralWrapper expected;
+    for (size_t round = 0; round < ROUNDS; round++) {
+        // single ops, batches and lazy rounds in turn
+        bool batch = round % 3 == 1;
+        tree.set_lazy(round % 3 == 2);
+        expected.set_lazy(round % 3 == 2);
+        std::vector<op_t> ops;
+        for (size_t i = 0; i < OPERATIONS; i++) {
+            uint64_t key = key_gen(generator);
+            if (kind_gen(generator) == 0) {
+                ops.push_back(op_t::erase(key));
+            } else {
+                ops.push_back(op_t::insert(key, value_gen(key + round)));
+            }
+        }
+        if (batch) {
+            tree.apply_batch(ops);
+            expected.apply_batch(ops);
+        } else {
+            for (const op_t &op : ops) {
+                if (op.kind_ == op_t::kind_t::ERASE) {
+                    tree.erase(op.key_);
+                    expected.erase(op.key_);
+                } else {
+                    tree.insert(op.key_, op.value_);
+                    expected.insert(op.key_, op.value_);
+                }
+            }
+        }
+        // erased slots are reused
+        ASSERT_LE(tree.capacity(), 2 * 5001u);
+
+        std::vector<uint64_t> probes;
+        for (size_t i = 0; i < 20; i++) {
+            probes.push_back(key_gen(generator));
+        }
+        ASSERT_NO_FATAL_FAILURE(expect_same_reads(tree, expected, probes));
+    }
+}
+
+TEST(structural, frozen_view_same_as_csmt) {
+    constexpr size_t SIZE = 20000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    CsmtStructuralWrapper tree;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < SIZE; i++) {
+        // half of keys share long prefixes to make the tree deep
+        keys.push_back(i % 2 ? key_gen(generator) : key_gen(generator) % 1024);
+        tree.insert(keys.back(), value_gen(i));
+    }
+    tree.set_lazy(true);
+    tree.erase(keys[0]);
+
+    auto view = tree.freeze();
+    ASSERT_EQ(view.size(), tree.size());
+    ASSERT_EQ(view.root_hash(), tree.root_hash());
+    for (uint64_t key : keys) {
+        ASSERT_EQ(view.contains(key), tree.contains(key));
+        ASSERT_EQ(view.contains(key + 1), tree.contains(key + 1));
+        ASSERT_EQ(view.membership_proof(key), tree.membership_proof(key));
+    }
+    for (size_t i = 0; i < SIZE; i += 101) {
+        auto absent = view.non_membership_proof(keys[i] + 1);
+        auto expected_absent = tree.non_membership_proof(keys[i] + 1);
+        ASSERT_EQ(absent.has_value(), expected_absent.has_value());
+        if (absent) {
+            ASSERT_EQ(absent->lower_.has_value(), expected_absent->lower_.has_value());
+            ASSERT_EQ(absent->upper_.has_value(), expected_absent->upper_.has_value());
+            if (absent->lower_) {
+                ASSERT_EQ(absent->lower_->key_, expected_absent->lower_->key_);
+                ASSERT_EQ(absent->lower_->proof_.siblings_, expected_absent->lower_->proof_.siblings_);
+            }
+        }
+        auto range = view.range_proof(keys[i], keys[i] + (uint64_t(1) << 50u));
+        auto expected_range = tree.range_proof(keys[i], keys[i] + (uint64_t(1) << 50u));
+        ASSERT_EQ(range->keys_, expected_range->keys_);
+        ASSERT_EQ(range->subtree_.hashes_, expected_range->subtree_.hashes_);
+        auto multiproof = view.membership_multiproof({keys[i], keys[i + 1]});
+        auto expected_multiproof = tree.membership_multiproof({keys[i], keys[i + 1]});
+        ASSERT_EQ(multiproof.has_value(), expected_multiproof.has_value());
+        if (multiproof) {
+            ASSERT_EQ(multiproof->hashes_, expected_multiproof->hashes_);
+        }
+    }
+
+    std::string root = tree.root_hash();
+    CsmtStructuralWrapper::proof_t proof = tree.membership_proof(keys[1]);
+    for (size_t i = 1; i < SIZE; i += 2) {
+        tree.erase(keys[i]);
+    }
+    ASSERT_EQ(view.root_hash(), root);
+    ASSERT_EQ(view.membership_proof(keys[1]), proof);
+}
+
+TEST(structural, snapshot_file_same_as_csmt) {
+    constexpr size_t SIZE = 20000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    CsmtStructuralWrapper tree;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < SIZE; i++) {
+        keys.push_back(i % 2 ? key_gen(generator) : key_gen(generator) % 1024);
+        tree.insert(keys.back(), value_gen(i));
+    }
+    tree.erase(keys[0]);
+
+    using snapshot_t = CsmtSnapshot<HashPolicySHA256Tree>;
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_structural.snap").string();
+    snapshot_t::write(tree, path, SIZE);
+    snapshot_t snapshot = snapshot_t::open(path, true);
+    std::remove(path.c_str()); // mapping outlives the name
+
+    ASSERT_EQ(snapshot.lsn(), SIZE);
+    ASSERT_EQ(snapshot.size(), tree.size());
+    ASSERT_EQ(snapshot.root_hash(), tree.root_hash());
+    for (uint64_t key : keys) {
+        ASSERT_EQ(snapshot.contains(key), tree.contains(key));
+        ASSERT_EQ(snapshot.contains(key + 1), tree.contains(key + 1));
+        ASSERT_EQ(snapshot.membership_proof(key), tree.membership_proof(key));
+    }
+}
+
+TEST(structural, paged_same_as_csmt) {
+    constexpr size_t SIZE = 20000;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    std::uniform_int_distribution<uint64_t> key_gen(0, std::numeric_limits<uint64_t>::max());
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_structural.pages").string();
+    std::remove(path.c_str());
+    CsmtStructuralWrapper tree;
+    PagedCsmt<HashPolicySHA256Tree> paged_tree(path, 16);
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < SIZE; i++) {
+        keys.push_back(i % 2 ? key_gen(generator) : key_gen(generator) % 1024);
+        tree.insert(keys.back(), value_gen(i));
+        paged_tree.insert(keys.back(), value_gen(i));
+        if (i % 3 == 0) {
+            tree.erase(keys[i / 2]);
+            paged_tree.erase(keys[i / 2]);
+        }
+    }
+
+    ASSERT_EQ(paged_tree.size(), tree.size());
+    ASSERT_EQ(paged_tree.root_hash(), tree.root_hash());
+    for (uint64_t key : keys) {
+        ASSERT_EQ(paged_tree.contains(key), tree.contains(key));
+        ASSERT_EQ(paged_tree.contains(key + 1), tree.contains(key + 1));
+        ASSERT_EQ(paged_tree.membership_proof(key), tree.membership_proof(key));
+    }
+
+    // batch in lazy mode, stale hashes are committed by the first proof
+    using op_t = CsmtStructuralWrapper::op_t;
+    std::vector<op_t> ops;
+    for (size_t i = 0; i < SIZE; i += 5) {
+        ops.push_back(i % 2 ? op_t::erase(keys[i]) : op_t::insert(keys[i] + 1, value_gen(i)));
+    }
+    tree.set_lazy(true);
+    paged_tree.set_lazy(true);
+    tree.apply_batch(ops);
+    paged_tree.apply_batch(ops);
+    std::vector<uint64_t> probes;
+    for (size_t i = 0; i < SIZE; i += 499) {
+        probes.push_back(keys[i]);
+        probes.push_back(keys[i] + 1);
+    }
+    ASSERT_NO_FATAL_FAILURE(expect_same_reads(paged_tree, tree, probes));
+    std::remove(path.c_str());
+}
+
+TEST(structural, keyed_storages_same_as_csmt) {
+    using policy_t = HashPolicySHA256TreeKeyed;
+    using tree_t = Csmt<policy_t>;
+    using op_t = tree_t::op_t;
+
+    constexpr size_t ROUNDS = 6;
+    constexpr size_t OPERATIONS = 500;
+
+    std::random_device random_device;
+    std::mt19937 generator(random_device());
+
+    // small key space, so most inserts update leaves in place
+    std::uniform_int_distribution<uint64_t> key_gen(0, 1000);
+    std::uniform_int_distribution<int> kind_gen(0, 2);
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_keyed.pages").string();
+    std::remove(path.c_str());
+    tree_t expected;
+    IndexedCsmt<policy_t> indexed;
+    PagedCsmt<policy_t> paged(path, 16);
+    PersistentCsmt<policy_t> persistent;
+    ConcurrentCsmt<policy_t> concurrent;
+    for (size_t round = 0; round < ROUNDS; round++) {
+        std::vector<op_t> ops;
+        for (size_t i = 0; i < OPERATIONS; i++) {
+            uint64_t key = key_gen(generator);
+            if (kind_gen(generator) == 0) {
+                ops.push_back(op_t::erase(key));
+            } else {
+                ops.push_back(op_t::insert(key, value_gen(key + round)));
+            }
+        }
+        if (round % 2) {
+            expected.apply_batch(ops);
+            indexed.apply_batch(ops);
+            paged.apply_batch(ops);
+            persistent.apply_batch(ops);
+        }
+        for (const op_t &op : ops) {
+            if (op.kind_ == op_t::kind_t::ERASE) {
+                concurrent.erase(op.key_);
+            } else {
+                concurrent.insert(op.key_, op.value_);
+            }
+            if (round % 2) {
+                continue;
+            }
+            if (op.kind_ == op_t::kind_t::ERASE) {
+                expected.erase(op.key_);
+                indexed.erase(op.key_);
+                paged.erase(op.key_);
+                persistent.erase(op.key_);
+            } else {
+                expected.insert(op.key_, op.value_);
+                indexed.insert(op.key_, op.value_);
+                paged.insert(op.key_, op.value_);
+                persistent.insert(op.key_, op.value_);
+            }
+        }
+
+        std::string root = expected.root_hash();
+        ASSERT_EQ(persistent.root_hash(), root);
+        ASSERT_EQ(concurrent.root_hash(), root);
+        std::vector<uint64_t> probes;
+        for (size_t i = 0; i < 20; i++) {
+            probes.push_back(key_gen(generator));
+        }
+        ASSERT_NO_FATAL_FAILURE(expect_same_reads(indexed, expected, probes));
+        ASSERT_NO_FATAL_FAILURE(expect_same_reads(paged, expected, probes));
+
+        // neighbour and range proofs carry leaf hashes, verifiers bind them to keys
+        auto view = expected.freeze();
+        for (uint64_t key : probes) {
+            ASSERT_EQ(view.membership_proof(key), expected.membership_proof(key));
+            auto absent = view.non_membership_proof(key);
+            ASSERT_EQ(absent.has_value(), !expected.contains(key));
+            ASSERT_TRUE(!absent || tree_t::verify_non_membership(key, *absent, root));
+            auto range = view.range_proof(key, key + 50);
+            ASSERT_EQ(range->leaves_, expected.range_proof(key, key + 50)->leaves_);
+            ASSERT_TRUE(tree_t::verify_range_proof(key, key + 50, *range, root));
+        }
+    }
+    std::remove(path.c_str());
+}
+
 TEST(structural, full_structure_3_left) {
     std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
         return "VALUE" + std::to_string(key_index);
@@ -166,6 +890,45 @@ TEST(structural, full_structure_3_right) {
     }));
 }
 
+TEST(structural, full_structure_3_keyed) {
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+    using keyed_tree = CsmtStructuralWrapperOf<HashPolicySHA256TreeKeyed>;
+
+    // leaves keep leaf hashes, parents merge them bound to their keys
+    keyed_tree tree_left;
+    tree_left.insert(0, value_gen(0));
+    tree_left.insert(1, value_gen(1));
+    tree_left.insert(2, value_gen(2));
+
+    ASSERT_TRUE(tree_left.check_structure(std::vector<keyed_tree::tree_line>{
+            {0, "f20f3d4e3548dbd1776646a463b03d079d856a9bd4dbc181041debd4da6275d2"},
+            {1, "6a403d3e67258fa131647258bfd03c3b5ae09318e7a1eac421354a263ca8e9a6"},
+            {2, "94691a6dca8d9b3529a9ba48bd482eace32358548c0dfab12bfa5f860a1d627d"},
+            {2, "36b78f882885cf09ea371be0c69e23567382e4a3ca797899f0400e72b14d0028"},
+            {1, "8f1a5e72cf5cec1f94cda9cc8e66cd0a5b0dd64a8188dd1067a4fb28a776e39b"}
+    }));
+
+    keyed_tree tree_right;
+    tree_right.insert(1, value_gen(1));
+    tree_right.insert(2, value_gen(2));
+    tree_right.insert(3, value_gen(3));
+
+    ASSERT_TRUE(tree_right.check_structure(std::vector<keyed_tree::tree_line>{
+            {0, "85a2ce3f550b675823b4a3789be49cf0066c028207338b7e6717a1cf34aa7d37"},
+            {1, "36b78f882885cf09ea371be0c69e23567382e4a3ca797899f0400e72b14d0028"},
+            {1, "3c1fb30c16a684fd2a7f6c29cac6fdb09d4865ad637151f30dd480d762c325b2"},
+            {2, "8f1a5e72cf5cec1f94cda9cc8e66cd0a5b0dd64a8188dd1067a4fb28a776e39b"},
+            {2, "bc1008460b1fde744c529491bc1eb56a312f59cb3b1756e923d6355c6afee8fc"}
+    }));
+
+    // proofs hold for their keys only
+    keyed_tree::proof_t proof = tree_left.membership_proof(1);
+    ASSERT_TRUE(keyed_tree::verify(1, value_gen(1), proof, tree_left.root_hash()));
+    ASSERT_FALSE(keyed_tree::verify(3, value_gen(1), proof, tree_left.root_hash()));
+}
+
 TEST(structural, full_structure_large) {
     std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
         return "VALUE" + std::to_string(key_index);
@@ -233,3 +996,33 @@ TEST(structural, low_memory_check) {
         }
     }
 }
+
+TEST(structural, in_place_update) {
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return "VALUE" + std::to_string(key_index);
+    };
+
+    CsmtStructuralWrapper tree;
+    CsmtStructuralWrapper expected;
+
+    for (uint64_t key = 0; key < 100; ++key) {
+        tree.insert(key, value_gen(key));
+        expected.insert(key, value_gen(key + 1));
+    }
+
+    const void *root = tree.root_address();
+    size_t nodes = CsmtStructuralWrapper::count_memory(tree);
+
+    for (uint64_t key = 0; key < 100; ++key) {
+        tree.insert(key, value_gen(key + 1));
+        ASSERT_EQ(tree.root_address(), root);
+    }
+    ASSERT_EQ(CsmtStructuralWrapper::count_memory(tree), nodes);
+    ASSERT_TRUE(CsmtStructuralWrapper::check_same_structure(tree, expected));
+
+    tree.erase(1000);
+    ASSERT_EQ(tree.root_address(), root);
+    tree.erase(50);
+    ASSERT_EQ(tree.root_address(), root);
+    ASSERT_EQ(CsmtStructuralWrapper::count_memory(tree), nodes - 2);
+}
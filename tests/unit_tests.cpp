@@ -1,9 +1,26 @@
+#include "benchmark/hash_policy.h"
 #include "contrib/crypto/sha256.h"
 #include "contrib/gtest/gtest.h"
+#include "src/concurrent_csmt.h"
 #include "src/csmt.h"
+#include "src/csmt_snapshot.h"
+#include "src/csmt_view.h"
+#include "src/durable_csmt.h"
+#include "src/indexed_csmt.h"
+#include "src/paged_csmt.h"
+#include "src/persistent_csmt.h"
+#include "src/pool_allocator.h"
+#include "src/sharded_csmt.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iterator>
+#include <stdexcept>
 
 TEST(sha256, correct) {
     std::vector<std::pair<std::string, std::string>> codes{
@@ -18,6 +35,145 @@ TEST(sha256, correct) {
     }
 }
 
+TEST(sha256, digest) {
+    std::string input = "banana";
+    SHA256::digest_t digest = SHA256::digest(input);
+
+    ASSERT_EQ(digest.size(), 32u);
+    ASSERT_EQ(digest[0], 0xb4u);
+    ASSERT_EQ(digest[31], 0x4eu);
+    ASSERT_EQ(SHA256::to_hex(digest), SHA256::hash(input));
+    ASSERT_EQ(SHA256::digest((const unsigned char *) input.data(), input.size()), digest);
+}
+
+TEST(sha256, hash_parts) {
+    std::string lhs = SHA256::hash("hello");
+    std::string rhs = SHA256::hash("world");
+    std::string long_part(300, 'x');
+
+    ASSERT_EQ(SHA256::hash_parts({"1", lhs, "2", rhs}), SHA256::hash("1" + lhs + "2" + rhs));
+    ASSERT_EQ(SHA256::hash_parts({long_part, "", long_part}),
+              SHA256::hash(long_part + long_part));
+    ASSERT_EQ(SHA256::hash_parts({}), SHA256::hash(""));
+    ASSERT_EQ(SHA256::digest_parts({lhs}), SHA256::digest(lhs));
+}
+
+TEST(sha256, backends) {
+    SHA256::backend_t initial = SHA256::get_backend();
+    ASSERT_TRUE(SHA256::is_supported(SHA256::backend_t::SCALAR));
+
+    std::vector<std::string> inputs;
+    for (size_t len : {0, 1, 55, 56, 63, 64, 65, 119, 128, 1000}) {
+        std::string input;
+        for (size_t i = 0; i < len; i++) {
+            input += (char)(i * 31 + len);
+        }
+        inputs.push_back(input);
+    }
+
+    ASSERT_TRUE(SHA256::set_backend(SHA256::backend_t::SCALAR));
+    std::vector<std::string> expected;
+    for (const std::string &input : inputs) {
+        expected.push_back(SHA256::hash(input));
+    }
+
+    for (SHA256::backend_t backend : {SHA256::backend_t::AVX2, SHA256::backend_t::SHA_NI}) {
+        if (!SHA256::set_backend(backend)) {
+            continue;
+        }
+        ASSERT_EQ(SHA256::get_backend(), backend);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            ASSERT_EQ(SHA256::hash(inputs[i]), expected[i]) << SHA256::backend_name(backend);
+        }
+    }
+    SHA256::set_backend(initial);
+}
+
+TEST(sha256, digest_many) {
+    size_t initial = SHA256::get_lanes();
+
+    std::vector<std::string> inputs;
+    for (size_t i = 0; i < 100; i++) {
+        // runs of equal lengths with some odd ones in between
+        size_t len = (i % 17 == 0 ? i : 65 + (i / 10) * 30);
+        std::string input;
+        for (size_t j = 0; j < len; j++) {
+            input += (char)(i * 7 + j);
+        }
+        inputs.push_back(input);
+    }
+    std::vector<SHA256::part_t> messages(inputs.begin(), inputs.end());
+
+    for (size_t lanes : {1, 4, 8, 16}) {
+        if (!SHA256::set_lanes(lanes)) {
+            continue;
+        }
+        std::vector<SHA256::digest_t> digests(inputs.size());
+        SHA256::digest_many(messages.data(), messages.size(), digests.data());
+        for (size_t i = 0; i < inputs.size(); i++) {
+            ASSERT_EQ(digests[i], SHA256::digest(inputs[i])) << lanes << " lanes";
+        }
+    }
+    SHA256::set_lanes(initial);
+}
+
+TEST(sha256, merge_hash_many) {
+    static_assert(has_merge_hash_many<HashPolicySHA256Digest, SHA256::digest_t>::value);
+    static_assert(has_merge_hash_many<HashPolicySHA256Tree, std::string>::value);
+    static_assert(!has_merge_hash_many<DefaultHashPolicy, std::string>::value);
+
+    std::vector<SHA256::digest_t> digests;
+    std::vector<std::string> hashes;
+    for (size_t i = 0; i < 21; i++) {
+        digests.push_back(HashPolicySHA256Digest::leaf_hash(std::to_string(i)));
+        hashes.push_back(HashPolicySHA256Tree::leaf_hash(std::to_string(i)));
+    }
+
+    std::vector<const SHA256::digest_t *> d_lhs, d_rhs;
+    std::vector<const std::string *> h_lhs, h_rhs;
+    for (size_t i = 0; i + 1 < digests.size(); i++) {
+        d_lhs.push_back(&digests[i]);
+        d_rhs.push_back(&digests[i + 1]);
+        h_lhs.push_back(&hashes[i]);
+        h_rhs.push_back(&hashes[i + 1]);
+    }
+
+    std::vector<SHA256::digest_t> d_out(d_lhs.size());
+    std::vector<std::string> h_out(h_lhs.size());
+    HashPolicySHA256Digest::merge_hash_many(d_lhs.data(), d_rhs.data(), d_out.data(),
+                                            d_out.size());
+    HashPolicySHA256Tree::merge_hash_many(h_lhs.data(), h_rhs.data(), h_out.data(),
+                                          h_out.size());
+
+    for (size_t i = 0; i < d_out.size(); i++) {
+        ASSERT_EQ(d_out[i], HashPolicySHA256Digest::merge_hash(digests[i], digests[i + 1]));
+        ASSERT_EQ(h_out[i], HashPolicySHA256Tree::merge_hash(hashes[i], hashes[i + 1]));
+    }
+}
+
+TEST(sha256, digest_policy) {
+    SHA256::digest_t lhs = HashPolicySHA256Digest::leaf_hash("hello");
+    SHA256::digest_t rhs = HashPolicySHA256Digest::leaf_hash("world");
+
+    ASSERT_EQ(lhs, SHA256::digest(std::string(1, '\0') + "hello"));
+
+    std::string concat = "\1";
+    concat.append(lhs.begin(), lhs.end());
+    concat.append(rhs.begin(), rhs.end());
+    ASSERT_EQ(HashPolicySHA256Digest::merge_hash(lhs, rhs), SHA256::digest(concat));
+
+    std::string bound = "\2";
+    bound.append("\0\0\0\0\0\0\1\2", 8); // key in big-endian order
+    bound.append(lhs.begin(), lhs.end());
+    ASSERT_EQ(HashPolicySHA256Digest::bind_key(0x0102, lhs), SHA256::digest(bound));
+
+    // bind_key is optional, trees without it see leaves by leaf hash
+    static_assert(has_bind_key<HashPolicySHA256Digest, SHA256::digest_t>::value);
+    static_assert(has_bind_key<HashPolicySHA256TreeKeyed, std::string>::value);
+    static_assert(!has_bind_key<HashPolicySHA256Tree, std::string>::value);
+    static_assert(!Csmt<>::BINDS_KEYS);
+}
+
 TEST(log, correct) {
     // implementation from csmt private function
     std::function<uint64_t(uint64_t)> log_impl = [](uint64_t num) {
@@ -168,3 +324,790 @@ TEST(basic, binary_tree_proof) {
     ASSERT_TRUE(look_for_key(tree, 5, {"4", "5", "45", "67", "0123", "4567", "01234567"}));
     ASSERT_TRUE(look_for_key(tree, 6, {"6", "7", "45", "67", "0123", "4567", "01234567"}));
 }
+
+TEST(basic, apply_batch) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+    using op_t = tree_t::op_t;
+
+    tree_t tree;
+    for (uint64_t key_index = 0; key_index < 4; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+
+    tree.apply_batch(std::vector<op_t>{
+            op_t::insert(6, "6"), op_t::erase(1), op_t::insert(3, "x"),
+            op_t::erase(9), op_t::insert(5, "y"), op_t::insert(5, "5"),
+    });
+
+    ASSERT_EQ(tree.size(), 5u);
+    ASSERT_TRUE(look_for_key(tree, 1));
+    ASSERT_TRUE(look_for_key(tree, 0, {"0", "2x", "02x", "56", "02x56"}));
+    ASSERT_TRUE(look_for_key(tree, 5, {"5", "6", "02x", "56", "02x56"}));
+
+    tree.apply_batch(std::vector<op_t>{op_t::erase(0), op_t::erase(2), op_t::erase(3),
+                                       op_t::erase(5), op_t::erase(6)});
+    ASSERT_EQ(tree.size(), 0u);
+    ASSERT_TRUE(look_for_key(tree, 6));
+}
+
+struct CountingHashPolicy : IdentityHashPolicy {
+    inline static size_t merges = 0;
+
+    static std::string merge_hash(const std::string &lhs, const std::string &rhs) {
+        ++merges;
+        return IdentityHashPolicy::merge_hash(lhs, rhs);
+    }
+};
+
+TEST(basic, lazy) {
+    Csmt<CountingHashPolicy> tree;
+    tree.set_lazy(true);
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+    ASSERT_EQ(CountingHashPolicy::merges, 0u);
+    ASSERT_EQ(tree.root_hash(), "01234567");
+    ASSERT_EQ(CountingHashPolicy::merges, 7u);
+
+    for (size_t iter = 0; iter < 10; ++iter) {
+        tree.insert(5, std::to_string(iter));
+    }
+    tree.erase(7);
+    ASSERT_EQ(CountingHashPolicy::merges, 7u);
+    ASSERT_TRUE(look_for_key(tree, 5, {"4", "9", "49", "6", "0123", "496", "0123496"}));
+    ASSERT_EQ(CountingHashPolicy::merges, 10u);
+
+    tree.insert(7, "7");
+    tree.set_lazy(false);
+    ASSERT_EQ(CountingHashPolicy::merges, 13u);
+    tree.insert(5, "5");
+    ASSERT_EQ(CountingHashPolicy::merges, 16u);
+    ASSERT_EQ(tree.root_hash(), "01234567");
+}
+
+TEST(basic, verify) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    tree.insert(0, "0");
+    ASSERT_TRUE(tree_t::verify(0, "0", tree.membership_proof(0), "0"));
+    ASSERT_FALSE(tree_t::verify(0, "0", {}, "0"));
+
+    for (uint64_t key_index = 1; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+    tree_t::proof_t proof = tree.membership_proof(5);
+    ASSERT_TRUE(tree_t::verify(5, "5", proof, "01234567"));
+    ASSERT_FALSE(tree_t::verify(5, "6", proof, "01234567"));
+    ASSERT_FALSE(tree_t::verify(5, "5", proof, "0123456"));
+
+    proof[3] = "76";
+    ASSERT_FALSE(tree_t::verify(5, "5", proof, "01234567"));
+    proof.pop_back();
+    ASSERT_FALSE(tree_t::verify(5, "5", proof, "01234567"));
+}
+
+TEST(basic, compact_proof) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    ASSERT_FALSE(tree.compact_proof(0).has_value());
+    tree.insert(0, "0");
+    ASSERT_TRUE(tree_t::verify_compact_proof(0, "0", *tree.compact_proof(0), "0"));
+
+    for (uint64_t key_index = 1; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+
+    auto proof = tree.compact_proof(5);
+    ASSERT_TRUE(proof.has_value());
+    ASSERT_EQ(proof->siblings_, std::vector<std::string>({"4", "67", "0123"}));
+    ASSERT_EQ(proof->directions_, 0b101u);
+    ASSERT_TRUE(tree_t::verify_compact_proof(5, "5", *proof, "01234567"));
+    ASSERT_FALSE(tree_t::verify_compact_proof(5, "4", *proof, "01234567"));
+
+    proof->directions_ ^= 0b1000u;
+    ASSERT_FALSE(tree_t::verify_compact_proof(5, "5", *proof, "01234567"));
+    ASSERT_FALSE(tree.compact_proof(8).has_value());
+}
+
+TEST(basic, non_membership_proof) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    auto empty = tree.non_membership_proof(3);
+    ASSERT_TRUE(empty.has_value());
+    ASSERT_TRUE(tree_t::verify_non_membership(3, *empty, ""));
+
+    for (uint64_t key_index : {0, 1, 2, 4, 6, 7}) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+    std::string root = tree.root_hash();
+    ASSERT_FALSE(tree.non_membership_proof(4).has_value());
+
+    auto proof = tree.non_membership_proof(5);
+    ASSERT_TRUE(proof.has_value());
+    ASSERT_EQ(proof->lower_->key_, 4u);
+    ASSERT_EQ(proof->upper_->key_, 6u);
+    ASSERT_TRUE(tree_t::verify_non_membership(5, *proof, root));
+    ASSERT_FALSE(tree_t::verify_non_membership(5, *proof, "0124"));
+    ASSERT_FALSE(tree_t::verify_non_membership(7, *proof, root));
+
+    proof = tree.non_membership_proof(3);
+    ASSERT_EQ(proof->lower_->key_, 2u);
+    ASSERT_EQ(proof->upper_->key_, 4u);
+    ASSERT_TRUE(tree_t::verify_non_membership(3, *proof, root));
+
+    // leaves 2 and 6 are both in the tree, but not neighbours
+    proof->upper_ = tree_t::neighbour_t{6, "6", *tree.compact_proof(6)};
+    ASSERT_FALSE(tree_t::verify_non_membership(3, *proof, root));
+
+    // hashes here leave keys out, but relabelled 4 and 6 do not fit their paths
+    proof->lower_ = tree_t::neighbour_t{3, "4", *tree.compact_proof(4)};
+    proof->upper_ = tree_t::neighbour_t{5, "6", *tree.compact_proof(6)};
+    ASSERT_FALSE(tree_t::verify_non_membership(4, *proof, root));
+    proof->lower_->key_ = 4;
+    proof->upper_->key_ = 6;
+    ASSERT_TRUE(tree_t::verify_non_membership(5, *proof, root));
+
+    proof = tree.non_membership_proof(100);
+    ASSERT_EQ(proof->lower_->key_, 7u);
+    ASSERT_FALSE(proof->upper_.has_value());
+    ASSERT_TRUE(tree_t::verify_non_membership(100, *proof, root));
+    proof->lower_ = tree_t::neighbour_t{6, "6", *tree.compact_proof(6)};
+    ASSERT_FALSE(tree_t::verify_non_membership(100, *proof, root));
+}
+
+TEST(basic, multiproof) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    ASSERT_FALSE(tree.membership_multiproof({0}).has_value());
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+
+    auto proof = tree.membership_multiproof({5, 1, 5});
+    ASSERT_TRUE(proof.has_value());
+    ASSERT_EQ(proof->hashes_, std::vector<std::string>({"0", "23", "4", "67"}));
+    std::vector<uint64_t> keys{1, 5};
+    std::vector<std::string> values{"1", "5"};
+    ASSERT_TRUE(tree_t::verify_multiproof(keys, values, *proof, "01234567"));
+    ASSERT_FALSE(tree_t::verify_multiproof(keys, std::vector<std::string>{"5", "1"}, *proof,
+                                           "01234567"));
+    ASSERT_FALSE(tree_t::verify_multiproof(std::vector<uint64_t>{5, 1}, values, *proof,
+                                           "01234567"));
+    ASSERT_FALSE(tree_t::verify_multiproof(std::vector<uint64_t>{1}, std::vector<std::string>{"1"},
+                                           *proof, "01234567"));
+
+    auto empty = tree.membership_multiproof({});
+    ASSERT_TRUE(empty.has_value());
+    ASSERT_EQ(empty->hashes_, std::vector<std::string>({"01234567"}));
+    ASSERT_TRUE(tree_t::verify_multiproof(std::vector<uint64_t>{}, std::vector<std::string>{},
+                                          *empty, "01234567"));
+
+    // hashes here leave keys out, but leaf 5 claimed for key 6 does not fit split bits
+    ASSERT_FALSE(tree_t::verify_multiproof(std::vector<uint64_t>{1, 6}, values, *proof,
+                                           "01234567"));
+
+    proof->shape_.push_back(false);
+    ASSERT_FALSE(tree_t::verify_multiproof(keys, values, *proof, "01234567"));
+    ASSERT_FALSE(tree.membership_multiproof({1, 8}).has_value());
+}
+
+TEST(basic, range_proof) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    ASSERT_FALSE(tree.range_proof(5, 2).has_value());
+    auto empty = tree.range_proof(0, 10);
+    ASSERT_TRUE(empty.has_value());
+    ASSERT_TRUE(tree_t::verify_range_proof(0, 10, *empty, ""));
+    ASSERT_FALSE(tree_t::verify_range_proof(0, 10, *empty, "0"));
+
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+
+    auto proof = tree.range_proof(2, 5);
+    ASSERT_TRUE(proof.has_value());
+    ASSERT_EQ(proof->keys_, std::vector<uint64_t>({1, 2, 3, 4, 5, 6}));
+    ASSERT_EQ(proof->subtree_.hashes_, std::vector<std::string>({"0", "7"}));
+    ASSERT_TRUE(tree_t::verify_range_proof(2, 5, *proof, "01234567"));
+    // 6 would be in range, but leaves after it are not proven
+    ASSERT_FALSE(tree_t::verify_range_proof(2, 6, *proof, "01234567"));
+    // leaves 4, 5 and 6 relabelled to hide key 4 do not fit split bits
+    tree_t::range_proof_t relabelled = *proof;
+    relabelled.keys_ = {1, 2, 3, 5, 6, 7};
+    ASSERT_FALSE(tree_t::verify_range_proof(2, 6, relabelled, "01234567"));
+
+    auto whole = tree.range_proof(0, 100);
+    ASSERT_EQ(whole->keys_.size(), 8u);
+    ASSERT_TRUE(whole->subtree_.hashes_.empty());
+    ASSERT_TRUE(tree_t::verify_range_proof(0, 100, *whole, "01234567"));
+
+    // leaf 3 left out is a sibling hash between proven leaves
+    tree_t::range_proof_t gap{{1, 2, 4, 5, 6}, {"1", "2", "4", "5", "6"},
+                              *tree.membership_multiproof({1, 2, 4, 5, 6})};
+    ASSERT_FALSE(tree_t::verify_range_proof(2, 5, gap, "01234567"));
+    // leaf 7 left out while there is no upper neighbour
+    tree_t::range_proof_t tail{{6}, {"6"}, *tree.membership_multiproof({6})};
+    ASSERT_FALSE(tree_t::verify_range_proof(6, 100, tail, "01234567"));
+
+    proof->leaves_[2] = "X";
+    ASSERT_FALSE(tree_t::verify_range_proof(2, 5, *proof, "01234567"));
+}
+
+TEST(basic, persistent) {
+    using tree_t = PersistentCsmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    tree.insert(2, "hello");
+    tree.insert(3, "world");
+    tree_t::Snapshot before = tree.snapshot();
+    ASSERT_EQ(tree.version(), 2u);
+
+    tree.erase(2);
+    tree.insert(3, "again");
+    ASSERT_EQ(tree.size(), 1u);
+    ASSERT_EQ(tree.root_hash(), "again");
+
+    ASSERT_EQ(before.size(), 2u);
+    ASSERT_TRUE(before.contains(2));
+    ASSERT_EQ(before.membership_proof(2), tree_t::proof_t({"hello", "world", "helloworld"}));
+    ASSERT_TRUE(Csmt<IdentityHashPolicy>::verify_compact_proof(
+        3, "world", *before.compact_proof(3), "helloworld"));
+    ASSERT_EQ(tree.snapshot(1)->root_hash(), "hello");
+    ASSERT_EQ(tree.snapshot(0)->size(), 0u);
+    ASSERT_FALSE(tree.snapshot(5).has_value());
+
+    tree.prune(3);
+    ASSERT_EQ(tree.versions(), 2u);
+    ASSERT_FALSE(tree.snapshot(2).has_value());
+    ASSERT_EQ(before.root_hash(), "helloworld");
+
+    // one version per batch, the last op on a key wins
+    using op_t = tree_t::op_t;
+    tree.apply_batch(std::vector<op_t>{op_t::insert(5, "y"), op_t::erase(3), op_t::insert(1, "x"),
+                                       op_t::insert(5, "z"), op_t::erase(9)});
+    ASSERT_EQ(tree.version(), 5u);
+    ASSERT_EQ(tree.size(), 2u);
+    ASSERT_EQ(tree.root_hash(), "xz");
+    ASSERT_EQ(tree.snapshot(4)->root_hash(), "again");
+}
+
+TEST(basic, sharded) {
+    using tree_t = ShardedCsmt<IdentityHashPolicy>;
+
+    ASSERT_THROW(tree_t(tree_t::MAX_SHARD_BITS + 1), std::invalid_argument);
+
+    tree_t tree(2);
+    ASSERT_EQ(tree.shards(), 4u);
+    uint64_t high = uint64_t(3) << 62u;
+    tree.insert(2, "a");
+    tree.insert(3, "b");
+    tree.insert(high, "c");
+    ASSERT_EQ(tree.size(), 3u);
+    ASSERT_TRUE(tree.contains(high));
+    ASSERT_EQ(tree.root_hash(), "abc");
+    ASSERT_EQ(tree.membership_proof(3), tree_t::proof_t({"a", "b", "ab", "c", "abc"}));
+    ASSERT_EQ(tree.membership_proof(high), tree_t::proof_t({"ab", "c", "abc"}));
+    ASSERT_TRUE(tree.membership_proof(4).empty());
+
+    tree.erase(2);
+    tree.erase(3);
+    ASSERT_EQ(tree.membership_proof(high), tree_t::proof_t({"c"}));
+}
+
+TEST(basic, indexed) {
+    using tree_t = IndexedCsmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    tree.reserve(3);
+    tree.insert(2, "hello");
+    tree.insert(3, "world");
+    tree.insert(3, "again");
+    ASSERT_EQ(tree.size(), 2u);
+    ASSERT_EQ(tree.membership_proof(2), tree_t::proof_t({"hello", "again", "helloagain"}));
+    ASSERT_TRUE(Csmt<IdentityHashPolicy>::verify_compact_proof(
+        3, "again", *tree.compact_proof(3), "helloagain"));
+
+    tree.erase(2);
+    ASSERT_FALSE(tree.contains(2));
+    ASSERT_EQ(tree.root_hash(), "again");
+    tree.insert(6, "x");
+    tree.insert(7, "y");
+    // two freed slots are reused before storage grows
+    ASSERT_EQ(tree.capacity(), 5u);
+    ASSERT_EQ(tree.root_hash(), "againxy");
+}
+
+TEST(basic, freeze) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    ASSERT_EQ(tree.freeze().root_hash(), "");
+    ASSERT_FALSE(tree.freeze().contains(0));
+
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+    auto view = tree.freeze();
+    tree.erase(5);
+
+    ASSERT_EQ(view.size(), 8u);
+    ASSERT_TRUE(view.contains(5));
+    ASSERT_FALSE(view.contains(8));
+    ASSERT_EQ(view.root_hash(), "01234567");
+    ASSERT_EQ(view.membership_proof(5),
+              tree_t::proof_t({"4", "5", "45", "67", "0123", "4567", "01234567"}));
+    ASSERT_TRUE(tree_t::verify_compact_proof(5, "5", *view.compact_proof(5), "01234567"));
+}
+
+TEST(basic, snapshot_file) {
+    using tree_t = Csmt<HashPolicySHA256Digest, SHA256::digest_t>;
+    using snapshot_t = CsmtSnapshot<HashPolicySHA256Digest, SHA256::digest_t>;
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_unit.snap").string();
+
+    tree_t tree;
+    snapshot_t::write(tree, path);
+    snapshot_t empty = snapshot_t::open(path, true);
+    ASSERT_EQ(empty.size(), 0u);
+    ASSERT_FALSE(empty.contains(0));
+    ASSERT_EQ(empty.root_hash(), SHA256::digest_t());
+
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        tree.insert(key_index, std::to_string(key_index));
+    }
+    snapshot_t::write(tree, path, 42);
+    snapshot_t snapshot = snapshot_t::open(path, true);
+    ASSERT_EQ(snapshot.lsn(), 42u);
+    ASSERT_EQ(snapshot.size(), 8u);
+    ASSERT_TRUE(snapshot.contains(5));
+    ASSERT_FALSE(snapshot.contains(8));
+    ASSERT_EQ(snapshot.root_hash(), tree.root_hash());
+    ASSERT_EQ(snapshot.membership_proof(5), tree.membership_proof(5));
+    ASSERT_TRUE(tree_t::verify_compact_proof(5, "5", *snapshot.compact_proof(5),
+                                             tree.root_hash()));
+
+    // lazy tree is flushed before writing, frozen view gives the same file
+    auto read_file = [](const std::string &name) {
+        std::ifstream file(name, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), {});
+    };
+    std::string view_path = path + ".view";
+    tree_t lazy;
+    lazy.set_lazy(true);
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        lazy.insert(key_index, std::to_string(key_index));
+    }
+    snapshot_t::write(lazy, path, 42);
+    snapshot_t::write(tree.freeze(), view_path, 42);
+    ASSERT_EQ(read_file(path), read_file(view_path));
+
+    // so do persistent versions, restored one keeps stored hashes
+    snapshot_t::persistent_type persistent;
+    persistent.insert(9, "9");
+    for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+        persistent.insert(key_index, std::to_string(key_index));
+    }
+    persistent.erase(9);
+    snapshot_t::write(persistent.snapshot(), view_path, 42);
+    ASSERT_EQ(read_file(path), read_file(view_path));
+    snapshot_t::persistent_type restored = snapshot_t::open(view_path, true).restore();
+    ASSERT_EQ(restored.size(), 8u);
+    ASSERT_EQ(restored.version(), 1u);
+    ASSERT_EQ(restored.root_hash(), tree.root_hash());
+    ASSERT_EQ(restored.membership_proof(5), tree.membership_proof(5));
+    restored.insert(8, "8");
+    tree.insert(8, "8");
+    ASSERT_EQ(restored.root_hash(), tree.root_hash());
+    tree.erase(8);
+    std::remove(view_path.c_str());
+
+    // header has its own checksum, child links are checked on the way down
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offsetof(snapshot_t::header_t, lsn_));
+        file.put('\x01');
+    }
+    ASSERT_THROW(snapshot_t::open(path), std::runtime_error);
+    snapshot_t::write(tree, path, 42);
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(sizeof(snapshot_t::header_t) + offsetof(snapshot_t::record_t, right_));
+        file.write("\xff\xff\xff\xff", 4);
+    }
+    snapshot_t damaged = snapshot_t::open(path);
+    ASSERT_FALSE(damaged.verify());
+    ASSERT_TRUE(damaged.contains(1));
+    ASSERT_THROW((void)damaged.contains(7), std::runtime_error);
+    ASSERT_THROW((void)damaged.restore(), std::runtime_error);
+    snapshot_t::write(tree, path, 42);
+
+    // damaged byte is caught by checksum, cut file by size check
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('\xff');
+    }
+    ASSERT_FALSE(snapshot_t::open(path).verify());
+    ASSERT_THROW(snapshot_t::open(path, true), std::runtime_error);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    ASSERT_THROW(snapshot_t::open(path), std::runtime_error);
+    std::remove(path.c_str());
+    ASSERT_THROW(snapshot_t::open(path), std::runtime_error);
+
+    // hashes of different sizes do not fit fixed-size records
+    Csmt<IdentityHashPolicy> identity;
+    identity.insert(1, "a");
+    identity.insert(2, "b");
+    ASSERT_THROW(CsmtSnapshot<IdentityHashPolicy>::write(identity, path), std::invalid_argument);
+}
+
+TEST(basic, durable) {
+    using tree_t = DurableCsmt<HashPolicySHA256Digest, SHA256::digest_t>;
+    std::string dir = (std::filesystem::temp_directory_path() / "csmt_unit_durable").string();
+    std::filesystem::remove_all(dir);
+
+    Csmt<HashPolicySHA256Digest, SHA256::digest_t> expected;
+    {
+        tree_t tree(dir);
+        for (uint64_t key_index = 0; key_index < 8; ++key_index) {
+            tree.insert(key_index, std::to_string(key_index));
+            expected.insert(key_index, std::to_string(key_index));
+        }
+        tree.erase(3);
+        expected.erase(3);
+        ASSERT_EQ(tree.lsn(), 9u);
+        ASSERT_EQ(tree.durable_lsn(), 9u);
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+    }
+    {
+        // log only
+        tree_t tree(dir);
+        ASSERT_EQ(tree.lsn(), 9u);
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+
+        tree.checkpoint();
+        ASSERT_EQ(tree.checkpoint_lsn(), 9u);
+        ASSERT_EQ(tree.log().segments(), 1u);
+        tree.insert(10, "10");
+        expected.insert(10, "10");
+    }
+    {
+        // checkpoint and log tail
+        tree_t tree(dir);
+        ASSERT_EQ(tree.checkpoint_lsn(), 9u);
+        ASSERT_EQ(tree.lsn(), 10u);
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        ASSERT_EQ(tree.membership_proof(10), expected.membership_proof(10));
+    }
+
+    // torn record at the end of log is dropped
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".log" && std::filesystem::file_size(entry.path()) > 0) {
+            std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) - 1);
+        }
+    }
+    {
+        tree_t tree(dir);
+        ASSERT_EQ(tree.lsn(), 9u);
+        ASSERT_FALSE(tree.contains(10));
+        tree.insert(11, "11");
+    }
+    {
+        tree_t tree(dir);
+        ASSERT_EQ(tree.lsn(), 10u);
+        ASSERT_TRUE(tree.contains(11));
+
+        // batch record plus one per op
+        std::vector<tree_t::op_t> ops = {tree_t::op_t::insert(12, "12"),
+                                         tree_t::op_t::insert(13, "13"), tree_t::op_t::erase(11)};
+        tree.apply_batch(ops);
+        ASSERT_EQ(tree.lsn(), 14u);
+        ASSERT_FALSE(tree.contains(11));
+    }
+    {
+        tree_t tree(dir);
+        ASSERT_EQ(tree.lsn(), 14u);
+        ASSERT_TRUE(tree.contains(13));
+        ASSERT_FALSE(tree.contains(11));
+    }
+
+    // batch with a torn record is dropped whole
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".log" && std::filesystem::file_size(entry.path()) > 0) {
+            std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) - 1);
+        }
+    }
+    {
+        tree_t tree(dir);
+        ASSERT_EQ(tree.lsn(), 10u);
+        ASSERT_TRUE(tree.contains(11));
+        ASSERT_FALSE(tree.contains(12));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST(basic, paged) {
+    using tree_t = PagedCsmt<HashPolicySHA256Digest, SHA256::digest_t>;
+    std::string path = (std::filesystem::temp_directory_path() / "csmt_unit.pages").string();
+    std::remove(path.c_str());
+
+    Csmt<HashPolicySHA256Digest, SHA256::digest_t> expected;
+    {
+        // two nodes per page, two pages cached: most accesses miss
+        tree_t tree(path, 2, 128);
+        ASSERT_EQ(tree.root_hash(), SHA256::digest_t());
+        for (uint64_t key_index = 0; key_index < 64; ++key_index) {
+            tree.insert(key_index * 7, std::to_string(key_index));
+            expected.insert(key_index * 7, std::to_string(key_index));
+        }
+        for (uint64_t key_index = 0; key_index < 64; key_index += 3) {
+            tree.erase(key_index * 7);
+            expected.erase(key_index * 7);
+        }
+        ASSERT_GT(tree.cache_stats().misses_, 0u);
+        ASSERT_GT(tree.cache_stats().writebacks_, 0u);
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        ASSERT_EQ(tree.membership_proof(7), expected.membership_proof(7));
+        ASSERT_FALSE(tree.contains(0));
+
+        // freed slots are reused
+        size_t pages = tree.pages();
+        tree.insert(0, "0");
+        expected.insert(0, "0");
+        ASSERT_EQ(tree.pages(), pages);
+    }
+
+    {
+        tree_t tree(path, 4, 128);
+        ASSERT_EQ(tree.size(), expected.size());
+        ASSERT_EQ(tree.root_hash(), expected.root_hash());
+        ASSERT_TRUE(decltype(expected)::verify_compact_proof(7, "1", *tree.compact_proof(7),
+                                                             expected.root_hash()));
+        ASSERT_THROW(tree_t(path, 4, 256), std::runtime_error);
+        ASSERT_THROW(tree_t(path, 4, 32), std::invalid_argument);
+
+        // stale hashes of lazy mode are kept with links, reopened tree commits them
+        tree.set_lazy(true);
+        tree.insert(1000, "x");
+        tree.erase(7);
+        expected.insert(1000, "x");
+        expected.erase(7);
+    }
+    tree_t reopened(path, 4, 128);
+    ASSERT_EQ(reopened.root_hash(), expected.root_hash());
+    std::remove(path.c_str());
+}
+
+TEST(basic, ordered_iteration) {
+    using tree_t = Csmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    ASSERT_TRUE(tree.begin() == tree.end());
+    ASSERT_TRUE(tree.lower_bound(0) == tree.end());
+    ASSERT_TRUE(tree.predecessor(5) == tree.end());
+
+    for (uint64_t key : {8, 1, 6, 3, 12}) {
+        tree.insert(key, std::to_string(key));
+    }
+    std::vector<uint64_t> keys;
+    for (const auto &blob : tree) {
+        keys.push_back(blob.key_);
+    }
+    ASSERT_EQ(keys, std::vector<uint64_t>({1, 3, 6, 8, 12}));
+    keys.clear();
+    for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+        keys.push_back(it->key_);
+    }
+    ASSERT_EQ(keys, std::vector<uint64_t>({12, 8, 6, 3, 1}));
+    ASSERT_EQ(tree.begin()->value_, "1");
+
+    ASSERT_EQ(tree.lower_bound(0)->key_, 1u);
+    ASSERT_EQ(tree.lower_bound(6)->key_, 6u);
+    ASSERT_EQ(tree.lower_bound(7)->key_, 8u);
+    ASSERT_TRUE(tree.lower_bound(13) == tree.end());
+    ASSERT_EQ(tree.successor(6)->key_, 8u);
+    ASSERT_TRUE(tree.successor(12) == tree.end());
+    ASSERT_EQ(tree.predecessor(6)->key_, 3u);
+    ASSERT_EQ(tree.predecessor(100)->key_, 12u);
+    ASSERT_TRUE(tree.predecessor(1) == tree.end());
+    ASSERT_EQ((--tree.end())->key_, 12u);
+
+    keys.clear();
+    tree.for_each_in_range(2, 8, [&keys](const tree_t::Blob &blob) {
+        keys.push_back(blob.key_);
+    });
+    ASSERT_EQ(keys, std::vector<uint64_t>({3, 6, 8}));
+    keys.clear();
+    tree.for_each_in_range(9, 11, [&keys](const tree_t::Blob &blob) {
+        keys.push_back(blob.key_);
+    });
+    ASSERT_TRUE(keys.empty());
+}
+
+TEST(basic, digest_hash_type) {
+    Csmt<HashPolicySHA256Digest, SHA256::digest_t> tree;
+
+    tree.insert(2, "hello");
+    tree.insert(3, "world");
+
+    SHA256::digest_t lhs =
+        HashPolicySHA256Digest::bind_key(2, HashPolicySHA256Digest::leaf_hash("hello"));
+    SHA256::digest_t rhs =
+        HashPolicySHA256Digest::bind_key(3, HashPolicySHA256Digest::leaf_hash("world"));
+    SHA256::digest_t root = HashPolicySHA256Digest::merge_hash(lhs, rhs);
+
+    ASSERT_TRUE(look_for_key(tree, 2, {lhs, rhs, root}));
+    ASSERT_TRUE(look_for_key(tree, 3, {lhs, rhs, root}));
+
+    tree.erase(2);
+    ASSERT_TRUE(look_for_key(tree, 3, {rhs}));
+}
+
+TEST(threads, run_each_task_once) {
+    constexpr size_t TASKS = 1000;
+
+    ThreadPool pool(4);
+    ASSERT_EQ(pool.size(), 4u);
+
+    for (size_t round = 0; round < 10; ++round) {
+        std::vector<int> hits(TASKS, 0);
+        pool.run(TASKS, [&hits](size_t task) { ++hits[task]; });
+        ASSERT_EQ(std::count(hits.begin(), hits.end(), 1), (long)TASKS);
+    }
+
+    ASSERT_THROW(pool.run(TASKS, [](size_t task) {
+        if (task == TASKS / 2) {
+            throw std::runtime_error("task failed");
+        }
+    }), std::runtime_error);
+    pool.run(0, [](size_t) {});
+}
+
+struct Tracked {
+    inline static size_t alive = 0;
+
+    Tracked() {
+        ++alive;
+    }
+
+    ~Tracked() {
+        --alive;
+    }
+};
+
+TEST(threads, epoch_reclaim) {
+    EpochManager epochs(4);
+
+    {
+        auto guard = epochs.pin();
+        epochs.retire(new Tracked());
+        epochs.reclaim(true);
+        // reader pinned before retire may still hold it
+        ASSERT_EQ(Tracked::alive, 1u);
+        ASSERT_EQ(epochs.pending(), 1u);
+    }
+    auto late = epochs.pin();
+    epochs.retire(new Tracked());
+    epochs.reclaim(true);
+    // reader pinned after first retire can not reach it
+    ASSERT_EQ(Tracked::alive, 1u);
+    ASSERT_EQ(epochs.pending(), 1u);
+}
+
+TEST(threads, concurrent_tree) {
+    using tree_t = ConcurrentCsmt<IdentityHashPolicy>;
+
+    tree_t tree;
+    tree.insert(2, "hello");
+    tree.insert(3, "world");
+    ASSERT_EQ(tree.size(), 2u);
+    ASSERT_TRUE(tree.contains(2));
+    ASSERT_EQ(tree.membership_proof(2), tree_t::proof_t({"hello", "world", "helloworld"}));
+
+    std::string root;
+    auto proof = tree.compact_proof(3, &root);
+    ASSERT_EQ(root, "helloworld");
+    ASSERT_TRUE(Csmt<IdentityHashPolicy>::verify_compact_proof(3, "world", *proof, root));
+
+    tree.insert(3, "again");
+    tree.erase(2);
+    ASSERT_EQ(tree.size(), 1u);
+    ASSERT_FALSE(tree.contains(2));
+    ASSERT_EQ(tree.root_hash(), "again");
+
+    tree.reclaim();
+    ASSERT_EQ(tree.pending(), 0u);
+    tree.erase(3);
+    ASSERT_EQ(tree.root_hash(), "");
+}
+
+TEST(pool, same_proofs) {
+    std::function<std::string(uint64_t)> value_gen = [](uint64_t key_index) {
+        return std::to_string(key_index);
+    };
+
+    Csmt<IdentityHashPolicy> tree;
+    Csmt<IdentityHashPolicy, std::string, std::string, PoolAllocator<void>> pool_tree;
+
+    for (uint64_t key_index = 0; key_index < 64; ++key_index) {
+        tree.insert(key_index * 7, value_gen(key_index));
+        pool_tree.insert(key_index * 7, value_gen(key_index));
+    }
+    for (uint64_t key_index = 0; key_index < 64; key_index += 3) {
+        tree.erase(key_index * 7);
+        pool_tree.erase(key_index * 7);
+    }
+
+    ASSERT_EQ(tree.size(), pool_tree.size());
+    for (uint64_t key_index = 0; key_index < 64; ++key_index) {
+        ASSERT_EQ(tree.contains(key_index * 7), pool_tree.contains(key_index * 7));
+        ASSERT_EQ(tree.membership_proof(key_index * 7),
+                  pool_tree.membership_proof(key_index * 7));
+    }
+}
+
+TEST(pool, reuse_freed_nodes) {
+    PoolAllocator<void> alloc;
+    Csmt<IdentityHashPolicy, std::string, std::string, PoolAllocator<void>> tree(alloc);
+
+    for (uint64_t key = 0; key < 1000; ++key) {
+        tree.insert(key, "v");
+    }
+    size_t slabs = alloc.pool()->slabs();
+    ASSERT_GT(slabs, 0u);
+
+    for (size_t round = 0; round < 10; ++round) {
+        for (uint64_t key = 0; key < 1000; ++key) {
+            tree.erase(key);
+        }
+        ASSERT_EQ(tree.size(), 0u);
+        for (uint64_t key = 0; key < 1000; ++key) {
+            tree.insert(key, "v");
+        }
+    }
+    ASSERT_EQ(alloc.pool()->slabs(), slabs);
+}
+
+TEST(pool, unpooled_allocations) {
+    struct alignas(128) wide_t {
+        char bytes_[128];
+    };
+    PoolAllocator<wide_t> alloc;
+
+    // over-aligned types and arrays bypass the pool, alignment is kept
+    wide_t *one = alloc.allocate(1);
+    wide_t *many = alloc.allocate(3);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(one) % alignof(wide_t), 0u);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(many) % alignof(wide_t), 0u);
+    alloc.deallocate(one, 1);
+    alloc.deallocate(many, 3);
+    ASSERT_EQ(alloc.pool()->slabs(), 0u);
+
+    ASSERT_THROW((void)alloc.allocate(SIZE_MAX / 2), std::bad_alloc);
+}